@@ -1,14 +1,25 @@
 /*
  * cli.c - Command Line Interface implementation
- * version 0.0.5
- * Updated with file management commands (ls, touch, cd, pwd, rm, mkdir)
+ * version 0.0.19
+ * Updated with file management commands (ls, touch, cd, pwd, rm, mkdir),
+ * the gfxbench graphics benchmark, console scroll mode selection,
+ * console flush policy, display mode setting, an image viewer,
+ * screenshots, mouse cursor statistics, virtual consoles and a
+ * particle demo
+ * The shell runs on virtual console 1; demo results are also logged
+ * to virtual console 2. A key pressed while another console is shown
+ * only brings the shell back
  */
 
 #include "cli.h"
 #include "drivers/video/fb_console.h"
 #include "drivers/input/keyboard.h"
+#include "drivers/input/mouse.h"
+#include "drivers/video/cursor.h"
 #include "drivers/video/graphics.h"
 #include "demo.h"
+#include "gfxbench.h"
+#include "image.h"
 #include "utils.h"
 #include "drivers/fs/fat32.h"
 #include "drivers/fs/ramdisk.h"
@@ -18,6 +29,9 @@
 static char cmd_buffer[CMD_BUFFER_SIZE];
 static int cmd_pos = 0;
 
+/* Virtual console collecting demo results */
+#define LOG_VT 1
+
 /* Prompt string */
 static const char *prompt = "kryos> ";
 
@@ -27,6 +41,7 @@ static const char *cmd_help = "help";
 static const char *cmd_halt = "halt";
 static const char *cmd_clear = "clear";
 static const char *cmd_test = "test";
+static const char *cmd_particles = "particles";
 static const char *cmd_shutdown = "shutdown";
 static const char *cmd_ls = "ls";
 static const char *cmd_touch = "touch";
@@ -34,6 +49,14 @@ static const char *cmd_cd = "cd";
 static const char *cmd_pwd = "pwd";
 static const char *cmd_rm = "rm";
 static const char *cmd_mkdir = "mkdir";
+static const char *cmd_gfxbench = "gfxbench";
+static const char *cmd_scroll = "scroll";
+static const char *cmd_flush = "flush";
+static const char *cmd_mode = "mode";
+static const char *cmd_view = "view";
+static const char *cmd_screenshot = "screenshot";
+static const char *cmd_mouse = "mouse";
+static const char *cmd_vt = "vt";
 static const char *cmd_crash = "sex";  /* Secret crash command */
 
 /* Compare two strings */
@@ -65,6 +88,22 @@ static const char *skip_spaces(const char *str) {
     return str;
 }
 
+/* Parse unsigned decimal number and advance past it, -1 if no digits */
+static int parse_uint(const char **str) {
+    const char *s = *str;
+    int value = 0;
+    
+    if (*s < '0' || *s > '9') {
+        return -1;
+    }
+    while (*s >= '0' && *s <= '9') {
+        value = value * 10 + (*s - '0');
+        s++;
+    }
+    *str = s;
+    return value;
+}
+
 /*
  * Echo command - print arguments
  */
@@ -85,12 +124,21 @@ static void cmd_help_exec(void) {
     fb_print("  shutdown     - Shutdown the system\n");
     fb_print("  clear        - Clear the screen\n");
     fb_print("  test         - Run graphics demo\n");
+    fb_print("  particles [N] - Run particle demo with N particles\n");
     fb_print("  ls           - List directory contents\n");
     fb_print("  touch <file> - Create empty file\n");
     fb_print("  cd <dir>     - Change directory\n");
     fb_print("  pwd          - Print working directory\n");
     fb_print("  rm <file>    - Delete file\n");
     fb_print("  mkdir <dir>  - Create directory\n");
+    fb_print("  gfxbench [N|compare] - Graphics benchmark suite (N iterations)\n");
+    fb_print("  scroll <hw|sw> - Select console scrolling mode\n");
+    fb_print("  flush [immediate|deferred|queued] - Console flush policy and stats\n");
+    fb_print("  mode [WxHxBPP] - List display modes or switch mode\n");
+    fb_print("  view [fit] <file> - Show a QOI or BMP image, fit scales it to the screen\n");
+    fb_print("  screenshot [qoi|bmp] [damage] <file> - Save the screen to a file\n");
+    fb_print("  mouse [show|hide|reset] - Mouse cursor and latency stats\n");
+    fb_print("  vt [1-6]     - Show a virtual console (or Alt+F1..F6)\n");
 }
 
 /*
@@ -98,6 +146,7 @@ static void cmd_help_exec(void) {
  */
 static void cmd_halt_exec(void) {
     fb_print("System halting...\n");
+    fb_flush();
     __asm__ __volatile__("cli; hlt");
 }
 
@@ -112,9 +161,58 @@ static void cmd_clear_exec(void) {
  * Test command - run graphics demo
  */
 static void cmd_test_exec(void) {
+    demo_stats_t stats;
+    int shell_vt;
+    
     fb_print("Starting graphics demo...\n");
     fb_print("Press any key to return to CLI.\n");
-    demo_rainbow_circle();
+    fb_flush();  /* Nothing left for the timer to draw over the demo */
+    demo_rainbow_circle(&stats);
+    
+    /* Demo drew over the console; repaint it from the cell grid */
+    fb_console_redraw();
+    demo_print_stats(&stats);
+    
+    /* Keep a record on the log console, drawn only when it is shown */
+    shell_vt = fb_vt_get_output();
+    fb_vt_print(LOG_VT, "graphics demo: ");
+    fb_vt_set_output(LOG_VT);
+    demo_print_stats(&stats);
+    fb_vt_set_output(shell_vt);
+}
+
+/*
+ * particles command - run the particle demo
+ */
+static void cmd_particles_exec(const char *args) {
+    demo_stats_t stats;
+    int count = 0;
+    int shell_vt;
+    
+    args = skip_spaces(args);
+    if (*args != '\0') {
+        count = parse_uint(&args);
+        if (count < 1 || count > DEMO_MAX_PARTICLES || *skip_spaces(args) != '\0') {
+            fb_print("Usage: particles [N], N = 1..");
+            fb_print_int(DEMO_MAX_PARTICLES);
+            fb_putchar('\n');
+            return;
+        }
+    }
+    
+    fb_print("Starting particle demo...\n");
+    fb_print("Press any key to return to CLI.\n");
+    fb_flush();
+    demo_particles(count, 0, &stats);
+    
+    fb_console_redraw();
+    demo_print_stats(&stats);
+    
+    shell_vt = fb_vt_get_output();
+    fb_vt_print(LOG_VT, "particle demo: ");
+    fb_vt_set_output(LOG_VT);
+    demo_print_stats(&stats);
+    fb_vt_set_output(shell_vt);
 }
 
 /*
@@ -236,6 +334,396 @@ static void cmd_mkdir_exec(const char *args) {
     }
 }
 
+/*
+ * gfxbench command - run the benchmark suite or the renderer comparisons
+ */
+static void cmd_gfxbench_exec(const char *args) {
+    int iterations = 0;
+    
+    args = skip_spaces(args);
+    
+    if (strcmp(args, "compare") == 0) {
+        fb_print("Running renderer comparisons...\n");
+        fb_flush();  /* Shown before the benchmarks take the screen */
+        gfxbench_compare();
+        return;
+    }
+    if (*args != '\0') {
+        iterations = parse_uint(&args);
+        if (iterations < 1 || iterations > GFXBENCH_MAX_ITERATIONS || *skip_spaces(args) != '\0') {
+            fb_print("Usage: gfxbench [N|compare], N = 1..");
+            fb_print_int(GFXBENCH_MAX_ITERATIONS);
+            fb_putchar('\n');
+            return;
+        }
+    }
+    
+    fb_print("Running graphics benchmark...\n");
+    fb_flush();  /* Shown before the benchmark takes the screen */
+    gfxbench_run(iterations);
+}
+
+/*
+ * scroll command - select hardware or software console scrolling
+ */
+static void cmd_scroll_exec(const char *args) {
+    args = skip_spaces(args);
+    
+    if (strcmp(args, "hw") == 0) {
+        if (fb_console_set_hw_scroll(1) != 0) {
+            fb_print("Error: Hardware scrolling not supported\n");
+        } else {
+            fb_print("Hardware scrolling enabled\n");
+        }
+    } else if (strcmp(args, "sw") == 0) {
+        fb_console_set_hw_scroll(0);
+        fb_print("Software scrolling enabled\n");
+    } else {
+        fb_print("Usage: scroll <hw|sw>\n");
+        fb_print("Current mode: ");
+        fb_print(fb_console_get_hw_scroll() ? "hw\n" : "sw\n");
+    }
+}
+
+/*
+ * flush command - select console flush policy, show swap statistics
+ */
+static void cmd_flush_exec(const char *args) {
+    static const char *mode_names[] = {"immediate", "deferred", "queued"};
+    uint32_t requests, flushes;
+    uint32_t bytes, peak, stalls;
+    
+    args = skip_spaces(args);
+    
+    if (strcmp(args, "immediate") == 0) {
+        fb_set_flush_mode(FB_FLUSH_IMMEDIATE);
+    } else if (strcmp(args, "deferred") == 0) {
+        fb_set_flush_mode(FB_FLUSH_DEFERRED);
+    } else if (strcmp(args, "queued") == 0) {
+        fb_set_flush_mode(FB_FLUSH_QUEUED);
+    } else if (*args != '\0') {
+        fb_print("Usage: flush [immediate|deferred|queued]\n");
+        return;
+    }
+    
+    fb_get_flush_stats(&requests, &flushes);
+    fb_get_queue_stats(&bytes, &peak, &stalls);
+    
+    fb_print("Flush mode: ");
+    fb_print(mode_names[fb_get_flush_mode()]);
+    fb_putchar('\n');
+    fb_print("Flush requests: ");
+    fb_print_int((int)requests);
+    fb_print("\nSwaps: ");
+    fb_print_int((int)flushes);
+    fb_print("\nSwaps saved: ");
+    fb_print_int(requests > flushes ? (int)(requests - flushes) : 0);
+    fb_print("\nQueued bytes: ");
+    fb_print_int((int)bytes);
+    fb_print(" (peak ");
+    fb_print_int((int)peak);
+    fb_print(", writer drains ");
+    fb_print_int((int)stalls);
+    fb_print(")\n");
+}
+
+/*
+ * Print a mode as WxHxBPP
+ */
+static void print_mode(int width, int height, int bpp) {
+    fb_print_int(width);
+    fb_putchar('x');
+    fb_print_int(height);
+    fb_putchar('x');
+    fb_print_int(bpp);
+}
+
+/*
+ * mode command - list display modes or switch to one
+ */
+static void cmd_mode_exec(const char *args) {
+    gfx_mode_t mode;
+    int width, height, bpp;
+    int i;
+    
+    args = skip_spaces(args);
+    
+    if (*args == '\0') {
+        for (i = 0; gfx_get_mode(i, &mode) == 0; i++) {
+            fb_print("  ");
+            print_mode(mode.width, mode.height, mode.bpp);
+            if (mode.width == gfx_get_width() && mode.height == gfx_get_height() &&
+                mode.bpp == gfx_get_bpp()) {
+                fb_print(" (current)");
+            }
+            fb_putchar('\n');
+        }
+        return;
+    }
+    
+    width = parse_uint(&args);
+    if (width > 0 && *args == 'x') {
+        args++;
+        height = parse_uint(&args);
+        if (height > 0 && *args == 'x') {
+            args++;
+            bpp = parse_uint(&args);
+            if (bpp > 0 && *skip_spaces(args) == '\0') {
+                if (gfx_set_mode(width, height, bpp) != 0) {
+                    fb_print("Error: Mode not supported\n");
+                    return;
+                }
+                fb_console_resize();
+                fb_print("Mode set to ");
+                print_mode(gfx_get_width(), gfx_get_height(), gfx_get_bpp());
+                fb_putchar('\n');
+                return;
+            }
+        }
+    }
+    
+    fb_print("Usage: mode [WxHxBPP]\n");
+}
+
+/* Skip a word and the spaces after it, or return 0 if it is not next */
+static const char *skip_word(const char *str, const char *word) {
+    while (*word) {
+        if (*str != *word) {
+            return 0;
+        }
+        str++;
+        word++;
+    }
+    if (*str != ' ' && *str != '\t') {
+        return 0;
+    }
+    return skip_spaces(str);
+}
+
+/*
+ * view command - decode an image file onto the screen, at its own size
+ * or fitted to the screen
+ */
+static void cmd_view_exec(const char *args) {
+    image_info_t info;
+    int width = 0, height = 0;
+    const char *next;
+    int result;
+    
+    args = skip_spaces(args);
+    if ((next = skip_word(args, "fit")) != 0) {
+        width = gfx_get_width();
+        height = gfx_get_height();
+        args = next;
+    }
+    if (*args == '\0') {
+        fb_print("Usage: view [fit] <file>\n");
+        return;
+    }
+    
+    fb_flush();
+    gfx_acquire();  /* The timer must not draw the console over the image */
+    gfx_clear(0x00000000);
+    result = image_view(args, 0, 0, width, height, &info);
+    
+    if (result == IMAGE_ERR_OPEN || result == IMAGE_ERR_FORMAT) {
+        gfx_release();
+        fb_console_redraw();
+        fb_print(result == IMAGE_ERR_OPEN ? "Error: File not found\n" :
+                 "Error: Not a QOI or uncompressed 24/32-bit BMP image\n");
+        return;
+    }
+    
+    gfx_swap_buffers();
+    keyboard_getchar();
+    gfx_release();
+    fb_console_redraw();
+    
+    fb_print_int(info.width);
+    fb_putchar('x');
+    fb_print_int(info.height);
+    fb_print(info.format == IMAGE_QOI ? " QOI, " : " BMP, ");
+    fb_print_int((int)info.bytes);
+    fb_print(" bytes in ");
+    fb_print_int((int)info.us);
+    fb_print(" us\n");
+    if (info.us > 0) {
+        /* Bytes per microsecond is MB/s */
+        fb_print("Throughput: ");
+        fb_print_int((int)(info.bytes / info.us));
+        fb_print(" MB/s read, ");
+        fb_print_int((int)((uint32_t)info.width * info.height * 4 / info.us));
+        fb_print(" MB/s decoded\n");
+    }
+    fb_print("Decoder memory: ");
+    fb_print_int((int)info.memory);
+    fb_print(" bytes\n");
+    if (result == IMAGE_ERR_DATA) {
+        fb_print("Warning: File ends before the last row\n");
+    }
+}
+
+/*
+ * screenshot command - save the screen, or the last presented
+ * rectangle, to a QOI or BMP file
+ */
+static void cmd_screenshot_exec(const char *args) {
+    image_info_t info;
+    int format = IMAGE_QOI;
+    int damage = 0;
+    int x = 0, y = 0;
+    int width = gfx_get_width();
+    int height = gfx_get_height();
+    const char *next;
+    int result;
+    
+    args = skip_spaces(args);
+    if ((next = skip_word(args, "qoi")) != 0) {
+        args = next;
+    } else if ((next = skip_word(args, "bmp")) != 0) {
+        format = IMAGE_BMP;
+        args = next;
+    }
+    if ((next = skip_word(args, "damage")) != 0) {
+        damage = 1;
+        args = next;
+    }
+    if (*args == '\0') {
+        fb_print("Usage: screenshot [qoi|bmp] [damage] <file>\n");
+        return;
+    }
+    
+    /* Hardware scrolling draws the console straight into video memory,
+     * past what the back buffer holds */
+    if (fb_console_get_hw_scroll()) {
+        fb_print("Error: Screenshots need software scrolling (scroll sw)\n");
+        return;
+    }
+    
+    /* Taken before the command's own output is presented */
+    if (damage && !gfx_get_presented_rect(&x, &y, &width, &height)) {
+        fb_print("Error: Nothing presented yet\n");
+        return;
+    }
+    
+    fb_flush();  /* The back buffer matches the screen */
+    result = image_save(args, format, x, y, width, height, &info);
+    
+    if (result == IMAGE_ERR_OPEN) {
+        fb_print("Error: Cannot create file\n");
+        return;
+    }
+    if (result == IMAGE_ERR_FORMAT) {
+        fb_print("Error: Nothing to save\n");
+        return;
+    }
+    
+    fb_print_int(info.width);
+    fb_putchar('x');
+    fb_print_int(info.height);
+    fb_print(info.format == IMAGE_QOI ? " QOI, " : " BMP, ");
+    fb_print_int((int)info.bytes);
+    fb_print(" bytes in ");
+    fb_print_int((int)info.us);
+    fb_print(" us");
+    if (info.us > 0) {
+        fb_print(" (");
+        fb_print_int((int)(1000000 / info.us));
+        fb_print(" fps)");
+    }
+    fb_print("\n");
+    fb_print("Encoder memory: ");
+    fb_print_int((int)info.memory);
+    fb_print(" bytes\n");
+    if (result == IMAGE_ERR_WRITE) {
+        fb_print("Error: Disk full, file is incomplete\n");
+    }
+}
+
+/*
+ * mouse command - show or hide the cursor, print pointer statistics
+ */
+static void cmd_mouse_exec(const char *args) {
+    cursor_stats_t stats;
+    uint32_t packets, dropped;
+    int x, y;
+    
+    args = skip_spaces(args);
+    
+    if (strcmp(args, "show") == 0) {
+        cursor_set_visible(1);
+    } else if (strcmp(args, "hide") == 0) {
+        cursor_set_visible(0);
+    } else if (strcmp(args, "reset") == 0) {
+        cursor_reset_stats();
+    } else if (*args != '\0') {
+        fb_print("Usage: mouse [show|hide|reset]\n");
+        return;
+    }
+    
+    mouse_get_stats(&packets, &dropped);
+    cursor_get_position(&x, &y);
+    cursor_get_stats(&stats);
+    
+    fb_print("Cursor at ");
+    fb_print_int(x);
+    fb_putchar(',');
+    fb_print_int(y);
+    fb_print(cursor_get_visible() ? ", shown" : ", hidden");
+    fb_print(", buttons ");
+    fb_print_hex((uint32_t)mouse_get_buttons());
+    fb_print("\nPackets: ");
+    fb_print_int((int)packets);
+    fb_print(" (");
+    fb_print_int((int)dropped);
+    fb_print(" bytes skipped)\n");
+    fb_print("Moves: ");
+    fb_print_int((int)stats.moves);
+    fb_print(" (");
+    fb_print_int((int)stats.deferred);
+    fb_print(" waited for a screen update)\n");
+    fb_print("IRQ to screen ns: min ");
+    fb_print_int((int)stats.min_ns);
+    fb_print(" avg ");
+    fb_print_int((int)stats.avg_ns);
+    fb_print(" max ");
+    fb_print_int((int)stats.max_ns);
+    fb_print("\nRedraw per move: ");
+    fb_print_int((int)stats.draw_ns);
+    fb_print(" ns, ");
+    fb_print_int((int)stats.pixels);
+    fb_print(" pixels\n");
+}
+
+/*
+ * vt command - show a virtual console, print switch statistics
+ */
+static void cmd_vt_exec(const char *args) {
+    uint32_t switches, cells;
+    
+    args = skip_spaces(args);
+    
+    if (*args >= '1' && *args < '1' + FB_VT_COUNT && args[1] == '\0') {
+        fb_vt_switch(*args - '1');
+    } else if (*args != '\0') {
+        fb_print("Usage: vt [1-6]\n");
+        return;
+    }
+    
+    fb_vt_get_stats(&switches, &cells);
+    fb_print("Showing console ");
+    fb_print_int(fb_vt_get_active() + 1);
+    fb_print(", shell on ");
+    fb_print_int(fb_vt_get_output() + 1);
+    fb_print(", log on ");
+    fb_print_int(LOG_VT + 1);
+    fb_print("\nSwitches: ");
+    fb_print_int((int)switches);
+    fb_print(", last one drew ");
+    fb_print_int((int)cells);
+    fb_print(" cells\n");
+}
+
 /*
  * Crash command - intentionally cause a divide by zero exception
  */
@@ -302,6 +790,14 @@ void cli_process_command(const char *cmd) {
         return;
     }
     
+    /* particles command */
+    if (starts_with(cmd, cmd_particles)) {
+        if (cmd[9] == ' ' || cmd[9] == '\0') {
+            cmd_particles_exec(cmd + 9);
+            return;
+        }
+    }
+    
     /* ls command */
     if (starts_with(cmd, cmd_ls)) {
         if (cmd[2] == ' ' || cmd[2] == '\0') {
@@ -348,6 +844,70 @@ void cli_process_command(const char *cmd) {
         }
     }
     
+    /* gfxbench command */
+    if (starts_with(cmd, cmd_gfxbench)) {
+        if (cmd[8] == ' ' || cmd[8] == '\0') {
+            cmd_gfxbench_exec(cmd + 8);
+            return;
+        }
+    }
+    
+    /* scroll command */
+    if (starts_with(cmd, cmd_scroll)) {
+        if (cmd[6] == ' ' || cmd[6] == '\0') {
+            cmd_scroll_exec(cmd + 6);
+            return;
+        }
+    }
+    
+    /* flush command */
+    if (starts_with(cmd, cmd_flush)) {
+        if (cmd[5] == ' ' || cmd[5] == '\0') {
+            cmd_flush_exec(cmd + 5);
+            return;
+        }
+    }
+    
+    /* mode command */
+    if (starts_with(cmd, cmd_mode)) {
+        if (cmd[4] == ' ' || cmd[4] == '\0') {
+            cmd_mode_exec(cmd + 4);
+            return;
+        }
+    }
+    
+    /* view command */
+    if (starts_with(cmd, cmd_view)) {
+        if (cmd[4] == ' ' || cmd[4] == '\0') {
+            cmd_view_exec(cmd + 4);
+            return;
+        }
+    }
+    
+    /* screenshot command */
+    if (starts_with(cmd, cmd_screenshot)) {
+        if (cmd[10] == ' ' || cmd[10] == '\0') {
+            cmd_screenshot_exec(cmd + 10);
+            return;
+        }
+    }
+    
+    /* mouse command */
+    if (starts_with(cmd, cmd_mouse)) {
+        if (cmd[5] == ' ' || cmd[5] == '\0') {
+            cmd_mouse_exec(cmd + 5);
+            return;
+        }
+    }
+    
+    /* vt command */
+    if (starts_with(cmd, cmd_vt)) {
+        if (cmd[2] == ' ' || cmd[2] == '\0') {
+            cmd_vt_exec(cmd + 2);
+            return;
+        }
+    }
+    
     /* crash command (secret) */
     if (strcmp(cmd, cmd_crash) == 0) {
         cmd_crash_exec();
@@ -385,8 +945,18 @@ void cli_run(void) {
         
         /* Read command line */
         while (1) {
+            /* About to block: present everything written so far */
+            if (!keyboard_has_key()) {
+                fb_flush_pending();
+            }
             c = keyboard_getchar();
             
+            /* Never edit a command line that is not on screen */
+            if (fb_vt_get_active() != fb_vt_get_output()) {
+                fb_vt_switch(fb_vt_get_output());
+                continue;
+            }
+            
             if (c == '\n') {
                 /* Enter pressed - execute command */
                 fb_putchar('\n');
@@ -398,13 +968,11 @@ void cli_run(void) {
                 if (cmd_pos > 0) {
                     cmd_pos--;
                     fb_putchar('\b');
-                    fb_flush();  /* Flush so user sees it immediately */
                 }
             } else if (c >= ' ' && cmd_pos < CMD_BUFFER_SIZE - 1) {
                 /* Regular character */
                 cmd_buffer[cmd_pos++] = c;
                 fb_putchar(c);
-                fb_flush();  /* Flush so user sees it immediately */
             }
         }
     }
@@ -1,78 +1,480 @@
 /*
  * demo.c - Graphics demo implementation
- * version 0.0.9
+ * version 0.0.14
  * Optimized animated pulsating circle with keyboard exit
+ * Uses page flipping where the adapter supports it
+ * Only the ring between the old and new radius is redrawn; frame
+ * statistics are taken with the TSC and the timer tick
+ * Particle fountain: positions and velocities are kept one array per
+ * field and moved four at a time with SSE2, in chunks that each keep
+ * a bounding box; each frame erases the last frame's pixels, stores
+ * the new ones and presents only the box around both
  */
 
 #include "demo.h"
 #include "drivers/video/graphics.h"
+#include "drivers/video/raster.h"
 #include "drivers/input/keyboard.h"
 #include "drivers/video/fb_console.h"
+#include "timer.h"
 #include "utils.h"
 
+/* Radius range of the pulse */
+#define CIRCLE_MIN_RADIUS 100
+#define CIRCLE_MAX_RADIUS 200
+
+/* The hue steps every HUE_FRAMES frames; the disc is recolored then */
+#define HUE_FRAMES 8
+#define HUE_STEP   16
+
+/* Particles per update chunk, each with its own bounding box */
+#define PARTICLE_CHUNK  256
+#define PARTICLE_CHUNKS (DEMO_MAX_PARTICLES / PARTICLE_CHUNK)
+
+/* Positions and velocities are 16.16 fixed point pixels (per frame) */
+#define PARTICLE_GRAVITY 0x1000
+#define PARTICLE_SEED    4321
+
+/* Frame time of the paced particle demo */
+#define PARTICLE_FRAME_MS 16
+
+/* What one page currently shows */
+typedef struct {
+    int radius;     /* -1: nothing drawn yet */
+    int hue;
+} circle_page_t;
+
 /*
- * Run rainbow circle demo
- * Displays a pulsating circle that changes size
+ * Bring a page from what it shows to the given radius and hue
+ * Returns 0 if the page already matched
+ */
+static int draw_circle_step(circle_page_t *page, int cx, int cy, int radius, int hue) {
+    uint32_t color = gfx_hsv(hue, 255, 255);
+    
+    if (page->hue != hue) {
+        /* Hue changed: recolor the disc, erase what it no longer covers */
+        gfx_fill_circle(cx, cy, radius, color);
+        if (page->radius > radius) {
+            gfx_fill_annulus(cx, cy, radius, page->radius, 0x00000000);
+        }
+    } else if (radius > page->radius) {
+        gfx_fill_annulus(cx, cy, page->radius, radius, color);
+    } else if (radius < page->radius) {
+        gfx_fill_annulus(cx, cy, radius, page->radius, 0x00000000);
+    } else {
+        return 0;
+    }
+    
+    page->radius = radius;
+    page->hue = hue;
+    return 1;
+}
+
+/*
+ * Run the pulsating circle animation
+ * frames: frames to draw, 0 for no limit; paced: about 60 fps if set
  * Exits when any key is pressed
- * Optimized: only redraws the area that changed
+ * With GFX_PRESENT_FLIP_DISCARD the page being drawn holds the frame
+ * before last, so each of the two pages keeps its own radius and hue
+ * and is brought forward from that.
  */
-void demo_rainbow_circle(void) {
-    int cx = 800 / 2;
-    int cy = 600 / 2;
-    int base_radius = 100;
-    int max_radius = 200;
-    int prev_radius = 0;
-    int radius;
+static void run_circle(int frames, int paced, demo_stats_t *stats) {
+    int cx = gfx_get_width() / 2;
+    int cy = gfx_get_height() / 2;
+    circle_page_t pages[2];
+    int page_count;
+    int page = 0;
     int frame = 0;
-    int hue = 0;
-    uint32_t color;
+    int radius;
+    uint32_t start_ticks;
+    uint32_t draw_us = 0;
+    uint32_t pixels;
+    unsigned long long t0;
     
-    /* Clear screen to black once */
-    gfx_clear(0x00000000);
-    gfx_swap_buffers_full();
+    gfx_acquire();
+    /* Page flipping moves the display start, which hardware console
+     * scrolling also uses */
+    if (!fb_console_get_hw_scroll()) {
+        gfx_set_present_mode(GFX_PRESENT_FLIP_DISCARD);
+    }
+    page_count = (gfx_get_present_mode() == GFX_PRESENT_FLIP_DISCARD) ? 2 : 1;
+    
+    /* Clear every page to black once */
+    for (page = 0; page < page_count; page++) {
+        gfx_clear(0x00000000);
+        gfx_swap_buffers_full();
+        pages[page].radius = -1;
+        pages[page].hue = -1;
+    }
+    page = 0;
+    
+    raster_reset_stats();
+    start_ticks = timer_ticks();
     
     /* Main animation loop */
-    while (1) {
+    while (frames == 0 || frame < frames) {
         /* Check for key press to exit using keyboard buffer */
         if (keyboard_has_key()) {
             /* Consume the key */
             keyboard_getchar();
-            /* Clear screen before returning to CLI */
-            gfx_clear(0x00000000);
-            gfx_swap_buffers_full();
-            return;
+            break;
         }
         
-        /* Calculate pulsating radius */
-        radius = base_radius + (frame % 100);
+        /* Triangle wave between the minimum and maximum radius */
+        radius = CIRCLE_MIN_RADIUS + (frame % 100);
         if ((frame / 100) % 2 == 1) {
-            radius = base_radius + 100 - (frame % 100);
+            radius = CIRCLE_MAX_RADIUS - (frame % 100);
+        }
+        
+        t0 = rdtsc();
+        
+        if (!draw_circle_step(&pages[page], cx, cy, radius,
+                              (frame / HUE_FRAMES * HUE_STEP) % 360)) {
+            /* Present anyway so the pages keep alternating */
+            gfx_mark_dirty_rect(cx, cy, 1, 1);
+        }
+        gfx_swap_buffers();
+        
+        draw_us += timer_cycles_to_us((uint32_t)(rdtsc() - t0));
+        page = (page + 1) % page_count;
+        
+        if (paced) {
+            wait(16);
+        }
+        
+        frame++;
+    }
+    
+    if (stats) {
+        raster_get_stats(0, &pixels);
+        stats->frames = frame;
+        stats->ms = (timer_ticks() - start_ticks) * 1000 / TIMER_HZ;
+        stats->draw_us = draw_us;
+        stats->pixels = pixels;
+        stats->particles = 0;
+        stats->update_us = 0;
+    }
+    
+    /* Clear screen before returning to CLI */
+    gfx_clear(0x00000000);
+    gfx_swap_buffers_full();
+    gfx_set_present_mode(GFX_PRESENT_COPY);
+    gfx_release();
+}
+
+/* Particle state, one aligned array per field; kept together so the
+ * update kernel reaches every field from one base register */
+static struct {
+    int32_t x[DEMO_MAX_PARTICLES];
+    int32_t vx[DEMO_MAX_PARTICLES];
+    int32_t y[DEMO_MAX_PARTICLES];
+    int32_t vy[DEMO_MAX_PARTICLES];
+} part __attribute__((aligned(16)));
+
+/* Distance between the fields of one particle */
+#define PARTICLE_FIELD (DEMO_MAX_PARTICLES * 4)
+
+static uint32_t part_color[DEMO_MAX_PARTICLES] __attribute__((aligned(16)));
+
+/* Back buffer offset of each particle, this frame and last frame */
+static uint32_t part_offset[2][DEMO_MAX_PARTICLES] __attribute__((aligned(16)));
+
+/* Pixels covered by the particles of one chunk */
+typedef struct {
+    int x1, y1, x2, y2;
+} particle_box_t;
+
+static particle_box_t chunk_box[PARTICLE_CHUNKS];
+
+/* One frame's update: limits and constants in four lanes each */
+typedef struct {
+    int32_t max_x[4];           /* Offsets 0, 16, 32, 48 in the kernel */
+    int32_t max_y[4];
+    int32_t gravity[4];
+    int32_t pitch[4];
+    uint32_t *offset;           /* Where the new offsets go */
+} particle_job_t;
+
+/*
+ * Move the particles of chunks c1 to c2 - 1 by one frame
+ * Four particles per step: fall, move, bounce off the screen edges
+ * (negate the velocity, clamp the position), then the pixel offset
+ * y * pitch + x. Pixel coordinates fit in 16 bits with the top half
+ * clear, so pminsw/pmaxsw keep the bounding box and pmaddwd does the
+ * multiply.
+ */
+static void update_chunks(int c1, int c2, const particle_job_t *job) {
+    int32_t box[16] __attribute__((aligned(16)));
+    particle_box_t *out;
+    int c, i, lane;
+    
+    for (c = c1; c < c2; c++) {
+        for (lane = 0; lane < 4; lane++) {
+            box[lane] = 0x7FFF;         /* Smallest x */
+            box[lane + 4] = 0x7FFF;     /* Smallest y */
+            box[lane + 8] = 0;          /* Largest x */
+            box[lane + 12] = 0;         /* Largest y */
+        }
+        
+        for (i = c * PARTICLE_CHUNK; i < (c + 1) * PARTICLE_CHUNK; i += 4) {
+            __asm__ __volatile__(
+                /* x */
+                "movdqa (%0), %%xmm0\n\t"
+                "movdqa %c4(%0), %%xmm1\n\t"
+                "paddd %%xmm1, %%xmm0\n\t"
+                "pxor %%xmm4, %%xmm4\n\t"
+                "pcmpgtd %%xmm0, %%xmm4\n\t"
+                "movdqa %%xmm0, %%xmm5\n\t"
+                "pcmpgtd (%1), %%xmm5\n\t"
+                "movdqa %%xmm4, %%xmm6\n\t"
+                "por %%xmm5, %%xmm6\n\t"
+                "pxor %%xmm6, %%xmm1\n\t"
+                "psubd %%xmm6, %%xmm1\n\t"
+                "pandn %%xmm0, %%xmm4\n\t"
+                "movdqa (%1), %%xmm6\n\t"
+                "pand %%xmm5, %%xmm6\n\t"
+                "pandn %%xmm4, %%xmm5\n\t"
+                "por %%xmm6, %%xmm5\n\t"
+                "movdqa %%xmm5, (%0)\n\t"
+                "movdqa %%xmm1, %c4(%0)\n\t"
+                "movdqa %%xmm5, %%xmm0\n\t"
+                /* y, with gravity */
+                "movdqa %c5(%0), %%xmm2\n\t"
+                "movdqa %c6(%0), %%xmm3\n\t"
+                "paddd 32(%1), %%xmm3\n\t"
+                "paddd %%xmm3, %%xmm2\n\t"
+                "pxor %%xmm4, %%xmm4\n\t"
+                "pcmpgtd %%xmm2, %%xmm4\n\t"
+                "movdqa %%xmm2, %%xmm5\n\t"
+                "pcmpgtd 16(%1), %%xmm5\n\t"
+                "movdqa %%xmm4, %%xmm6\n\t"
+                "por %%xmm5, %%xmm6\n\t"
+                "pxor %%xmm6, %%xmm3\n\t"
+                "psubd %%xmm6, %%xmm3\n\t"
+                "pandn %%xmm2, %%xmm4\n\t"
+                "movdqa 16(%1), %%xmm6\n\t"
+                "pand %%xmm5, %%xmm6\n\t"
+                "pandn %%xmm4, %%xmm5\n\t"
+                "por %%xmm6, %%xmm5\n\t"
+                "movdqa %%xmm5, %c5(%0)\n\t"
+                "movdqa %%xmm3, %c6(%0)\n\t"
+                "movdqa %%xmm5, %%xmm2\n\t"
+                /* Pixel coordinates and bounding box */
+                "psrad $16, %%xmm0\n\t"
+                "psrad $16, %%xmm2\n\t"
+                "movdqa (%3), %%xmm4\n\t"
+                "pminsw %%xmm0, %%xmm4\n\t"
+                "movdqa %%xmm4, (%3)\n\t"
+                "movdqa 16(%3), %%xmm4\n\t"
+                "pminsw %%xmm2, %%xmm4\n\t"
+                "movdqa %%xmm4, 16(%3)\n\t"
+                "movdqa 32(%3), %%xmm4\n\t"
+                "pmaxsw %%xmm0, %%xmm4\n\t"
+                "movdqa %%xmm4, 32(%3)\n\t"
+                "movdqa 48(%3), %%xmm4\n\t"
+                "pmaxsw %%xmm2, %%xmm4\n\t"
+                "movdqa %%xmm4, 48(%3)\n\t"
+                /* Offset y * pitch + x */
+                "pmaddwd 48(%1), %%xmm2\n\t"
+                "paddd %%xmm0, %%xmm2\n\t"
+                "movdqa %%xmm2, (%2)"
+                :
+                : "r"(&part.x[i]), "r"(job), "r"(&job->offset[i]), "r"(box),
+                  "i"(PARTICLE_FIELD), "i"(PARTICLE_FIELD * 2), "i"(PARTICLE_FIELD * 3)
+                : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "memory"
+            );
         }
         
-        /* Only redraw if radius changed significantly */
-        if (radius != prev_radius) {
-            /* Cycle hue for rainbow effect */
-            hue = (hue + 2) % 360;
-            color = gfx_hsv(hue, 255, 255);
-            
-            /* Clear only the area that was drawn (dirty region) */
-            /* Draw black circle over previous position to erase */
-            if (prev_radius > 0) {
-                gfx_draw_circle(cx, cy, prev_radius + 2, 0x00000000);
+        out = &chunk_box[c];
+        out->x1 = box[0];
+        out->y1 = box[4];
+        out->x2 = box[8];
+        out->y2 = box[12];
+        for (lane = 1; lane < 4; lane++) {
+            if (box[lane] < out->x1) out->x1 = box[lane];
+            if (box[lane + 4] < out->y1) out->y1 = box[lane + 4];
+            if (box[lane + 8] > out->x2) out->x2 = box[lane + 8];
+            if (box[lane + 12] > out->y2) out->y2 = box[lane + 12];
+        }
+    }
+}
+
+/*
+ * Launch count particles from the bottom middle of the screen
+ * 4 to 12 pixels per frame up, up to 4 either way, hue by index
+ */
+static void init_particles(int count, int width, int height) {
+    uint32_t seed = PARTICLE_SEED;
+    int i;
+    
+    for (i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        part.vx[i] = (int32_t)((seed >> 8) % 0x80000) - 0x40000;
+        seed = seed * 1103515245 + 12345;
+        part.vy[i] = -(int32_t)(0x40000 + (seed >> 8) % 0x80000);
+        part.x[i] = (width / 2) << 16;
+        part.y[i] = (height - 1) << 16;
+        part_color[i] = gfx_hsv(i * 360 / count, 255, 255);
+    }
+}
+
+/*
+ * Run the particle fountain
+ * frames: frames to draw unpaced, 0 to run paced until a key is pressed
+ * The back buffer must keep the last frame, so this presents by copy.
+ */
+void demo_particles(int count, int frames, demo_stats_t *stats) {
+    static particle_job_t job __attribute__((aligned(16)));
+    int width = gfx_get_width();
+    int height = gfx_get_height();
+    gfx_pixel_t *pixels;
+    const uint32_t *offset;
+    particle_box_t now, box, last;
+    int chunks, c, i, lane;
+    int frame = 0;
+    int cur = 0;
+    uint32_t start_ticks;
+    uint32_t update_us = 0;
+    uint32_t draw_us = 0;
+    uint32_t written = 0;
+    unsigned long long t0, t1;
+    
+    if (count <= 0) count = DEMO_PARTICLES;
+    if (count > DEMO_MAX_PARTICLES) count = DEMO_MAX_PARTICLES;
+    count -= count % PARTICLE_CHUNK;
+    if (count == 0) count = PARTICLE_CHUNK;
+    chunks = count / PARTICLE_CHUNK;
+    
+    gfx_acquire();
+    gfx_set_present_mode(GFX_PRESENT_COPY);
+    gfx_clear(0x00000000);
+    gfx_swap_buffers_full();
+    pixels = gfx_get_double_buffer();
+    
+    /* pmaddwd takes the pitch as a signed 16-bit factor */
+    for (lane = 0; lane < 4; lane++) {
+        job.max_x[lane] = (width - 1) << 16;
+        job.max_y[lane] = (height - 1) << 16;
+        job.gravity[lane] = PARTICLE_GRAVITY;
+        job.pitch[lane] = gfx_get_buffer_pitch();
+    }
+    init_particles(count, width, height);
+    
+    start_ticks = timer_ticks();
+    
+    while (frames == 0 || frame < frames) {
+        if (keyboard_has_key()) {
+            keyboard_getchar();
+            break;
+        }
+        
+        t0 = rdtsc();
+        
+        job.offset = part_offset[cur];
+        update_chunks(0, chunks, &job);
+        
+        t1 = rdtsc();
+        
+        now = chunk_box[0];
+        for (c = 1; c < chunks; c++) {
+            if (chunk_box[c].x1 < now.x1) now.x1 = chunk_box[c].x1;
+            if (chunk_box[c].y1 < now.y1) now.y1 = chunk_box[c].y1;
+            if (chunk_box[c].x2 > now.x2) now.x2 = chunk_box[c].x2;
+            if (chunk_box[c].y2 > now.y2) now.y2 = chunk_box[c].y2;
+        }
+        box = now;
+        
+        /* Erase every old pixel before storing any new one, so a
+         * particle landing where another was stays visible */
+        if (frame > 0) {
+            offset = part_offset[cur ^ 1];
+            for (i = 0; i < count; i++) {
+                pixels[offset[i]] = 0;
             }
-            
-            /* Draw the new circle */
-            gfx_draw_circle(cx, cy, radius, color);
-            
-            /* Swap only the dirty region */
-            gfx_swap_buffers();
-            
-            prev_radius = radius;
+            if (last.x1 < box.x1) box.x1 = last.x1;
+            if (last.y1 < box.y1) box.y1 = last.y1;
+            if (last.x2 > box.x2) box.x2 = last.x2;
+            if (last.y2 > box.y2) box.y2 = last.y2;
+            written += count;
+        }
+        offset = part_offset[cur];
+        for (i = 0; i < count; i++) {
+            pixels[offset[i]] = (gfx_pixel_t)part_color[i];
         }
+        written += count;
         
-        /* Small delay */
-        wait(16);
+        gfx_mark_dirty_rect(box.x1, box.y1, box.x2 - box.x1 + 1, box.y2 - box.y1 + 1);
+        gfx_swap_buffers();
+        
+        update_us += timer_cycles_to_us((uint32_t)(t1 - t0));
+        draw_us += timer_cycles_to_us((uint32_t)(rdtsc() - t1));
+        last = now;
+        cur ^= 1;
+        
+        if (frames == 0) {
+            wait(PARTICLE_FRAME_MS);
+        }
         
         frame++;
     }
+    
+    if (stats) {
+        stats->frames = frame;
+        stats->ms = (timer_ticks() - start_ticks) * 1000 / TIMER_HZ;
+        stats->draw_us = draw_us;
+        stats->pixels = written;
+        stats->particles = count;
+        stats->update_us = update_us;
+    }
+    
+    gfx_clear(0x00000000);
+    gfx_swap_buffers_full();
+    gfx_release();
+}
+
+/*
+ * Run rainbow circle demo
+ * Displays a pulsating circle that changes size
+ * Exits when any key is pressed
+ */
+void demo_rainbow_circle(demo_stats_t *stats) {
+    run_circle(0, 1, stats);
+}
+
+/*
+ * Run the rainbow circle animation unpaced for a number of frames
+ */
+void demo_rainbow_circle_bench(int frames, demo_stats_t *stats) {
+    run_circle(frames, 0, stats);
+}
+
+/*
+ * Print demo statistics on the console
+ */
+void demo_print_stats(const demo_stats_t *stats) {
+    fb_print("Frames: ");
+    fb_print_int(stats->frames);
+    if (stats->ms > 0) {
+        fb_print("  fps: ");
+        fb_print_int(stats->frames * 1000 / stats->ms);
+    }
+    if (stats->frames > 0) {
+        fb_print("  pixels/frame: ");
+        fb_print_int(stats->pixels / stats->frames);
+        fb_print("  draw us/frame: ");
+        fb_print_int(stats->draw_us / stats->frames);
+    }
+    if (stats->particles > 0 && stats->frames > 0) {
+        fb_print("\n  particles: ");
+        fb_print_int(stats->particles);
+        if (stats->ms > 0) {
+            fb_print("  particles/s: ");
+            fb_print_int(mul_div(stats->particles, stats->frames * 1000, stats->ms));
+            fb_print("  frame us: ");
+            fb_print_int(stats->ms * 1000 / stats->frames);
+        }
+        fb_print("  update us/frame: ");
+        fb_print_int(stats->update_us / stats->frames);
+    }
+    fb_putchar('\n');
 }
@@ -1,12 +1,42 @@
 /*
  * demo.h - Graphics demo header
- * version 0.0.1
+ * version 0.0.3
  */
 
 #ifndef DEMO_H
 #define DEMO_H
 
-/* Run rainbow circle demo */
-void demo_rainbow_circle(void);
+#include "stdint.h"
+
+/* Statistics of a demo run */
+typedef struct {
+    uint32_t frames;    /* Frames presented */
+    uint32_t ms;        /* Wall time of the run */
+    uint32_t draw_us;   /* Time spent drawing and presenting */
+    uint32_t pixels;    /* Pixels written by the rasterizer */
+    uint32_t particles; /* Particles per frame, 0 for the circle */
+    uint32_t update_us; /* Time spent moving particles */
+} demo_stats_t;
+
+/* Particle counts: default, and the largest accepted */
+#define DEMO_PARTICLES     32768
+#define DEMO_MAX_PARTICLES 65536
+
+/* Run rainbow circle demo until a key is pressed
+ * stats may be 0 */
+void demo_rainbow_circle(demo_stats_t *stats);
+
+/* Run the same animation for a number of frames without pacing
+ * Stops early on a key press; stats may be 0 */
+void demo_rainbow_circle_bench(int frames, demo_stats_t *stats);
+
+/* Run the particle fountain with count particles (rounded down to a
+ * multiple of 256, 0 for DEMO_PARTICLES) until a key is pressed, or
+ * unpaced for a number of frames if frames is not 0; stats may be 0 */
+void demo_particles(int count, int frames, demo_stats_t *stats);
+
+/* Print fps, pixels per frame and draw time per frame, and for the
+ * particle demo particles per second and update and frame time */
+void demo_print_stats(const demo_stats_t *stats);
 
 #endif /* DEMO_H */
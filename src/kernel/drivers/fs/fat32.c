@@ -2,6 +2,8 @@
  * fat32.c - FAT32 filesystem driver implementation
  * Simplified FAT32 implementation for KryOS
  * No division operations to avoid division by zero exceptions
+ * A file's current cluster holds the byte before the position when the
+ * position is on a cluster boundary; reads and writes move on lazily
  */
 
 #include "fat32.h"
@@ -61,6 +63,9 @@ static uint8_t sector_buffer[512];
 /* Cluster buffer */
 static uint8_t cluster_buffer[CLUSTER_SIZE];
 
+/* Where the search for a free cluster starts */
+static uint32_t free_hint = 2;
+
 /*
  * Read a sector from disk
  */
@@ -104,15 +109,22 @@ static void set_fat_entry(uint32_t cluster, uint32_t value) {
 
 /*
  * Find a free cluster
+ * The search starts after the last cluster handed out and wraps once
  */
 static uint32_t find_free_cluster(void) {
     uint32_t cluster;
-    uint32_t max_cluster = boot_sector.total_sectors_32 >> 3;  /* >> 3 = / 8 */
+    uint32_t max_cluster = ((boot_sector.total_sectors_32 - data_start_sector) >> 3) + 2;  /* >> 3 = / 8 */
+    uint32_t count;
+    
+    if (free_hint < 2 || free_hint >= max_cluster) free_hint = 2;
     
-    for (cluster = 2; cluster < max_cluster; cluster++) {
+    cluster = free_hint;
+    for (count = 2; count < max_cluster; count++) {
         if (get_fat_entry(cluster) == 0) {
+            free_hint = cluster + 1;
             return cluster;
         }
+        if (++cluster == max_cluster) cluster = 2;
     }
     return 0;
 }
@@ -327,6 +339,7 @@ int fat32_init(void) {
     data_start_sector = fat_start_sector + boot_sector.num_fats * boot_sector.fat_size_32;
     root_cluster = boot_sector.root_cluster;
     current_dir_cluster = root_cluster;
+    free_hint = 2;
     
     /* Set current path to root */
     strcpy(current_path, "/");
@@ -411,6 +424,7 @@ int fat32_format(void) {
     data_start_sector = fat_start_sector + num_fats * fat_size;
     root_cluster = 2;
     current_dir_cluster = root_cluster;
+    free_hint = 2;
     strcpy(current_path, "/");
     
     return 0;
@@ -428,7 +442,7 @@ int fat32_open(const char *path, fat_file_t *file) {
         path++;
     }
     
-    if (find_dir_entry(cluster, path, &entry, 0, 0) != 0) {
+    if (find_dir_entry(cluster, path, &entry, &file->entry_cluster, &file->entry_offset) != 0) {
         return -1;
     }
     
@@ -439,14 +453,28 @@ int fat32_open(const char *path, fat_file_t *file) {
     file->position = 0;
     file->is_directory = (entry.attr & ATTR_DIRECTORY) != 0;
     file->is_open = 1;
+    file->is_modified = 0;
     
     return 0;
 }
 
 /*
  * Close a file
+ * Writing may have given the file its first cluster and a new size;
+ * both go back into the directory entry
  */
 void fat32_close(fat_file_t *file) {
+    if (file->is_open && file->is_modified) {
+        fat_dir_entry_t *entry;
+        
+        read_cluster(file->entry_cluster, cluster_buffer);
+        entry = (fat_dir_entry_t *)(cluster_buffer + file->entry_offset);
+        entry->fst_clus_hi = (file->first_cluster >> 16) & 0xFFFF;
+        entry->fst_clus_lo = file->first_cluster & 0xFFFF;
+        entry->file_size = file->file_size;
+        write_cluster(file->entry_cluster, cluster_buffer);
+        file->is_modified = 0;
+    }
     file->is_open = 0;
 }
 
@@ -465,6 +493,15 @@ int fat32_read(fat_file_t *file, void *buffer, uint32_t count) {
         uint32_t cluster_offset = file->position & (CLUSTER_SIZE - 1);  /* & 4095 = % 4096 */
         uint32_t bytes_to_read = count - bytes_read;
         
+        /* On a boundary: move on to the cluster holding the position */
+        if (cluster_offset == 0 && file->position > 0) {
+            uint32_t next_cluster = get_fat_entry(file->current_cluster);
+            if (next_cluster < 2 || next_cluster >= 0x0FFFFFF8) {
+                break;
+            }
+            file->current_cluster = next_cluster;
+        }
+        
         if (bytes_to_read > CLUSTER_SIZE - cluster_offset) {
             bytes_to_read = CLUSTER_SIZE - cluster_offset;
         }
@@ -477,13 +514,6 @@ int fat32_read(fat_file_t *file, void *buffer, uint32_t count) {
         
         bytes_read += bytes_to_read;
         file->position += bytes_to_read;
-        
-        if ((file->position & (CLUSTER_SIZE - 1)) == 0) {
-            file->current_cluster = get_fat_entry(file->current_cluster);
-            if (file->current_cluster >= 0x0FFFFFF8) {
-                break;
-            }
-        }
     }
     
     return bytes_read;
@@ -508,34 +538,50 @@ int fat32_write(fat_file_t *file, const void *buffer, uint32_t count) {
             bytes_to_write = CLUSTER_SIZE - cluster_offset;
         }
         
-        if (cluster_offset != 0 || bytes_to_write < CLUSTER_SIZE) {
-            read_cluster(file->current_cluster, cluster_buffer);
-        } else {
-            memset(cluster_buffer, 0, CLUSTER_SIZE);
-        }
-        
-        memcpy(cluster_buffer + cluster_offset, buf + bytes_written, bytes_to_write);
-        write_cluster(file->current_cluster, cluster_buffer);
-        
-        bytes_written += bytes_to_write;
-        file->position += bytes_to_write;
-        
-        if ((file->position & (CLUSTER_SIZE - 1)) == 0 && bytes_written < count) {
+        /* An empty file gets its first cluster */
+        if (file->first_cluster == 0) {
+            uint32_t new_cluster = find_free_cluster();
+            if (new_cluster == 0) {
+                break;
+            }
+            set_fat_entry(new_cluster, 0x0FFFFFFF);
+            file->first_cluster = new_cluster;
+            file->current_cluster = new_cluster;
+            file->is_modified = 1;
+        } else if (cluster_offset == 0 && file->position > 0) {
+            /* On a boundary: move on, extending the chain at its end */
             uint32_t next_cluster = get_fat_entry(file->current_cluster);
-            if (next_cluster >= 0x0FFFFFF8) {
+            if (next_cluster < 2 || next_cluster >= 0x0FFFFFF8) {
                 next_cluster = find_free_cluster();
                 if (next_cluster == 0) {
                     break;
                 }
-                set_fat_entry(file->current_cluster, next_cluster);
                 set_fat_entry(next_cluster, 0x0FFFFFFF);
+                set_fat_entry(file->current_cluster, next_cluster);
             }
             file->current_cluster = next_cluster;
         }
+        
+        if (bytes_to_write == CLUSTER_SIZE) {
+            /* Whole cluster: straight from the caller's buffer */
+            if (write_cluster(file->current_cluster, buf + bytes_written) != 0) {
+                break;
+            }
+        } else {
+            read_cluster(file->current_cluster, cluster_buffer);
+            memcpy(cluster_buffer + cluster_offset, buf + bytes_written, bytes_to_write);
+            if (write_cluster(file->current_cluster, cluster_buffer) != 0) {
+                break;
+            }
+        }
+        
+        bytes_written += bytes_to_write;
+        file->position += bytes_to_write;
     }
     
     if (file->position > file->file_size) {
         file->file_size = file->position;
+        file->is_modified = 1;
     }
     
     return bytes_written;
@@ -44,8 +44,11 @@ typedef struct {
     uint32_t current_cluster;
     uint32_t file_size;
     uint32_t position;
+    uint32_t entry_cluster;  /* Where the directory entry is */
+    uint32_t entry_offset;
     uint8_t is_directory;
     uint8_t is_open;
+    uint8_t is_modified;     /* Entry needs updating on close */
 } fat_file_t;
 
 /* Initialize FAT32 filesystem on RAM disk */
@@ -57,13 +60,14 @@ int fat32_format(void);
 /* Open a file */
 int fat32_open(const char *path, fat_file_t *file);
 
-/* Close a file */
+/* Close a file; a written file's size is saved to its directory entry */
 void fat32_close(fat_file_t *file);
 
 /* Read from a file */
 int fat32_read(fat_file_t *file, void *buffer, uint32_t count);
 
-/* Write to a file */
+/* Write to a file, growing it as needed
+ * Returns the bytes written, fewer if the disk is full */
 int fat32_write(fat_file_t *file, const void *buffer, uint32_t count);
 
 /* Create a new file */
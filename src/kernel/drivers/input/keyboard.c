@@ -1,6 +1,6 @@
 /*
  * keyboard.c - Keyboard driver implementation
- * version 0.0.1
+ * version 0.0.2
  */
 
 #include "keyboard.h"
@@ -15,6 +15,9 @@ static int kb_buffer_tail = 0;
 /* Keyboard state flags */
 static unsigned char kb_flags = 0;
 
+/* Alt key combination handler */
+static int (*hotkey_callback)(unsigned char scancode, unsigned char flags) = 0;
+
 /* US QWERTY scancode to ASCII (normal, no shift) */
 static const char scancode_normal[128] = {
     0,    0,   '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b', '\t',
@@ -117,6 +120,13 @@ void keyboard_handler(void) {
         return;
     }
     
+    /* Alt combinations may be taken before they become characters */
+    if ((kb_flags & KEY_FLAG_ALT) && hotkey_callback) {
+        if (hotkey_callback(scancode, kb_flags)) {
+            return;
+        }
+    }
+    
     /* Get ASCII character based on shift state */
     if (kb_flags & KEY_FLAG_SHIFT) {
         ascii = scancode_shift[scancode];
@@ -183,3 +193,10 @@ char keyboard_getchar(void) {
 unsigned char keyboard_get_flags(void) {
     return kb_flags;
 }
+
+/*
+ * Set the Alt key combination callback
+ */
+void keyboard_set_hotkey_callback(int (*callback)(unsigned char scancode, unsigned char flags)) {
+    hotkey_callback = callback;
+}
@@ -1,6 +1,6 @@
 /*
  * keyboard.h - Keyboard driver header
- * version 0.0.1
+ * version 0.0.2
  */
 
 #ifndef KEYBOARD_H
@@ -54,4 +54,8 @@ int keyboard_has_key(void);
 /* Get current key state */
 unsigned char keyboard_get_flags(void);
 
+/* Set a callback for key presses made while Alt is held
+ * Runs in interrupt context; returning nonzero swallows the key */
+void keyboard_set_hotkey_callback(int (*callback)(unsigned char scancode, unsigned char flags));
+
 #endif /* KEYBOARD_H */
@@ -0,0 +1,188 @@
+/*
+ * mouse.c - PS/2 mouse driver implementation
+ * version 0.0.1
+ * The mouse sits on the keyboard controller's auxiliary port and sends
+ * standard three byte packets, one byte per IRQ12. The first byte
+ * always has bit 3 set; bytes are skipped until one does, so a lost
+ * byte costs at most one packet.
+ */
+
+#include "mouse.h"
+#include "../../utils.h"
+
+/* Keyboard controller ports and status bits */
+#define KBC_DATA         0x60
+#define KBC_STATUS       0x64
+#define KBC_COMMAND      0x64
+#define KBC_OUTPUT_FULL  0x01
+#define KBC_INPUT_FULL   0x02
+#define KBC_AUX_DATA     0x20
+
+/* Controller commands */
+#define KBC_READ_CONFIG  0x20
+#define KBC_WRITE_CONFIG 0x60
+#define KBC_ENABLE_AUX   0xA8
+#define KBC_WRITE_AUX    0xD4
+
+/* Controller configuration bits */
+#define CONFIG_AUX_IRQ   0x02
+#define CONFIG_AUX_CLOCK 0x20   /* Set: auxiliary clock disabled */
+
+/* Mouse commands and reply */
+#define MOUSE_SET_DEFAULTS  0xF6
+#define MOUSE_ENABLE_REPORT 0xF4
+#define MOUSE_ACK           0xFA
+
+/* Packet byte 0 */
+#define PACKET_ALWAYS_1  0x08
+#define PACKET_X_SIGN    0x10
+#define PACKET_Y_SIGN    0x20
+#define PACKET_OVERFLOW  0xC0
+
+/* Polling limit for controller handshakes */
+#define KBC_TIMEOUT 100000
+
+static uint8_t packet[3];
+static int packet_len = 0;
+static int buttons = 0;
+static void (*event_callback)(const mouse_event_t *event) = 0;
+
+/* Statistics */
+static uint32_t packet_count = 0;
+static uint32_t dropped_count = 0;
+
+/* FPU/SSE state of the interrupted code, saved around the callback */
+static uint8_t fx_area[512] __attribute__((aligned(16)));
+
+/*
+ * Wait until the controller takes a byte, or has one for us
+ * Return 0, or -1 on timeout
+ */
+static int wait_write(void) {
+    int spin;
+    
+    for (spin = 0; spin < KBC_TIMEOUT; spin++) {
+        if (!(inb(KBC_STATUS) & KBC_INPUT_FULL)) return 0;
+    }
+    return -1;
+}
+
+static int wait_read(void) {
+    int spin;
+    
+    for (spin = 0; spin < KBC_TIMEOUT; spin++) {
+        if (inb(KBC_STATUS) & KBC_OUTPUT_FULL) return 0;
+    }
+    return -1;
+}
+
+/*
+ * Send a command to the mouse and check it is acknowledged
+ */
+static int mouse_command(uint8_t command) {
+    if (wait_write() != 0) return -1;
+    outb(KBC_COMMAND, KBC_WRITE_AUX);
+    if (wait_write() != 0) return -1;
+    outb(KBC_DATA, command);
+    if (wait_read() != 0) return -1;
+    return inb(KBC_DATA) == MOUSE_ACK ? 0 : -1;
+}
+
+/*
+ * Initialize the mouse
+ */
+int mouse_init(void) {
+    uint8_t config;
+    
+    packet_len = 0;
+    buttons = 0;
+    
+    if (wait_write() != 0) return -1;
+    outb(KBC_COMMAND, KBC_ENABLE_AUX);
+    
+    /* Route auxiliary data to IRQ12 and start its clock */
+    if (wait_write() != 0) return -1;
+    outb(KBC_COMMAND, KBC_READ_CONFIG);
+    if (wait_read() != 0) return -1;
+    config = inb(KBC_DATA);
+    config |= CONFIG_AUX_IRQ;
+    config &= ~CONFIG_AUX_CLOCK;
+    if (wait_write() != 0) return -1;
+    outb(KBC_COMMAND, KBC_WRITE_CONFIG);
+    if (wait_write() != 0) return -1;
+    outb(KBC_DATA, config);
+    
+    if (mouse_command(MOUSE_SET_DEFAULTS) != 0) return -1;
+    if (mouse_command(MOUSE_ENABLE_REPORT) != 0) return -1;
+    
+    /* Enable IRQ12 on the slave PIC and the cascade on the master */
+    outb(0xA1, inb(0xA1) & ~0x10);
+    outb(0x21, inb(0x21) & ~0x04);
+    return 0;
+}
+
+/*
+ * Mouse interrupt handler
+ * Called from IRQ12 (interrupt 44)
+ */
+void mouse_handler(void) {
+    uint32_t stamp = (uint32_t)rdtsc();
+    mouse_event_t event;
+    uint8_t status = inb(KBC_STATUS);
+    uint8_t data;
+    
+    if ((status & (KBC_OUTPUT_FULL | KBC_AUX_DATA)) != (KBC_OUTPUT_FULL | KBC_AUX_DATA)) {
+        return;
+    }
+    data = inb(KBC_DATA);
+    
+    if (packet_len == 0 && !(data & PACKET_ALWAYS_1)) {
+        dropped_count++;
+        return;
+    }
+    packet[packet_len++] = data;
+    if (packet_len < 3) {
+        return;
+    }
+    packet_len = 0;
+    
+    /* Movement too fast to count; keep only the buttons */
+    event.dx = 0;
+    event.dy = 0;
+    if (!(packet[0] & PACKET_OVERFLOW)) {
+        event.dx = (int)packet[1] - ((packet[0] & PACKET_X_SIGN) ? 256 : 0);
+        event.dy = ((packet[0] & PACKET_Y_SIGN) ? 256 : 0) - (int)packet[2];
+    }
+    event.buttons = packet[0] & (MOUSE_LEFT | MOUSE_RIGHT | MOUSE_MIDDLE);
+    event.stamp = stamp;
+    buttons = event.buttons;
+    packet_count++;
+    
+    if (event_callback) {
+        __asm__ __volatile__("fxsave (%0)" : : "r"(fx_area) : "memory");
+        event_callback(&event);
+        __asm__ __volatile__("fxrstor (%0)" : : "r"(fx_area) : "memory");
+    }
+}
+
+/*
+ * Set the packet callback
+ */
+void mouse_set_callback(void (*callback)(const mouse_event_t *event)) {
+    event_callback = callback;
+}
+
+/*
+ * Buttons held now
+ */
+int mouse_get_buttons(void) {
+    return buttons;
+}
+
+/*
+ * Get statistics
+ */
+void mouse_get_stats(uint32_t *packets, uint32_t *dropped) {
+    *packets = packet_count;
+    *dropped = dropped_count;
+}
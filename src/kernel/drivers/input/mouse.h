@@ -0,0 +1,41 @@
+/*
+ * mouse.h - PS/2 mouse driver header
+ * version 0.0.1
+ */
+
+#ifndef MOUSE_H
+#define MOUSE_H
+
+#include "../../stdint.h"
+
+/* Button bits */
+#define MOUSE_LEFT   0x01
+#define MOUSE_RIGHT  0x02
+#define MOUSE_MIDDLE 0x04
+
+/* Decoded movement packet */
+typedef struct {
+    int dx;                     /* Right is positive */
+    int dy;                     /* Down is positive, as on screen */
+    int buttons;                /* MOUSE_* bits held */
+    uint32_t stamp;             /* Low TSC word when the last byte arrived */
+} mouse_event_t;
+
+/* Enable the auxiliary port and data reporting, and unmask IRQ12
+ * Call with interrupts disabled. Returns 0, or -1 if no mouse answers */
+int mouse_init(void);
+
+/* Mouse interrupt handler - called from IRQ12 */
+void mouse_handler(void);
+
+/* Set the function called from IRQ12 for every packet
+ * It may use SSE; the interrupted code's state is preserved */
+void mouse_set_callback(void (*callback)(const mouse_event_t *event));
+
+/* Buttons held now */
+int mouse_get_buttons(void);
+
+/* Packets decoded, and bytes dropped while finding a packet start */
+void mouse_get_stats(uint32_t *packets, uint32_t *dropped);
+
+#endif /* MOUSE_H */
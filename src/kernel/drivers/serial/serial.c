@@ -0,0 +1,93 @@
+/*
+ * serial.c - Serial port driver implementation
+ * version 0.0.1
+ * The UART is probed with its loopback mode, so a machine without
+ * COM1 simply has no serial output. Output is polled; nothing is read.
+ */
+
+#include "serial.h"
+#include "../../utils.h"
+
+/* COM1 registers */
+#define COM1            0x3F8
+#define UART_DATA       0   /* Divisor low byte while DLAB is set */
+#define UART_IER        1   /* Divisor high byte while DLAB is set */
+#define UART_FCR        2
+#define UART_LCR        3
+#define UART_MCR        4
+#define UART_LSR        5
+
+#define LCR_8N1         0x03
+#define LCR_DLAB        0x80
+#define LSR_THR_EMPTY   0x20
+#define MCR_LOOPBACK    0x10
+
+/* Spins on a full transmitter before giving up on a character */
+#define SERIAL_TIMEOUT  100000
+
+static int available = 0;
+
+/*
+ * Set up COM1 and check it with a loopback byte
+ */
+int serial_init(void) {
+    outb(COM1 + UART_IER, 0x00);            /* No interrupts */
+    outb(COM1 + UART_LCR, LCR_DLAB);
+    outb(COM1 + UART_DATA, 0x01);           /* Divisor 1: 115200 baud */
+    outb(COM1 + UART_IER, 0x00);
+    outb(COM1 + UART_LCR, LCR_8N1);
+    outb(COM1 + UART_FCR, 0xC7);            /* FIFOs on, cleared */
+    
+    outb(COM1 + UART_MCR, MCR_LOOPBACK | 0x0E);
+    outb(COM1 + UART_DATA, 0xAE);
+    if (inb(COM1 + UART_DATA) != 0xAE) {
+        available = 0;
+        return -1;
+    }
+    
+    outb(COM1 + UART_MCR, 0x0F);            /* DTR, RTS, OUT1, OUT2 */
+    available = 1;
+    return 0;
+}
+
+/*
+ * Check if serial output is available
+ */
+int serial_available(void) {
+    return available;
+}
+
+/*
+ * Send one byte once the transmitter has room
+ */
+static void put_byte(char c) {
+    int spin;
+    
+    for (spin = 0; spin < SERIAL_TIMEOUT; spin++) {
+        if (inb(COM1 + UART_LSR) & LSR_THR_EMPTY) {
+            outb(COM1 + UART_DATA, (unsigned char)c);
+            return;
+        }
+    }
+}
+
+/*
+ * Send a character
+ */
+void serial_putchar(char c) {
+    if (!available) return;
+    
+    if (c == '\n') {
+        put_byte('\r');
+    }
+    put_byte(c);
+}
+
+/*
+ * Send a string
+ */
+void serial_print(const char *str) {
+    while (*str) {
+        serial_putchar(*str++);
+    }
+}
@@ -0,0 +1,22 @@
+/*
+ * serial.h - Serial port driver header
+ * version 0.0.1
+ * Polled output on COM1 (115200 8N1)
+ */
+
+#ifndef SERIAL_H
+#define SERIAL_H
+
+/* Probe and set up COM1, returns 0 if a UART answered, -1 if not */
+int serial_init(void);
+
+/* Check if serial output is available */
+int serial_available(void);
+
+/* Send a character ('\n' goes out as "\r\n") */
+void serial_putchar(char c);
+
+/* Send a string */
+void serial_print(const char *str);
+
+#endif /* SERIAL_H */
@@ -0,0 +1,262 @@
+/*
+ * blend.c - Alpha blending and color-key blits implementation
+ * version 0.0.2
+ * Premultiplied alpha: dst = src + dst * (255 - src alpha) / 255.
+ * With an XRGB8888 back buffer four pixels are done per SSE2 iteration:
+ * pmullw forms the products and pmulhuw divides by 255 exactly. The
+ * RGB565 back buffer goes through the scalar path.
+ */
+
+#include "blend.h"
+#include "graphics.h"
+#include "pixfmt.h"
+
+#ifndef GFX_BACKBUFFER_16
+/* SSE2 constants */
+static const uint16_t words_255[8] __attribute__((aligned(16))) = {255, 255, 255, 255, 255, 255, 255, 255};
+static const uint16_t words_127[8] __attribute__((aligned(16))) = {127, 127, 127, 127, 127, 127, 127, 127};
+static const uint16_t words_8081[8] __attribute__((aligned(16))) = {
+    0x8081, 0x8081, 0x8081, 0x8081, 0x8081, 0x8081, 0x8081, 0x8081
+};
+#endif
+
+/* Source for gfx_blend_rect: four copies of the premultiplied color */
+static uint32_t fill_src[4] __attribute__((aligned(16)));
+
+/*
+ * Divide a product of two bytes by 255, rounded
+ * Gives the same result as (x + 127) * 0x8081 >> 23 in the SSE2 path
+ */
+static inline uint32_t div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+/*
+ * Premultiply an ARGB8888 color by its alpha
+ */
+uint32_t gfx_premultiply(uint32_t argb) {
+    uint32_t a = argb >> 24;
+    uint32_t r = div255(((argb >> 16) & 0xFF) * a);
+    uint32_t g = div255(((argb >> 8) & 0xFF) * a);
+    uint32_t b = div255((argb & 0xFF) * a);
+    
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+/*
+ * Premultiply ARGB8888 pixels in place
+ */
+void gfx_premultiply_pixels(uint32_t *pixels, int count) {
+    int i;
+    
+    for (i = 0; i < count; i++) {
+        pixels[i] = gfx_premultiply(pixels[i]);
+    }
+}
+
+/*
+ * Blend one premultiplied pixel over an XRGB8888 pixel
+ * All four bytes are blended, as the SSE2 path does
+ */
+static inline uint32_t blend_pixel(uint32_t dst, uint32_t src) {
+    uint32_t ia = 255 - (src >> 24);
+    uint32_t out = 0;
+    int shift;
+    
+    for (shift = 0; shift < 32; shift += 8) {
+        uint32_t c = ((src >> shift) & 0xFF) + div255(((dst >> shift) & 0xFF) * ia);
+        if (c > 255) c = 255;
+        out |= c << shift;
+    }
+    return out;
+}
+
+/*
+ * Blend count premultiplied pixels over a back buffer row
+ * If advance is 0 the four pixels at src are used for every group
+ */
+static void blend_row(gfx_pixel_t *dst, const uint32_t *src, int count, int advance) {
+    int i = 0;
+    
+#ifdef GFX_BACKBUFFER_16
+    for (; i < count; i++) {
+        dst[i] = pixfmt_to_565(blend_pixel(pixfmt_from_565(dst[i]), src[advance ? i : (i & 3)]));
+    }
+#else
+    const uint32_t *s = src;
+    
+    for (; i + 4 <= count; i += 4) {
+        __asm__ __volatile__(
+            "movdqu (%1), %%xmm0\n\t"
+            "movdqu (%0), %%xmm1\n\t"
+            "pxor %%xmm7, %%xmm7\n\t"
+            /* Widen source and destination bytes to words */
+            "movdqa %%xmm0, %%xmm2\n\t"
+            "punpcklbw %%xmm7, %%xmm0\n\t"
+            "punpckhbw %%xmm7, %%xmm2\n\t"
+            "movdqa %%xmm1, %%xmm3\n\t"
+            "punpcklbw %%xmm7, %%xmm1\n\t"
+            "punpckhbw %%xmm7, %%xmm3\n\t"
+            /* Broadcast each source alpha over its pixel, invert */
+            "pshuflw $0xFF, %%xmm0, %%xmm4\n\t"
+            "pshufhw $0xFF, %%xmm4, %%xmm4\n\t"
+            "pshuflw $0xFF, %%xmm2, %%xmm5\n\t"
+            "pshufhw $0xFF, %%xmm5, %%xmm5\n\t"
+            "movdqa %2, %%xmm6\n\t"
+            "psubw %%xmm4, %%xmm6\n\t"
+            "movdqa %2, %%xmm4\n\t"
+            "psubw %%xmm5, %%xmm4\n\t"
+            /* dst * (255 - a) / 255 */
+            "pmullw %%xmm6, %%xmm1\n\t"
+            "pmullw %%xmm4, %%xmm3\n\t"
+            "paddw %3, %%xmm1\n\t"
+            "paddw %3, %%xmm3\n\t"
+            "pmulhuw %4, %%xmm1\n\t"
+            "pmulhuw %4, %%xmm3\n\t"
+            "psrlw $7, %%xmm1\n\t"
+            "psrlw $7, %%xmm3\n\t"
+            /* + src, back to bytes */
+            "paddw %%xmm0, %%xmm1\n\t"
+            "paddw %%xmm2, %%xmm3\n\t"
+            "packuswb %%xmm3, %%xmm1\n\t"
+            "movdqu %%xmm1, (%0)"
+            :
+            : "r"(dst + i), "r"(s), "m"(words_255), "m"(words_127), "m"(words_8081)
+            : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", "memory"
+        );
+        if (advance) s += 4;
+    }
+    
+    for (; i < count; i++) {
+        dst[i] = blend_pixel(dst[i], advance ? src[i] : src[0]);
+    }
+#endif
+}
+
+/*
+ * Copy count pixels to a back buffer row, skipping those matching key
+ */
+static void colorkey_row(gfx_pixel_t *dst, const uint32_t *src, int count, uint32_t key) {
+    int i = 0;
+    
+    key &= 0x00FFFFFF;
+    
+#ifndef GFX_BACKBUFFER_16
+    for (; i + 4 <= count; i += 4) {
+        __asm__ __volatile__(
+            "movd %2, %%xmm3\n\t"
+            "pshufd $0, %%xmm3, %%xmm3\n\t"
+            "movd %3, %%xmm4\n\t"
+            "pshufd $0, %%xmm4, %%xmm4\n\t"
+            "movdqu (%1), %%xmm0\n\t"
+            "movdqu (%0), %%xmm1\n\t"
+            /* Mask of the pixels whose RGB equals the key */
+            "movdqa %%xmm0, %%xmm2\n\t"
+            "pand %%xmm4, %%xmm2\n\t"
+            "pcmpeqd %%xmm3, %%xmm2\n\t"
+            /* Keep dst there, take src elsewhere */
+            "pand %%xmm2, %%xmm1\n\t"
+            "pandn %%xmm0, %%xmm2\n\t"
+            "por %%xmm2, %%xmm1\n\t"
+            "movdqu %%xmm1, (%0)"
+            :
+            : "r"(dst + i), "r"(src + i), "r"(key), "r"(0x00FFFFFF)
+            : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "memory"
+        );
+    }
+#endif
+    
+    for (; i < count; i++) {
+        if ((src[i] & 0x00FFFFFF) != key) {
+            dst[i] = (gfx_pixel_t)gfx_color(src[i]);
+        }
+    }
+}
+
+/*
+ * Clip a destination rectangle to the draw target, moving the source
+ * origin with it. Returns 0 if nothing is left.
+ */
+static int clip_rect(int *x, int *y, int *width, int *height, int *src_x, int *src_y) {
+    int x1, y1, x2, y2;
+    
+    gfx_get_clip(&x1, &y1, &x2, &y2);
+    
+    if (*x < x1) { *width -= x1 - *x; *src_x += x1 - *x; *x = x1; }
+    if (*y < y1) { *height -= y1 - *y; *src_y += y1 - *y; *y = y1; }
+    if (*x + *width > x2 + 1) *width = x2 + 1 - *x;
+    if (*y + *height > y2 + 1) *height = y2 + 1 - *y;
+    
+    return *width > 0 && *height > 0;
+}
+
+/*
+ * Blend one color over a rectangle
+ */
+void gfx_blend_rect(int x, int y, int width, int height, uint32_t argb) {
+    int src_x = 0, src_y = 0;
+    int alpha = argb >> 24;
+    int row, pitch;
+    gfx_pixel_t *dst;
+    
+    if (alpha == 0) return;
+    if (alpha == 255) {
+        gfx_fill_rect(x, y, width, height, gfx_color(argb & 0x00FFFFFF));
+        return;
+    }
+    if (!clip_rect(&x, &y, &width, &height, &src_x, &src_y)) return;
+    
+    fill_src[0] = fill_src[1] = fill_src[2] = fill_src[3] = gfx_premultiply(argb);
+    
+    pitch = gfx_get_buffer_pitch();
+    dst = gfx_get_double_buffer() + y * pitch + x;
+    for (row = 0; row < height; row++) {
+        blend_row(dst, fill_src, width, 0);
+        dst += pitch;
+    }
+    gfx_mark_dirty_rect(x, y, width, height);
+}
+
+/*
+ * Blend a premultiplied image over the back buffer
+ */
+void gfx_blit_alpha(const uint32_t *src, int src_pitch, int x, int y, int width, int height) {
+    int src_x = 0, src_y = 0;
+    int row, pitch;
+    gfx_pixel_t *dst;
+    
+    if (!clip_rect(&x, &y, &width, &height, &src_x, &src_y)) return;
+    
+    src += src_y * src_pitch + src_x;
+    pitch = gfx_get_buffer_pitch();
+    dst = gfx_get_double_buffer() + y * pitch + x;
+    for (row = 0; row < height; row++) {
+        blend_row(dst, src, width, 1);
+        src += src_pitch;
+        dst += pitch;
+    }
+    gfx_mark_dirty_rect(x, y, width, height);
+}
+
+/*
+ * Copy an image over the back buffer, skipping key-colored pixels
+ */
+void gfx_blit_colorkey(const uint32_t *src, int src_pitch, int x, int y,
+                       int width, int height, uint32_t key) {
+    int src_x = 0, src_y = 0;
+    int row, pitch;
+    gfx_pixel_t *dst;
+    
+    if (!clip_rect(&x, &y, &width, &height, &src_x, &src_y)) return;
+    
+    src += src_y * src_pitch + src_x;
+    pitch = gfx_get_buffer_pitch();
+    dst = gfx_get_double_buffer() + y * pitch + x;
+    for (row = 0; row < height; row++) {
+        colorkey_row(dst, src, width, key);
+        src += src_pitch;
+        dst += pitch;
+    }
+    gfx_mark_dirty_rect(x, y, width, height);
+}
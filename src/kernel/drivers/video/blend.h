@@ -0,0 +1,37 @@
+/*
+ * blend.h - Alpha blending and color-key blits header
+ * version 0.0.2
+ * Draws over the back buffer instead of overwriting it
+ */
+
+#ifndef BLEND_H
+#define BLEND_H
+
+#include "../../stdint.h"
+
+/* Build an ARGB8888 color */
+static inline uint32_t gfx_argb(uint8_t a, uint8_t r, uint8_t g, uint8_t b) {
+    return ((uint32_t)a << 24) | ((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b;
+}
+
+/* Premultiply an ARGB8888 color by its alpha */
+uint32_t gfx_premultiply(uint32_t argb);
+
+/* Premultiply count ARGB8888 pixels in place (for gfx_blit_alpha) */
+void gfx_premultiply_pixels(uint32_t *pixels, int count);
+
+/* Blend one ARGB8888 color over a rectangle
+ * The color is straight (not premultiplied) alpha and is not passed
+ * through gfx_color; alpha 255 is a plain fill */
+void gfx_blend_rect(int x, int y, int width, int height, uint32_t argb);
+
+/* Blend a premultiplied ARGB8888 image over the back buffer at x, y
+ * src_pitch is in pixels; the image is clipped to the draw target */
+void gfx_blit_alpha(const uint32_t *src, int src_pitch, int x, int y, int width, int height);
+
+/* Copy an XRGB8888 image to the back buffer at x, y, leaving the
+ * pixels whose RGB equals key's RGB untouched (alpha byte ignored) */
+void gfx_blit_colorkey(const uint32_t *src, int src_pitch, int x, int y,
+                       int width, int height, uint32_t key);
+
+#endif /* BLEND_H */
@@ -0,0 +1,75 @@
+/*
+ * bochs_vbe.c - Bochs/QEMU VBE DISPI interface implementation
+ * version 0.0.2
+ */
+
+#include "bochs_vbe.h"
+#include "../../utils.h"
+
+/*
+ * Read a DISPI register
+ */
+uint16_t bochs_vbe_read(uint16_t index) {
+    outw(VBE_DISPI_IOPORT_INDEX, index);
+    return inw(VBE_DISPI_IOPORT_DATA);
+}
+
+/*
+ * Write a DISPI register
+ */
+void bochs_vbe_write(uint16_t index, uint16_t value) {
+    outw(VBE_DISPI_IOPORT_INDEX, index);
+    outw(VBE_DISPI_IOPORT_DATA, value);
+}
+
+/*
+ * Check if the DISPI interface is present
+ */
+int bochs_vbe_detect(void) {
+    uint16_t id = bochs_vbe_read(VBE_DISPI_INDEX_ID);
+    return id >= VBE_DISPI_ID0 && id <= VBE_DISPI_ID5;
+}
+
+/*
+ * Request a virtual height in lines
+ * QEMU derives the virtual height from video memory size when the
+ * virtual width is written, so read it back and clamp to the request.
+ */
+int bochs_vbe_set_virtual_height(int lines) {
+    int actual;
+    
+    bochs_vbe_write(VBE_DISPI_INDEX_VIRT_WIDTH, bochs_vbe_read(VBE_DISPI_INDEX_XRES));
+    bochs_vbe_write(VBE_DISPI_INDEX_VIRT_HEIGHT, (uint16_t)lines);
+    
+    actual = bochs_vbe_read(VBE_DISPI_INDEX_VIRT_HEIGHT);
+    if (actual > lines) {
+        actual = lines;
+    }
+    return actual;
+}
+
+/*
+ * Set the first visible line of the virtual framebuffer
+ */
+void bochs_vbe_set_y_offset(int line) {
+    bochs_vbe_write(VBE_DISPI_INDEX_Y_OFFSET, (uint16_t)line);
+}
+
+/*
+ * Program a new resolution and depth
+ * The adapter must be disabled while the geometry registers change.
+ */
+int bochs_vbe_set_mode(int width, int height, int bpp) {
+    bochs_vbe_write(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_DISABLED);
+    bochs_vbe_write(VBE_DISPI_INDEX_XRES, (uint16_t)width);
+    bochs_vbe_write(VBE_DISPI_INDEX_YRES, (uint16_t)height);
+    bochs_vbe_write(VBE_DISPI_INDEX_BPP, (uint16_t)bpp);
+    bochs_vbe_write(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED);
+    
+    if (bochs_vbe_read(VBE_DISPI_INDEX_XRES) != width ||
+        bochs_vbe_read(VBE_DISPI_INDEX_YRES) != height ||
+        bochs_vbe_read(VBE_DISPI_INDEX_BPP) != bpp) {
+        return -1;
+    }
+    return 0;
+}
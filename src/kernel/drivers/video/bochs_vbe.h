@@ -0,0 +1,58 @@
+/*
+ * bochs_vbe.h - Bochs/QEMU VBE DISPI interface header
+ * version 0.0.2
+ * Register access for the Bochs graphics adapter (QEMU std-vga)
+ */
+
+#ifndef BOCHS_VBE_H
+#define BOCHS_VBE_H
+
+#include "../../stdint.h"
+
+/* I/O ports */
+#define VBE_DISPI_IOPORT_INDEX  0x01CE
+#define VBE_DISPI_IOPORT_DATA   0x01CF
+
+/* Register indices */
+#define VBE_DISPI_INDEX_ID          0x0
+#define VBE_DISPI_INDEX_XRES        0x1
+#define VBE_DISPI_INDEX_YRES        0x2
+#define VBE_DISPI_INDEX_BPP         0x3
+#define VBE_DISPI_INDEX_ENABLE      0x4
+#define VBE_DISPI_INDEX_BANK        0x5
+#define VBE_DISPI_INDEX_VIRT_WIDTH  0x6
+#define VBE_DISPI_INDEX_VIRT_HEIGHT 0x7
+#define VBE_DISPI_INDEX_X_OFFSET    0x8
+#define VBE_DISPI_INDEX_Y_OFFSET    0x9
+#define VBE_DISPI_INDEX_VIDEO_MEMORY_64K 0xA
+
+/* ID values */
+#define VBE_DISPI_ID0   0xB0C0
+#define VBE_DISPI_ID5   0xB0C5
+
+/* ENABLE register bits */
+#define VBE_DISPI_DISABLED      0x00
+#define VBE_DISPI_ENABLED       0x01
+#define VBE_DISPI_LFB_ENABLED   0x40
+#define VBE_DISPI_NOCLEARMEM    0x80
+
+/* Check if the DISPI interface is present */
+int bochs_vbe_detect(void);
+
+/* Read a DISPI register */
+uint16_t bochs_vbe_read(uint16_t index);
+
+/* Write a DISPI register */
+void bochs_vbe_write(uint16_t index, uint16_t value);
+
+/* Request a virtual height in lines, returns the height actually available */
+int bochs_vbe_set_virtual_height(int lines);
+
+/* Set the first visible line of the virtual framebuffer */
+void bochs_vbe_set_y_offset(int line);
+
+/* Program a new resolution and depth with the linear framebuffer enabled
+ * Returns 0 on success, -1 if the adapter did not accept it */
+int bochs_vbe_set_mode(int width, int height, int bpp);
+
+#endif /* BOCHS_VBE_H */
@@ -0,0 +1,450 @@
+/*
+ * compositor.c - Layered surface compositor implementation
+ * version 0.0.2
+ * Damage is kept as a short list of disjoint screen rectangles. For each
+ * one the layers are walked top down: a layer's visible part is what is
+ * still uncovered, and opaque layers then cut their area out of it.
+ * Hidden layer pixels are never copied. The pieces are drawn bottom up,
+ * so keyed layers land on top of what they let through.
+ * A scaled layer is drawn piece by piece with the clip rectangle set to
+ * the piece, so every piece keeps the scale of the whole layer.
+ */
+
+#include "compositor.h"
+#include "scale.h"
+
+/* Rectangle, x2 and y2 exclusive */
+typedef struct {
+    int x1, y1;
+    int x2, y2;
+} comp_rect_t;
+
+/* Layer */
+typedef struct {
+    gfx_surface_t *surface;
+    int x, y;
+    int width, height;          /* Size on screen */
+    int z;
+    int mode;
+    uint32_t key;
+    int visible;
+    int used;
+} comp_layer_t;
+
+static comp_layer_t layers[COMP_MAX_LAYERS];
+static int order[COMP_MAX_LAYERS];     /* Layer ids, bottom to top */
+static int order_count = 0;
+static uint32_t background = 0;
+
+/* Damaged screen rectangles, disjoint */
+static comp_rect_t damage_list[COMP_MAX_DAMAGE];
+static int damage_count = 0;
+
+/* Region of the damage rectangle not yet covered by an opaque layer */
+static comp_rect_t uncovered[COMP_MAX_RECTS];
+static int uncovered_count = 0;
+static comp_rect_t scratch[COMP_MAX_RECTS];
+
+/* Visible pieces per stacking position */
+static comp_rect_t pieces[COMP_MAX_LAYERS][COMP_MAX_RECTS];
+static int piece_count[COMP_MAX_LAYERS];
+
+/* Statistics */
+static uint32_t composed_pixels = 0;
+static uint32_t culled_pixels = 0;
+
+static int area(const comp_rect_t *r) {
+    return (r->x2 - r->x1) * (r->y2 - r->y1);
+}
+
+/*
+ * Intersect two rectangles, returns 0 if they do not overlap
+ */
+static int intersect(const comp_rect_t *a, const comp_rect_t *b, comp_rect_t *out) {
+    out->x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+    out->y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+    out->x2 = a->x2 < b->x2 ? a->x2 : b->x2;
+    out->y2 = a->y2 < b->y2 ? a->y2 : b->y2;
+    return out->x1 < out->x2 && out->y1 < out->y2;
+}
+
+static void layer_rect(const comp_layer_t *layer, comp_rect_t *r) {
+    r->x1 = layer->x;
+    r->y1 = layer->y;
+    r->x2 = layer->x + layer->width;
+    r->y2 = layer->y + layer->height;
+}
+
+static int is_scaled(const comp_layer_t *layer) {
+    return layer->mode == COMP_OPAQUE &&
+           (layer->width != layer->surface->width || layer->height != layer->surface->height);
+}
+
+static comp_layer_t *get_layer(int id) {
+    if (id < 0 || id >= COMP_MAX_LAYERS || !layers[id].used) {
+        return (comp_layer_t *)0;
+    }
+    return &layers[id];
+}
+
+static void damage_layer(const comp_layer_t *layer) {
+    comp_damage(layer->x, layer->y, layer->width, layer->height);
+}
+
+/*
+ * Rebuild the bottom-to-top order (insertion sort on z, then id)
+ */
+static void sort_layers(void) {
+    int id, i;
+    
+    order_count = 0;
+    for (id = 0; id < COMP_MAX_LAYERS; id++) {
+        if (!layers[id].used) continue;
+        
+        for (i = order_count; i > 0 && layers[order[i - 1]].z > layers[id].z; i--) {
+            order[i] = order[i - 1];
+        }
+        order[i] = id;
+        order_count++;
+    }
+}
+
+/*
+ * Remove all layers
+ */
+void comp_init(uint32_t color) {
+    int id;
+    
+    for (id = 0; id < COMP_MAX_LAYERS; id++) {
+        layers[id].used = 0;
+    }
+    order_count = 0;
+    background = color;
+    damage_count = 0;
+    comp_damage(0, 0, gfx_get_width(), gfx_get_height());
+}
+
+/*
+ * Add a layer
+ */
+int comp_add_layer(gfx_surface_t *surface, int x, int y, int z, int mode) {
+    int id;
+    
+    for (id = 0; id < COMP_MAX_LAYERS; id++) {
+        if (!layers[id].used) break;
+    }
+    if (id == COMP_MAX_LAYERS) return -1;
+    
+    layers[id].surface = surface;
+    layers[id].x = x;
+    layers[id].y = y;
+    layers[id].width = surface->width;
+    layers[id].height = surface->height;
+    layers[id].z = z;
+    layers[id].mode = mode;
+    layers[id].key = 0;
+    layers[id].visible = 1;
+    layers[id].used = 1;
+    sort_layers();
+    damage_layer(&layers[id]);
+    return id;
+}
+
+/*
+ * Remove a layer; what it covered is recomposed
+ */
+void comp_remove_layer(int id) {
+    comp_layer_t *layer = get_layer(id);
+    
+    if (!layer) return;
+    damage_layer(layer);
+    layer->used = 0;
+    sort_layers();
+}
+
+/*
+ * Move a layer; both the old and new area are recomposed
+ */
+void comp_move_layer(int id, int x, int y) {
+    comp_layer_t *layer = get_layer(id);
+    
+    if (!layer || (layer->x == x && layer->y == y)) return;
+    damage_layer(layer);
+    layer->x = x;
+    layer->y = y;
+    damage_layer(layer);
+}
+
+/*
+ * Change a layer's stacking order
+ */
+void comp_set_layer_z(int id, int z) {
+    comp_layer_t *layer = get_layer(id);
+    
+    if (!layer || layer->z == z) return;
+    layer->z = z;
+    sort_layers();
+    damage_layer(layer);
+}
+
+/*
+ * Show or hide a layer
+ */
+void comp_show_layer(int id, int visible) {
+    comp_layer_t *layer = get_layer(id);
+    
+    if (!layer || layer->visible == visible) return;
+    layer->visible = visible;
+    damage_layer(layer);
+}
+
+/*
+ * Set the key color of a COMP_KEYED layer (back buffer format)
+ */
+void comp_set_layer_key(int id, uint32_t key) {
+    comp_layer_t *layer = get_layer(id);
+    
+    if (!layer) return;
+    layer->key = key;
+    damage_layer(layer);
+}
+
+/*
+ * Set the size a layer is shown at; the old and new area are recomposed
+ */
+void comp_set_layer_size(int id, int width, int height) {
+    comp_layer_t *layer = get_layer(id);
+    
+    if (!layer || width <= 0 || height <= 0) return;
+    damage_layer(layer);
+    layer->width = width;
+    layer->height = height;
+    damage_layer(layer);
+}
+
+/*
+ * Mark a screen rectangle for recomposition
+ * Rectangles that overlap are merged so nothing is composed twice; if
+ * the list is full everything collapses into one bounding rectangle.
+ */
+void comp_damage(int x, int y, int width, int height) {
+    comp_rect_t r;
+    comp_rect_t screen = {0, 0, 0, 0};
+    int i;
+    
+    screen.x2 = gfx_get_width();
+    screen.y2 = gfx_get_height();
+    r.x1 = x;
+    r.y1 = y;
+    r.x2 = x + width;
+    r.y2 = y + height;
+    if (width <= 0 || height <= 0 || !intersect(&r, &screen, &r)) return;
+    
+    i = 0;
+    while (i < damage_count) {
+        comp_rect_t *d = &damage_list[i];
+        comp_rect_t overlap;
+        
+        if (intersect(d, &r, &overlap)) {
+            if (d->x1 < r.x1) r.x1 = d->x1;
+            if (d->y1 < r.y1) r.y1 = d->y1;
+            if (d->x2 > r.x2) r.x2 = d->x2;
+            if (d->y2 > r.y2) r.y2 = d->y2;
+            *d = damage_list[--damage_count];
+            i = 0;   /* The grown rectangle may now touch earlier ones */
+        } else {
+            i++;
+        }
+    }
+    
+    if (damage_count == COMP_MAX_DAMAGE) {
+        for (i = 0; i < damage_count; i++) {
+            comp_rect_t *d = &damage_list[i];
+            if (d->x1 < r.x1) r.x1 = d->x1;
+            if (d->y1 < r.y1) r.y1 = d->y1;
+            if (d->x2 > r.x2) r.x2 = d->x2;
+            if (d->y2 > r.y2) r.y2 = d->y2;
+        }
+        damage_count = 0;
+    }
+    damage_list[damage_count++] = r;
+}
+
+/*
+ * Cut a rectangle out of the uncovered region
+ * Each piece splits into up to four; if the scratch list would
+ * overflow, the rest is kept whole. That only costs overdraw, since
+ * layers above are drawn later anyway.
+ */
+static void subtract(const comp_rect_t *cut) {
+    int i, n = 0;
+    
+    for (i = 0; i < uncovered_count; i++) {
+        const comp_rect_t *u = &uncovered[i];
+        comp_rect_t overlap;
+        
+        if (!intersect(u, cut, &overlap)) {
+            if (n == COMP_MAX_RECTS) return;
+            scratch[n++] = *u;
+            continue;
+        }
+        if (n + 4 > COMP_MAX_RECTS) return;
+        
+        /* Band above, band below, then left and right of the cut */
+        if (u->y1 < overlap.y1) {
+            scratch[n].x1 = u->x1; scratch[n].x2 = u->x2;
+            scratch[n].y1 = u->y1; scratch[n].y2 = overlap.y1;
+            n++;
+        }
+        if (overlap.y2 < u->y2) {
+            scratch[n].x1 = u->x1; scratch[n].x2 = u->x2;
+            scratch[n].y1 = overlap.y2; scratch[n].y2 = u->y2;
+            n++;
+        }
+        if (u->x1 < overlap.x1) {
+            scratch[n].x1 = u->x1; scratch[n].x2 = overlap.x1;
+            scratch[n].y1 = overlap.y1; scratch[n].y2 = overlap.y2;
+            n++;
+        }
+        if (overlap.x2 < u->x2) {
+            scratch[n].x1 = overlap.x2; scratch[n].x2 = u->x2;
+            scratch[n].y1 = overlap.y1; scratch[n].y2 = overlap.y2;
+            n++;
+        }
+    }
+    
+    for (i = 0; i < n; i++) {
+        uncovered[i] = scratch[i];
+    }
+    uncovered_count = n;
+}
+
+/*
+ * Draw a piece of a scaled layer, clipped to the piece
+ */
+static void draw_scaled(const comp_layer_t *layer, const comp_rect_t *r) {
+    const gfx_surface_t *s = layer->surface;
+    int cx1, cy1, cx2, cy2;
+    
+    gfx_get_clip(&cx1, &cy1, &cx2, &cy2);
+    gfx_set_clip(r->x1, r->y1, r->x2 - r->x1, r->y2 - r->y1);
+    gfx_blit_surface_scaled(s, 0, 0, s->width, s->height,
+                            layer->x, layer->y, layer->width, layer->height, GFX_SCALE_BILINEAR);
+    gfx_set_clip(cx1, cy1, cx2 - cx1 + 1, cy2 - cy1 + 1);
+}
+
+/*
+ * Compose one damaged rectangle
+ */
+static void compose_rect(const comp_rect_t *damaged) {
+    int k, i;
+    
+    uncovered[0] = *damaged;
+    uncovered_count = 1;
+    
+    /* Top down: find what each layer shows */
+    for (k = order_count - 1; k >= 0; k--) {
+        const comp_layer_t *layer = &layers[order[k]];
+        comp_rect_t bounds, clipped;
+        int shown = 0;
+        
+        piece_count[k] = 0;
+        layer_rect(layer, &bounds);
+        if (!layer->visible || !intersect(&bounds, damaged, &clipped)) continue;
+        
+        for (i = 0; i < uncovered_count; i++) {
+            comp_rect_t *piece = &pieces[k][piece_count[k]];
+            if (intersect(&uncovered[i], &bounds, piece)) {
+                shown += area(piece);
+                piece_count[k]++;
+            }
+        }
+        culled_pixels += area(&clipped) - shown;
+        
+        if (layer->mode == COMP_OPAQUE) {
+            subtract(&bounds);
+        }
+    }
+    
+    /* Bottom up: background, then each layer's pieces */
+    for (i = 0; i < uncovered_count; i++) {
+        const comp_rect_t *r = &uncovered[i];
+        gfx_fill_rect(r->x1, r->y1, r->x2 - r->x1, r->y2 - r->y1, background);
+        composed_pixels += area(r);
+    }
+    
+    for (k = 0; k < order_count; k++) {
+        const comp_layer_t *layer = &layers[order[k]];
+        
+        for (i = 0; i < piece_count[k]; i++) {
+            const comp_rect_t *r = &pieces[k][i];
+            int w = r->x2 - r->x1;
+            int h = r->y2 - r->y1;
+            
+            if (is_scaled(layer)) {
+                draw_scaled(layer, r);
+            } else if (layer->mode == COMP_KEYED) {
+                gfx_blit_surface_key(layer->surface, r->x1 - layer->x, r->y1 - layer->y,
+                                     r->x1, r->y1, w, h, layer->key);
+            } else {
+                gfx_blit_surface(layer->surface, r->x1 - layer->x, r->y1 - layer->y,
+                                 r->x1, r->y1, w, h);
+            }
+            composed_pixels += w * h;
+        }
+    }
+}
+
+/*
+ * Compose everything damaged since the last call
+ */
+void comp_compose(void) {
+    gfx_surface_t *saved = gfx_set_target((gfx_surface_t *)0);
+    int k, i;
+    
+    gfx_acquire();
+    
+    /* Pick up what was drawn into the layer surfaces */
+    for (k = 0; k < order_count; k++) {
+        comp_layer_t *layer = &layers[order[k]];
+        gfx_surface_t *s = layer->surface;
+        
+        if (layer->visible && s->dirty_x1 <= s->dirty_x2 && is_scaled(layer)) {
+            /* Bilinear output also depends on the neighbours of a
+             * source pixel, so the damage grows by one on each side */
+            int x1 = (s->dirty_x1 - 1) * layer->width / s->width;
+            int y1 = (s->dirty_y1 - 1) * layer->height / s->height;
+            int x2 = (s->dirty_x2 + 2) * layer->width / s->width + 1;
+            int y2 = (s->dirty_y2 + 2) * layer->height / s->height + 1;
+            comp_damage(layer->x + x1, layer->y + y1, x2 - x1, y2 - y1);
+        } else if (layer->visible && s->dirty_x1 <= s->dirty_x2) {
+            comp_damage(layer->x + s->dirty_x1, layer->y + s->dirty_y1,
+                        s->dirty_x2 - s->dirty_x1 + 1, s->dirty_y2 - s->dirty_y1 + 1);
+        }
+        gfx_surface_clear_dirty(s);
+    }
+    
+    for (i = 0; i < damage_count; i++) {
+        compose_rect(&damage_list[i]);
+    }
+    damage_count = 0;
+    
+    gfx_set_target(saved);
+    gfx_release();
+}
+
+/*
+ * Get compositor statistics
+ */
+void comp_get_stats(uint32_t *composed, uint32_t *culled) {
+    if (composed) *composed = composed_pixels;
+    if (culled) *culled = culled_pixels;
+}
+
+/*
+ * Reset compositor statistics
+ */
+void comp_reset_stats(void) {
+    composed_pixels = 0;
+    culled_pixels = 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * compositor.h - Layered surface compositor header
+ * version 0.0.2
+ * Stacks surfaces by z-order and composes damaged, visible regions
+ * into the back buffer; opaque layers may be shown scaled
+ */
+
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include "../../stdint.h"
+#include "graphics.h"
+
+/* Limits */
+#define COMP_MAX_LAYERS 8
+#define COMP_MAX_DAMAGE 16      /* Damage rectangles kept per frame */
+#define COMP_MAX_RECTS  64      /* Pieces a visible region may split into */
+
+/* Layer modes */
+#define COMP_OPAQUE     0       /* Hides everything below it */
+#define COMP_KEYED      1       /* Pixels equal to the key show what is below */
+
+/* Remove all layers; uncovered screen areas show the background color
+ * (back buffer format) */
+void comp_init(uint32_t background);
+
+/* Add a layer showing surface at x, y; higher z is on top
+ * Returns the layer id, or -1 if all layers are in use */
+int comp_add_layer(gfx_surface_t *surface, int x, int y, int z, int mode);
+
+/* Remove a layer */
+void comp_remove_layer(int id);
+
+/* Change a layer's position, stacking order, visibility or key */
+void comp_move_layer(int id, int x, int y);
+void comp_set_layer_z(int id, int z);
+void comp_show_layer(int id, int visible);
+void comp_set_layer_key(int id, uint32_t key);
+
+/* Show an opaque layer's surface scaled (bilinear) to width x height
+ * Keyed layers are always drawn at their surface size */
+void comp_set_layer_size(int id, int width, int height);
+
+/* Mark a screen rectangle for recomposition */
+void comp_damage(int x, int y, int width, int height);
+
+/* Compose everything damaged since the last call into the back buffer
+ * Layer surfaces report their own damage through their dirty rectangle.
+ * Presenting is left to gfx_swap_buffers */
+void comp_compose(void);
+
+/* Pixels written, and layer pixels skipped because they were hidden,
+ * since the last reset */
+void comp_get_stats(uint32_t *composed, uint32_t *culled);
+void comp_reset_stats(void);
+
+#endif /* COMPOSITOR_H */
@@ -0,0 +1,309 @@
+/*
+ * cursor.c - Mouse cursor overlay implementation
+ * version 0.0.1
+ * The sprite is never part of the frame: it is written into the visible
+ * video memory after a present, over a saved copy of what it covers.
+ * A move puts the saved pixels back and draws the sprite at the new
+ * place, two sprite-sized rectangles in all. While graphics updates the
+ * visible screen (see gfx_set_overlay) the sprite is taken off if it is
+ * in the way, and moves wait until the update is complete.
+ */
+
+#include "cursor.h"
+#include "graphics.h"
+#include "pixfmt.h"
+#include "../../string.h"
+#include "../../timer.h"
+#include "../../utils.h"
+
+/* Sprite: 'X' outline, 'o' fill, anything else transparent */
+static const char *const arrow[CURSOR_HEIGHT] = {
+    "X           ",
+    "XX          ",
+    "XoX         ",
+    "XooX        ",
+    "XoooX       ",
+    "XooooX      ",
+    "XoooooX     ",
+    "XooooooX    ",
+    "XoooooooX   ",
+    "XooooooooX  ",
+    "XoooooooooX ",
+    "XooooooooooX",
+    "XooooooXXXXX",
+    "XoooXooX    ",
+    "XooX XooX   ",
+    "XoX  XooX   ",
+    "XX    XooX  ",
+    "X     XooX  ",
+    "       XX   "
+};
+
+/* Sprite colors, XRGB8888 */
+#define OUTLINE_COLOR 0x00000000
+#define FILL_COLOR    0x00FFFFFF
+
+/* Hot spot, and the screen rectangle the sprite covers while drawn */
+static int cursor_x = 0, cursor_y = 0;
+static int drawn_x = 0, drawn_y = 0;
+static int drawn_width = 0, drawn_height = 0;
+static int drawn = 0;
+static int visible = 0;
+
+/* Screen updates in progress (overlay hide calls not yet shown) */
+static int hide_depth = 0;
+
+/* Video memory under the sprite, in framebuffer format */
+static uint8_t under[CURSOR_WIDTH * CURSOR_HEIGHT * 4];
+
+/* Oldest move not drawn yet */
+static int pending = 0;
+static int pending_deferred = 0;
+static uint32_t pending_stamp = 0;
+
+/* Statistics, in cycles */
+static uint32_t move_count = 0;
+static uint32_t deferred_count = 0;
+static uint32_t min_cycles = 0xFFFFFFFF;
+static uint32_t max_cycles = 0;
+static unsigned long long total_cycles = 0;
+static unsigned long long draw_cycles = 0;
+static uint32_t last_pixels = 0;
+
+/*
+ * Get a pixel of the visible screen
+ */
+static uint8_t *screen_pixel(int x, int y, int bytes) {
+    return (uint8_t *)gfx_get_screen_line(gfx_get_display_start() + y) + x * bytes;
+}
+
+/*
+ * Put the saved pixels back
+ */
+static void take_off(void) {
+    int bytes = gfx_get_bpp() / 8;
+    const uint8_t *saved = under;
+    int y;
+    
+    if (!drawn) return;
+    
+    for (y = 0; y < drawn_height; y++) {
+        memcpy(screen_pixel(drawn_x, drawn_y + y, bytes), saved, drawn_width * bytes);
+        saved += drawn_width * bytes;
+    }
+    drawn = 0;
+}
+
+/*
+ * Save what is under the hot spot and draw the sprite there
+ */
+static void put_on(void) {
+    const pixfmt_t *format = pixfmt_get(gfx_get_bpp());
+    uint8_t outline[4], fill[4];
+    uint8_t *saved = under;
+    int bytes, x, y;
+    
+    if (!format || !gfx_get_framebuffer()) return;
+    
+    bytes = format->bytes;
+    format->fill_row(outline, OUTLINE_COLOR, 1);
+    format->fill_row(fill, FILL_COLOR, 1);
+    
+    /* The screen may have shrunk since the last move */
+    if (cursor_x >= gfx_get_width()) cursor_x = gfx_get_width() - 1;
+    if (cursor_y >= gfx_get_height()) cursor_y = gfx_get_height() - 1;
+    
+    drawn_x = cursor_x;
+    drawn_y = cursor_y;
+    drawn_width = gfx_get_width() - cursor_x;
+    drawn_height = gfx_get_height() - cursor_y;
+    if (drawn_width > CURSOR_WIDTH) drawn_width = CURSOR_WIDTH;
+    if (drawn_height > CURSOR_HEIGHT) drawn_height = CURSOR_HEIGHT;
+    
+    for (y = 0; y < drawn_height; y++) {
+        uint8_t *dst = screen_pixel(drawn_x, drawn_y + y, bytes);
+        
+        memcpy(saved, dst, drawn_width * bytes);
+        saved += drawn_width * bytes;
+        
+        for (x = 0; x < drawn_width; x++) {
+            if (arrow[y][x] == 'X') {
+                memcpy(dst, outline, bytes);
+            } else if (arrow[y][x] == 'o') {
+                memcpy(dst, fill, bytes);
+            }
+            dst += bytes;
+        }
+    }
+    drawn = 1;
+}
+
+/*
+ * Bring the sprite in video memory up to date
+ * Called with interrupts disabled and no screen update in progress
+ */
+static void update(void) {
+    unsigned long long start;
+    uint32_t end, latency, pixels;
+    
+    if (!visible) {
+        take_off();
+        pending = 0;
+        return;
+    }
+    if (drawn && !pending) return;
+    
+    start = rdtsc();
+    pixels = drawn ? drawn_width * drawn_height : 0;
+    take_off();
+    put_on();
+    end = (uint32_t)rdtsc();
+    
+    if (pending) {
+        latency = end - pending_stamp;
+        if (latency < min_cycles) min_cycles = latency;
+        if (latency > max_cycles) max_cycles = latency;
+        total_cycles += latency;
+        draw_cycles += end - (uint32_t)start;
+        last_pixels = pixels + drawn_width * drawn_height;
+        move_count++;
+        if (pending_deferred) deferred_count++;
+        pending = 0;
+        pending_deferred = 0;
+    }
+}
+
+/*
+ * Overlay hide: take the sprite off if it is in the area about to change
+ */
+static void overlay_hide(int x1, int y1, int x2, int y2) {
+    unsigned int flags = irq_save();
+    
+    hide_depth++;
+    if (drawn && x1 < drawn_x + drawn_width && x2 >= drawn_x &&
+        y1 < drawn_y + drawn_height && y2 >= drawn_y) {
+        take_off();
+    }
+    irq_restore(flags);
+}
+
+/*
+ * Overlay show: redraw the sprite, at its latest place, once the
+ * outermost update is complete
+ */
+static void overlay_show(void) {
+    unsigned int flags = irq_save();
+    
+    if (hide_depth > 0) hide_depth--;
+    if (hide_depth == 0) update();
+    irq_restore(flags);
+}
+
+/*
+ * Install the overlay
+ */
+void cursor_init(void) {
+    cursor_x = gfx_get_width() / 2;
+    cursor_y = gfx_get_height() / 2;
+    drawn = 0;
+    visible = 0;
+    hide_depth = 0;
+    pending = 0;
+    cursor_reset_stats();
+    gfx_set_overlay(overlay_hide, overlay_show);
+}
+
+/*
+ * Show or hide the cursor
+ */
+void cursor_set_visible(int on) {
+    unsigned int flags = irq_save();
+    
+    visible = on ? 1 : 0;
+    if (hide_depth == 0) update();
+    irq_restore(flags);
+}
+
+int cursor_get_visible(void) {
+    return visible;
+}
+
+/*
+ * Move the hot spot
+ */
+void cursor_move_by(int dx, int dy, uint32_t stamp) {
+    unsigned int flags = irq_save();
+    int x = cursor_x + dx;
+    int y = cursor_y + dy;
+    
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (x >= gfx_get_width()) x = gfx_get_width() - 1;
+    if (y >= gfx_get_height()) y = gfx_get_height() - 1;
+    
+    if (x != cursor_x || y != cursor_y) {
+        cursor_x = x;
+        cursor_y = y;
+        if (!pending) {
+            pending = 1;
+            pending_stamp = stamp;
+        }
+        if (hide_depth > 0) {
+            pending_deferred = 1;
+        } else {
+            update();
+        }
+    }
+    irq_restore(flags);
+}
+
+/*
+ * Get the hot spot position
+ */
+void cursor_get_position(int *x, int *y) {
+    *x = cursor_x;
+    *y = cursor_y;
+}
+
+/*
+ * Average of a 64-bit total without 64-bit division
+ */
+static uint32_t average(unsigned long long total, uint32_t count) {
+    while (total >> 32) {
+        total >>= 1;
+        count >>= 1;
+    }
+    return count ? (uint32_t)total / count : 0;
+}
+
+/*
+ * Get statistics
+ */
+void cursor_get_stats(cursor_stats_t *stats) {
+    unsigned int flags = irq_save();
+    
+    stats->moves = move_count;
+    stats->deferred = deferred_count;
+    stats->min_ns = move_count ? timer_cycles_to_ns(min_cycles) : 0;
+    stats->avg_ns = timer_cycles_to_ns(average(total_cycles, move_count));
+    stats->max_ns = timer_cycles_to_ns(max_cycles);
+    stats->draw_ns = timer_cycles_to_ns(average(draw_cycles, move_count));
+    stats->pixels = last_pixels;
+    irq_restore(flags);
+}
+
+/*
+ * Reset statistics
+ */
+void cursor_reset_stats(void) {
+    unsigned int flags = irq_save();
+    
+    move_count = 0;
+    deferred_count = 0;
+    min_cycles = 0xFFFFFFFF;
+    max_cycles = 0;
+    total_cycles = 0;
+    draw_cycles = 0;
+    last_pixels = 0;
+    irq_restore(flags);
+}
@@ -0,0 +1,49 @@
+/*
+ * cursor.h - Mouse cursor overlay header
+ * version 0.0.1
+ * Arrow sprite drawn straight into video memory on top of the presented
+ * frame; the pixels it covers are saved and put back when it moves
+ */
+
+#ifndef CURSOR_H
+#define CURSOR_H
+
+#include "../../stdint.h"
+
+/* Sprite size; the hot spot is the top left pixel */
+#define CURSOR_WIDTH  12
+#define CURSOR_HEIGHT 19
+
+/* Statistics since the last reset
+ * Latency runs from the input interrupt to the sprite being in video
+ * memory at its new place */
+typedef struct {
+    uint32_t moves;             /* Moves drawn */
+    uint32_t deferred;          /* Moves that waited for a screen update */
+    uint32_t min_ns;
+    uint32_t avg_ns;
+    uint32_t max_ns;
+    uint32_t draw_ns;           /* Average time to redraw for a move */
+    uint32_t pixels;            /* Pixels restored and drawn by the last move */
+} cursor_stats_t;
+
+/* Install the overlay, with the cursor hidden in the middle of the screen */
+void cursor_init(void);
+
+/* Show or hide the cursor */
+void cursor_set_visible(int visible);
+int cursor_get_visible(void);
+
+/* Move the hot spot by dx, dy (clamped to the screen) for an input
+ * event that arrived when the low TSC word was stamp
+ * May be called from an interrupt handler */
+void cursor_move_by(int dx, int dy, uint32_t stamp);
+
+/* Get the hot spot position */
+void cursor_get_position(int *x, int *y);
+
+/* Get or reset statistics */
+void cursor_get_stats(cursor_stats_t *stats);
+void cursor_reset_stats(void);
+
+#endif /* CURSOR_H */
@@ -0,0 +1,419 @@
+/*
+ * displist.c - Deferred display list implementation
+ * version 0.0.1
+ * Ops are binned as they are recorded: each tile keeps a list of the
+ * ops whose bounds reach into it, in submission order. dl_flush then
+ * takes one tile at a time. A pass from the newest op back to the
+ * oldest finds ops hidden behind later opaque fills within that tile;
+ * the rest are replayed in order with the clip set to the tile, so the
+ * pixels being drawn over stay in cache.
+ */
+
+#include "displist.h"
+#include "graphics.h"
+#include "raster.h"
+#include "blend.h"
+#include "fb_console.h"
+
+/* Tile grid */
+#define DL_TILES_X  ((GFX_MAX_WIDTH + DL_TILE_SIZE - 1) / DL_TILE_SIZE)
+#define DL_TILES_Y  ((GFX_MAX_HEIGHT + DL_TILE_SIZE - 1) / DL_TILE_SIZE)
+#define DL_NO_BIN   0xFFFF
+
+/* Op types */
+#define DL_OP_FILL  0
+#define DL_OP_BLEND 1
+#define DL_OP_CIRCLE 2
+#define DL_OP_LINE  3
+#define DL_OP_TEXT  4
+
+/* Rectangle, inclusive */
+typedef struct {
+    int x1, y1;
+    int x2, y2;
+} dl_rect_t;
+
+/* Recorded op */
+typedef struct {
+    int type;
+    dl_rect_t bounds;       /* Pixels the op may touch, within the region */
+    int a, b, c, d;         /* Geometry, by type */
+    uint32_t color;
+} dl_op_t;
+
+/* Tile list entry */
+typedef struct {
+    uint16_t op;
+    uint16_t next;
+} dl_bin_t;
+
+static dl_op_t ops[DL_MAX_OPS];
+static int op_count = 0;
+static char text[DL_MAX_TEXT];
+static int text_used = 0;
+
+static dl_bin_t bins[DL_MAX_BINS];
+static int bin_count = 0;
+static uint16_t tile_head[DL_TILES_Y][DL_TILES_X];
+static uint16_t tile_tail[DL_TILES_Y][DL_TILES_X];
+
+/* Frame region: the clip rectangle at dl_begin, cut to the tile grid */
+static dl_rect_t region = {0, 0, -1, -1};
+static dl_rect_t frame_clip = {0, 0, -1, -1};
+static int tiles_x = 0, tiles_y = 0;
+
+/* Per-tile work */
+static uint16_t tile_ops[DL_MAX_OPS];
+static uint8_t keep[DL_MAX_OPS];
+static dl_rect_t occluders[DL_MAX_OCCLUDERS];
+static uint32_t cover[DL_TILE_SIZE][DL_TILE_SIZE / 32];
+
+static dl_stats_t stats;
+
+static int intersect(const dl_rect_t *a, const dl_rect_t *b, dl_rect_t *out) {
+    out->x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+    out->y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+    out->x2 = a->x2 < b->x2 ? a->x2 : b->x2;
+    out->y2 = a->y2 < b->y2 ? a->y2 : b->y2;
+    return out->x1 <= out->x2 && out->y1 <= out->y2;
+}
+
+static int contains(const dl_rect_t *outer, const dl_rect_t *inner) {
+    return inner->x1 >= outer->x1 && inner->y1 >= outer->y1 &&
+           inner->x2 <= outer->x2 && inner->y2 <= outer->y2;
+}
+
+static uint32_t area(const dl_rect_t *r) {
+    return (uint32_t)(r->x2 - r->x1 + 1) * (uint32_t)(r->y2 - r->y1 + 1);
+}
+
+static int count_bits(uint32_t v) {
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    v = (v + (v >> 4)) & 0x0F0F0F0F;
+    return (int)((v * 0x01010101) >> 24);
+}
+
+/*
+ * Empty the op list and the tile lists
+ */
+static void reset_list(void) {
+    int tx, ty;
+    
+    for (ty = 0; ty < tiles_y; ty++) {
+        for (tx = 0; tx < tiles_x; tx++) {
+            tile_head[ty][tx] = DL_NO_BIN;
+        }
+    }
+    op_count = 0;
+    text_used = 0;
+    bin_count = 0;
+}
+
+/*
+ * Start a frame over the current clip rectangle
+ */
+void dl_begin(void) {
+    gfx_get_clip(&frame_clip.x1, &frame_clip.y1, &frame_clip.x2, &frame_clip.y2);
+    region = frame_clip;
+    
+    if (region.x2 - region.x1 >= DL_TILES_X * DL_TILE_SIZE) {
+        region.x2 = region.x1 + DL_TILES_X * DL_TILE_SIZE - 1;
+    }
+    if (region.y2 - region.y1 >= DL_TILES_Y * DL_TILE_SIZE) {
+        region.y2 = region.y1 + DL_TILES_Y * DL_TILE_SIZE - 1;
+    }
+    
+    tiles_x = tiles_y = 0;
+    if (region.x1 <= region.x2 && region.y1 <= region.y2) {
+        tiles_x = (region.x2 - region.x1) / DL_TILE_SIZE + 1;
+        tiles_y = (region.y2 - region.y1) / DL_TILE_SIZE + 1;
+    }
+    reset_list();
+}
+
+/*
+ * Append an op and add it to every tile its bounds reach
+ * Flushes first if the op, its text or its tile entries do not fit.
+ * Returns the op to fill in, or 0 if it is outside the region.
+ */
+static dl_op_t *record(int type, int x1, int y1, int x2, int y2, int text_len) {
+    dl_rect_t bounds = {x1, y1, x2, y2};
+    dl_op_t *op;
+    int tx1, ty1, tx2, ty2, tx, ty;
+    
+    if (!intersect(&bounds, &region, &bounds)) return (dl_op_t *)0;
+    
+    tx1 = (bounds.x1 - region.x1) / DL_TILE_SIZE;
+    ty1 = (bounds.y1 - region.y1) / DL_TILE_SIZE;
+    tx2 = (bounds.x2 - region.x1) / DL_TILE_SIZE;
+    ty2 = (bounds.y2 - region.y1) / DL_TILE_SIZE;
+    
+    if (op_count == DL_MAX_OPS || text_used + text_len > DL_MAX_TEXT ||
+        bin_count + (tx2 - tx1 + 1) * (ty2 - ty1 + 1) > DL_MAX_BINS) {
+        dl_flush();
+    }
+    
+    op = &ops[op_count];
+    op->type = type;
+    op->bounds = bounds;
+    
+    for (ty = ty1; ty <= ty2; ty++) {
+        for (tx = tx1; tx <= tx2; tx++) {
+            dl_bin_t *bin = &bins[bin_count];
+            
+            bin->op = (uint16_t)op_count;
+            bin->next = DL_NO_BIN;
+            if (tile_head[ty][tx] == DL_NO_BIN) {
+                tile_head[ty][tx] = (uint16_t)bin_count;
+            } else {
+                bins[tile_tail[ty][tx]].next = (uint16_t)bin_count;
+            }
+            tile_tail[ty][tx] = (uint16_t)bin_count;
+            bin_count++;
+        }
+    }
+    stats.binned += (tx2 - tx1 + 1) * (ty2 - ty1 + 1);
+    stats.ops++;
+    op_count++;
+    return op;
+}
+
+/*
+ * Record a filled rectangle
+ */
+void dl_fill_rect(int x, int y, int width, int height, uint32_t color) {
+    dl_op_t *op;
+    
+    if (width <= 0 || height <= 0) return;
+    op = record(DL_OP_FILL, x, y, x + width - 1, y + height - 1, 0);
+    if (op) op->color = color;
+}
+
+/*
+ * Record a translucent rectangle (ARGB8888, not premultiplied)
+ */
+void dl_blend_rect(int x, int y, int width, int height, uint32_t argb) {
+    dl_op_t *op;
+    
+    /* Opaque colors become fills, so they can hide what is below */
+    if ((argb >> 24) == 255) {
+        dl_fill_rect(x, y, width, height, gfx_color(argb & 0x00FFFFFF));
+        return;
+    }
+    if ((argb >> 24) == 0 || width <= 0 || height <= 0) return;
+    op = record(DL_OP_BLEND, x, y, x + width - 1, y + height - 1, 0);
+    if (op) op->color = argb;
+}
+
+/*
+ * Record a filled circle
+ */
+void dl_fill_circle(int cx, int cy, int radius, uint32_t color) {
+    dl_op_t *op;
+    
+    if (radius < 0) return;
+    op = record(DL_OP_CIRCLE, cx - radius, cy - radius, cx + radius, cy + radius, 0);
+    if (op) {
+        op->a = cx;
+        op->b = cy;
+        op->c = radius;
+        op->color = color;
+    }
+}
+
+/*
+ * Record a line
+ */
+void dl_draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
+    dl_op_t *op;
+    
+    op = record(DL_OP_LINE, x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1,
+                x0 > x1 ? x0 : x1, y0 > y1 ? y0 : y1, 0);
+    if (op) {
+        op->a = x0;
+        op->b = y0;
+        op->c = x1;
+        op->d = y1;
+        op->color = color;
+    }
+}
+
+/*
+ * Record a line of text; the characters are copied
+ */
+void dl_text(int x, int y, const char *str, uint32_t color) {
+    dl_op_t *op;
+    int len = 0;
+    
+    while (str[len]) len++;
+    if (len == 0) return;
+    if (len > DL_MAX_TEXT - 1) len = DL_MAX_TEXT - 1;
+    
+    op = record(DL_OP_TEXT, x, y, x + len * 8 - 1, y + 7, len + 1);
+    if (op) {
+        int i;
+        
+        op->a = x;
+        op->b = y;
+        op->c = text_used;
+        op->color = color;
+        for (i = 0; i < len; i++) {
+            text[text_used++] = str[i];
+        }
+        text[text_used++] = '\0';
+    }
+}
+
+/*
+ * Replay one op, clipped to r (its bounds within the tile)
+ * Returns the number of pixels written
+ */
+static uint32_t replay(const dl_op_t *op, const dl_rect_t *r) {
+    uint32_t spans, before, after;
+    
+    switch (op->type) {
+        case DL_OP_FILL:
+            gfx_fill_rect(r->x1, r->y1, r->x2 - r->x1 + 1, r->y2 - r->y1 + 1, op->color);
+            return area(r);
+        case DL_OP_BLEND:
+            gfx_blend_rect(r->x1, r->y1, r->x2 - r->x1 + 1, r->y2 - r->y1 + 1, op->color);
+            return area(r);
+        case DL_OP_TEXT:
+            return fb_draw_text(op->a, op->b, &text[op->c], op->color);
+        default:
+            break;
+    }
+    
+    raster_get_stats(&spans, &before);
+    if (op->type == DL_OP_CIRCLE) {
+        gfx_fill_circle(op->a, op->b, op->c, op->color);
+    } else {
+        gfx_draw_line(op->a, op->b, op->c, op->d, op->color);
+    }
+    raster_get_stats(&spans, &after);
+    return after - before;
+}
+
+/*
+ * Record that the pixels of r (tile relative) were drawn into
+ */
+static void mark_covered(const dl_rect_t *r) {
+    int y, x;
+    
+    for (y = r->y1; y <= r->y2; y++) {
+        for (x = r->x1; x <= r->x2; ) {
+            int word = x >> 5;
+            int lo = x & 31;
+            int hi = r->x2 < (word << 5) + 31 ? r->x2 & 31 : 31;
+            uint32_t mask = (hi == 31 ? 0xFFFFFFFF : (1u << (hi + 1)) - 1) & ~((1u << lo) - 1);
+            
+            cover[y][word] |= mask;
+            x = (word << 5) + hi + 1;
+        }
+    }
+}
+
+/*
+ * Cull and replay the ops of one tile
+ */
+static void render_tile(int tx, int ty) {
+    dl_rect_t tile, r;
+    int count = 0, occluder_count = 0;
+    int i, j, y;
+    uint16_t b;
+    
+    tile.x1 = region.x1 + tx * DL_TILE_SIZE;
+    tile.y1 = region.y1 + ty * DL_TILE_SIZE;
+    tile.x2 = tile.x1 + DL_TILE_SIZE - 1;
+    tile.y2 = tile.y1 + DL_TILE_SIZE - 1;
+    if (tile.x2 > region.x2) tile.x2 = region.x2;
+    if (tile.y2 > region.y2) tile.y2 = region.y2;
+    
+    for (b = tile_head[ty][tx]; b != DL_NO_BIN; b = bins[b].next) {
+        tile_ops[count++] = bins[b].op;
+    }
+    
+    /* Newest first: drop ops that a later opaque fill hides */
+    for (i = count - 1; i >= 0; i--) {
+        const dl_op_t *op = &ops[tile_ops[i]];
+        
+        intersect(&op->bounds, &tile, &r);
+        keep[i] = 1;
+        for (j = 0; j < occluder_count; j++) {
+            if (contains(&occluders[j], &r)) {
+                keep[i] = 0;
+                stats.culled++;
+                stats.culled_pixels += area(&r);
+                break;
+            }
+        }
+        if (keep[i] && op->type == DL_OP_FILL && occluder_count < DL_MAX_OCCLUDERS) {
+            occluders[occluder_count++] = r;
+        }
+    }
+    
+    /* Oldest first: draw what is left */
+    for (y = 0; y < DL_TILE_SIZE; y++) {
+        for (j = 0; j < DL_TILE_SIZE / 32; j++) {
+            cover[y][j] = 0;
+        }
+    }
+    gfx_set_clip(tile.x1, tile.y1, tile.x2 - tile.x1 + 1, tile.y2 - tile.y1 + 1);
+    for (i = 0; i < count; i++) {
+        const dl_op_t *op = &ops[tile_ops[i]];
+        
+        if (!keep[i]) continue;
+        intersect(&op->bounds, &tile, &r);
+        stats.pixels += replay(op, &r);
+        
+        r.x1 -= tile.x1;
+        r.x2 -= tile.x1;
+        r.y1 -= tile.y1;
+        r.y2 -= tile.y1;
+        mark_covered(&r);
+    }
+    
+    for (y = 0; y < DL_TILE_SIZE; y++) {
+        for (j = 0; j < DL_TILE_SIZE / 32; j++) {
+            stats.covered += count_bits(cover[y][j]);
+        }
+    }
+}
+
+/*
+ * Draw the recorded ops tile by tile, then empty the list
+ */
+void dl_flush(void) {
+    int tx, ty;
+    
+    gfx_acquire();
+    if (op_count > 0) {
+        for (ty = 0; ty < tiles_y; ty++) {
+            for (tx = 0; tx < tiles_x; tx++) {
+                if (tile_head[ty][tx] != DL_NO_BIN) {
+                    render_tile(tx, ty);
+                }
+            }
+        }
+        gfx_set_clip(frame_clip.x1, frame_clip.y1,
+                     frame_clip.x2 - frame_clip.x1 + 1, frame_clip.y2 - frame_clip.y1 + 1);
+    }
+    reset_list();
+    gfx_release();
+}
+
+/*
+ * Get renderer statistics
+ */
+void dl_get_stats(dl_stats_t *out) {
+    *out = stats;
+}
+
+/*
+ * Reset renderer statistics
+ */
+void dl_reset_stats(void) {
+    dl_stats_t zero = {0, 0, 0, 0, 0, 0};
+    stats = zero;
+}
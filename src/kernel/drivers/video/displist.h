@@ -0,0 +1,53 @@
+/*
+ * displist.h - Deferred display list header
+ * version 0.0.1
+ * Records a frame of draw calls, bins them into screen tiles and
+ * replays one tile at a time
+ */
+
+#ifndef DISPLIST_H
+#define DISPLIST_H
+
+#include "../../stdint.h"
+
+/* Limits */
+#define DL_MAX_OPS      512     /* Ops recorded before an early flush */
+#define DL_MAX_TEXT     4096    /* Characters of dl_text recorded likewise */
+#define DL_MAX_BINS     4096    /* Op references across all tiles */
+#define DL_TILE_SIZE    64      /* Tile edge in pixels (multiple of 32) */
+#define DL_MAX_OCCLUDERS 16     /* Opaque rectangles tracked per tile */
+
+/* Renderer statistics */
+typedef struct {
+    uint32_t ops;               /* Ops recorded */
+    uint32_t binned;            /* Op references over all tiles */
+    uint32_t culled;            /* References skipped as hidden */
+    uint32_t pixels;            /* Pixels written */
+    uint32_t culled_pixels;     /* Pixels inside skipped references' bounds */
+    uint32_t covered;           /* Distinct pixels inside drawn op bounds */
+} dl_stats_t;
+
+/* Start a frame. Drawing goes to the current draw target, limited to its
+ * clip rectangle as it is now (at most GFX_MAX_WIDTH x GFX_MAX_HEIGHT) */
+void dl_begin(void);
+
+/* Record drawing calls; arguments as for the immediate versions
+ * Nothing is drawn until dl_flush, unless the list fills up first */
+void dl_fill_rect(int x, int y, int width, int height, uint32_t color);
+void dl_blend_rect(int x, int y, int width, int height, uint32_t argb);
+void dl_fill_circle(int cx, int cy, int radius, uint32_t color);
+void dl_draw_line(int x0, int y0, int x1, int y1, uint32_t color);
+
+/* Record a line of 8x8 text with a transparent background */
+void dl_text(int x, int y, const char *str, uint32_t color);
+
+/* Draw everything recorded and empty the list; the frame stays open */
+void dl_flush(void);
+
+/* Statistics since the last reset
+ * Overdraw is pixels / covered; culled_pixels is what immediate mode
+ * would have written on top of that */
+void dl_get_stats(dl_stats_t *stats);
+void dl_reset_stats(void);
+
+#endif /* DISPLIST_H */
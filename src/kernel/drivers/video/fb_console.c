@@ -1,18 +1,60 @@
 /*
  * fb_console.c - Framebuffer console implementation
- * version 0.0.1
+ * version 0.0.15
  * Text console for VBE graphics mode
+ * A character cell grid is the source of truth; pixels are rendered
+ * on demand from dirty rows only.
+ * Glyph rendering: scalar loop, cached tiles or SSE2 mask expansion
+ * Optional hardware scrolling through the Bochs/QEMU DISPI Y offset;
+ * glyphs then go to video memory, with the overlay taken off around them
+ * Deferred flushing: writes only record damage, fb_console_tick() or an
+ * explicit fb_flush() presents it with a single swap
+ * Bulk writes: fb_write() stores whole runs of characters at once
+ * The grid size follows the display mode (fb_console_resize)
+ * Text always goes to the screen, whatever the graphics draw target is;
+ * fb_draw_text is the exception, for free-standing text in graphics
+ * Cell colors are XRGB8888; glyphs are drawn in the back buffer format
+ * Virtual consoles: each has its own cell grid, cursor and colors.
+ * Writes go to the output console and only reach the pixels when it is
+ * the one shown; switching redraws the cells that differ from the
+ * screen, in one pass.
+ * VT100/ANSI escape sequences: a state machine with per-final-byte
+ * handler tables; sequences only edit cells, so a full-screen redraw
+ * is presented by one render of the cells that changed.
+ * Queued writes: a single-writer, single-reader byte ring. Writers only
+ * copy into it; the tick parses what was published, renders and swaps,
+ * unless the screen is held by a fullscreen client (gfx_acquire).
+ * Every other console call drains the ring first, so output keeps its
+ * order with clears, color changes and console switches.
  */
 
 #include "fb_console.h"
 #include "graphics.h"
+#include "../../string.h"
 #include "../../stdint.h"
 
 /* Console state */
-static int cursor_x = 0;
-static int cursor_y = 0;
-static uint32_t fg_color = 0x00FFFFFF;  /* White */
-static uint32_t bg_color = 0x00000000;  /* Black */
+static int render_mode = FB_RENDER_AUTO;
+
+/* Flush policy */
+static int flush_mode = FB_FLUSH_IMMEDIATE;
+static volatile int flush_pending = 0;  /* Damage not yet presented */
+static volatile int busy = 0;           /* Console code running, tick must wait */
+static uint32_t flush_requests = 0;     /* Points that would have swapped */
+static uint32_t flush_count = 0;        /* Swaps actually done */
+
+/* Write queue for FB_FLUSH_QUEUED; indexes run freely and are masked.
+ * Only writers move queue_head, only the drain moves queue_tail, and
+ * x86 keeps stores in order, so the bytes are in place before the head
+ * that publishes them. */
+#define QUEUE_SIZE 16384                /* Power of two */
+#define QUEUE_MASK (QUEUE_SIZE - 1)
+static char queue[QUEUE_SIZE];
+static volatile uint32_t queue_head = 0;
+static volatile uint32_t queue_tail = 0;
+static uint32_t queue_bytes = 0;        /* Bytes queued */
+static uint32_t queue_peak = 0;         /* Most bytes waiting at once */
+static uint32_t queue_stalls = 0;       /* Writes that found the ring full */
 
 /* Font: 8x8 bitmap font */
 static const uint8_t font[128][8] = {
@@ -153,206 +195,1917 @@ static const uint8_t font[128][8] = {
 #define CHAR_WIDTH 8
 #define CHAR_HEIGHT 12
 
-/* Console dimensions */
-#define CONSOLE_COLS (GFX_WIDTH / CHAR_WIDTH)
-#define CONSOLE_ROWS (GFX_HEIGHT / CHAR_HEIGHT)
+/* Console dimensions: storage for the largest mode, size follows the mode */
+#define CONSOLE_MAX_COLS (GFX_MAX_WIDTH / CHAR_WIDTH)
+#define CONSOLE_MAX_ROWS (GFX_MAX_HEIGHT / CHAR_HEIGHT)
+
+/* Character cell: codepoint plus attributes */
+typedef struct {
+    uint8_t ch;
+    uint32_t fg;
+    uint32_t bg;
+} fb_cell_t;
+
+static int console_cols = GFX_WIDTH / CHAR_WIDTH;
+static int console_rows = GFX_HEIGHT / CHAR_HEIGHT;
+
+/* Escape sequence parser states */
+#define ESC_GROUND   0    /* Plain text */
+#define ESC_ESCAPE   1    /* After ESC */
+#define ESC_CSI      2    /* After ESC [, collecting parameters */
+#define ESC_STRING   3    /* OSC/DCS payload, skipped up to BEL or ESC \ */
+#define ESC_CHARSET  4    /* After ESC ( and the like, one byte to skip */
+
+#define ESC_MAX_PARAMS 16
+
+/* Virtual console: a cell grid kept as a ring of rows (logical row 0
+ * is cells[top_row]), its cursor, its colors and its parser state */
+typedef struct {
+    fb_cell_t cells[CONSOLE_MAX_ROWS][CONSOLE_MAX_COLS];
+    int top_row;
+    int cursor_x;
+    int cursor_y;
+    int wrap_pending;           /* Last column written, wrap on next character */
+    int saved_x;
+    int saved_y;
+    int scroll_top;             /* Scroll region, rows inclusive */
+    int scroll_bottom;
+    uint32_t fg_color;          /* Colors given to new cells */
+    uint32_t bg_color;
+    uint32_t default_fg;        /* From fb_set_text_color, SGR 0/39/49 */
+    uint32_t default_bg;
+    uint32_t sgr_fg;            /* SGR colors before bold and reverse */
+    uint32_t sgr_bg;
+    int fg_index;               /* Basic palette entry of sgr_fg, or -1 */
+    int bold;
+    int reverse;
+    int esc_state;
+    int esc_ignore;             /* Private marker or intermediate seen */
+    int esc_count;              /* Parameters started */
+    int esc_params[ESC_MAX_PARAMS];
+} fb_vt_t;
+
+/* ANSI colors 0-15 (VGA palette) as XRGB8888 */
+static const uint32_t ansi_palette[16] = {
+    0x00000000, 0x00AA0000, 0x0000AA00, 0x00AA5500,
+    0x000000AA, 0x00AA00AA, 0x0000AAAA, 0x00AAAAAA,
+    0x00555555, 0x00FF5555, 0x0055FF55, 0x00FFFF55,
+    0x005555FF, 0x00FF55FF, 0x0055FFFF, 0x00FFFFFF
+};
+
+static fb_vt_t vts[FB_VT_COUNT];
+static fb_vt_t *out = &vts[0];      /* Receives writes */
+static fb_vt_t *shown = &vts[0];    /* On screen */
+
+/* Console to show on the next tick or flush, plus one (0 = none) */
+static volatile int switch_request = 0;
+
+/* Set by a line feed during fb_write: flush once the write is done */
+static int line_ended = 0;
+
+/* Switch statistics */
+static uint32_t switch_count = 0;
+static uint32_t switch_cells = 0;   /* Cells drawn by the last switch */
+static uint32_t drawn_cells = 0;    /* Cells drawn by renders so far */
+
+/* What is currently in the pixel buffer (ch 0 = unknown), a ring of
+ * rows: screen row 0 is shadow[shadow_top]. It rotates on every scroll
+ * of the console shown, and the pixels move along with the cells. */
+static fb_cell_t shadow[CONSOLE_MAX_ROWS][CONSOLE_MAX_COLS];
+static int shadow_top = 0;
+
+/* Software scrolling: text rows the double buffer still has to move up.
+ * The shadow already describes the screen after the move, which the
+ * next render does with one copy however many line feeds came first. */
+static int scroll_pending = 0;
+
+/* Per screen row: cells may differ from shadow */
+static uint8_t row_dirty[CONSOLE_MAX_ROWS];
+
+/* Hardware scrolling: text is drawn straight into video memory starting
+ * at line hw_origin of a tall virtual screen, and a line feed only moves
+ * the display start. When the ring is exhausted the visible rows are
+ * copied back to the top once. */
+#define HW_SCROLL_MAX_LINES 8192
+
+static int hw_scroll = 0;
+static int hw_origin = 0;
+static int hw_shown = 0;   /* Display start currently programmed */
+
+/* Glyph cache: printable characters (32-126) pre-expanded to 8x12 tiles */
+#define GLYPH_FIRST  32
+#define GLYPH_COUNT  95
+
+static gfx_pixel_t glyph_cache[GLYPH_COUNT][CHAR_WIDTH * CHAR_HEIGHT] __attribute__((aligned(16)));
+static uint32_t cache_fg = 0;
+static uint32_t cache_bg = 0;
+static int cache_built = 0;
+
+/* Auto mode: characters drawn in a row with the same color pair.
+ * The cache is only rebuilt once a pair has been used for about as many
+ * characters as a rebuild costs; until then the SIMD path is used. */
+static uint32_t run_fg = 0;
+static uint32_t run_bg = 0;
+static int pair_run = 0;
+
+/* Bit-select constants for SIMD mask expansion (leftmost pixel = bit 7) */
+#ifdef GFX_BACKBUFFER_16
+static const uint16_t bitsel_16[8] __attribute__((aligned(16))) = {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
+#else
+static const uint32_t bitsel_lo[4] __attribute__((aligned(16))) = {0x80, 0x40, 0x20, 0x10};
+static const uint32_t bitsel_hi[4] __attribute__((aligned(16))) = {0x08, 0x04, 0x02, 0x01};
+#endif
 
 /*
- * Draw a character at position (8x12 with 4 pixel spacing below)
- * Optimized version using batch operations
+ * Expand one font glyph into 32-bit pixels (8x8 font + 4 rows of spacing)
+ * pitch is in pixels
  */
-static void draw_char(char c, int x, int y) {
+static void expand_glyph(gfx_pixel_t *dst, int pitch, char c, uint32_t fg, uint32_t bg) {
     int i, j;
     uint8_t row;
-    int px = x * CHAR_WIDTH;
-    int py = y * CHAR_HEIGHT;
-    uint32_t *buffer = gfx_get_double_buffer();
-    int fb_width = gfx_get_width();
     
-    if ((int)c < 32 || (int)c > 126) {
-        c = '?';
-    }
-    
-    /* Draw font rows (8 rows) - direct buffer access */
     for (i = 0; i < 8; i++) {
         row = font[(int)c][i];
-        uint32_t *line_ptr = &buffer[(py + i) * fb_width + px];
         for (j = 0; j < 8; j++) {
-            line_ptr[j] = (row & (0x80 >> j)) ? fg_color : bg_color;
+            dst[j] = (row & (0x80 >> j)) ? fg : bg;
         }
+        dst += pitch;
     }
     
-    /* Draw 4 extra rows of background for spacing - use fill_rect */
-    gfx_fill_rect(px, py + 8, CHAR_WIDTH, 4, bg_color);
+    for (i = 8; i < CHAR_HEIGHT; i++) {
+        for (j = 0; j < CHAR_WIDTH; j++) {
+            dst[j] = bg;
+        }
+        dst += pitch;
+    }
 }
 
+#ifdef GFX_BACKBUFFER_16
 /*
- * Scroll console up one line
- * Optimized version using batch copy
+ * Expand one font glyph with SSE2, branch-free (RGB565 buffer)
+ * The row byte is broadcast to eight words, masked with the bit-select
+ * words and compared; one 16-byte store writes the whole glyph row.
  */
-static void scroll(void) {
-    int fb_width = gfx_get_width();
-    int fb_height = gfx_get_height();
+static void expand_glyph_simd(gfx_pixel_t *dst, int pitch, char c, uint32_t fg, uint32_t bg) {
+    const uint8_t *glyph = font[(int)c];
+    int pitch_bytes = pitch * 2;
     
-    /* Copy all lines up at once using gfx_copy_rect */
-    /* Source: line 1 to end, Destination: line 0 to end-1 */
-    int scroll_height = (CONSOLE_ROWS - 1) * CHAR_HEIGHT;
-    gfx_copy_rect(0, CHAR_HEIGHT, 0, 0, fb_width, scroll_height);
+    __asm__ __volatile__(
+        "movd %[fg], %%xmm6\n\t"
+        "pshuflw $0, %%xmm6, %%xmm6\n\t"
+        "punpcklqdq %%xmm6, %%xmm6\n\t"
+        "movd %[bg], %%xmm7\n\t"
+        "pshuflw $0, %%xmm7, %%xmm7\n\t"
+        "punpcklqdq %%xmm7, %%xmm7\n\t"
+        "movdqa %[sel], %%xmm4\n\t"
+        "mov $8, %%ecx\n\t"
+        "1:\n\t"
+        "movzbl (%[glyph]), %%eax\n\t"
+        "movd %%eax, %%xmm0\n\t"
+        "pshuflw $0, %%xmm0, %%xmm0\n\t"
+        "punpcklqdq %%xmm0, %%xmm0\n\t"
+        "pand %%xmm4, %%xmm0\n\t"
+        "pcmpeqw %%xmm4, %%xmm0\n\t"    /* mask for pixels 0-7 */
+        "movdqa %%xmm0, %%xmm2\n\t"
+        "pand %%xmm6, %%xmm0\n\t"
+        "pandn %%xmm7, %%xmm2\n\t"
+        "por %%xmm2, %%xmm0\n\t"
+        "movdqu %%xmm0, (%[dst])\n\t"
+        "add %[pitch], %[dst]\n\t"
+        "inc %[glyph]\n\t"
+        "dec %%ecx\n\t"
+        "jnz 1b\n\t"
+        /* Spacing rows are plain background */
+        "mov $4, %%ecx\n\t"
+        "2:\n\t"
+        "movdqu %%xmm7, (%[dst])\n\t"
+        "add %[pitch], %[dst]\n\t"
+        "dec %%ecx\n\t"
+        "jnz 2b"
+        : [dst] "+r"(dst), [glyph] "+r"(glyph)
+        : [fg] "m"(fg), [bg] "m"(bg), [pitch] "m"(pitch_bytes), [sel] "m"(bitsel_16)
+        : "eax", "ecx", "xmm0", "xmm2", "xmm4", "xmm6", "xmm7", "memory", "cc"
+    );
+}
+
+#else
+/*
+ * Expand one font glyph with SSE2, branch-free
+ * Each row byte is broadcast, ANDed with the bit-select constants and
+ * compared to build a pixel mask; fg/bg are blended with pand/pandn/por
+ * and the 8 pixels are written with two stores.
+ */
+static void expand_glyph_simd(gfx_pixel_t *dst, int pitch, char c, uint32_t fg, uint32_t bg) {
+    const uint8_t *glyph = font[(int)c];
+    int pitch_bytes = pitch * 4;
+    
+    __asm__ __volatile__(
+        "movd %[fg], %%xmm6\n\t"
+        "pshufd $0, %%xmm6, %%xmm6\n\t"
+        "movd %[bg], %%xmm7\n\t"
+        "pshufd $0, %%xmm7, %%xmm7\n\t"
+        "movdqa %[lo], %%xmm4\n\t"
+        "movdqa %[hi], %%xmm5\n\t"
+        "mov $8, %%ecx\n\t"
+        "1:\n\t"
+        "movzbl (%[glyph]), %%eax\n\t"
+        "movd %%eax, %%xmm0\n\t"
+        "pshufd $0, %%xmm0, %%xmm0\n\t"
+        "movdqa %%xmm0, %%xmm1\n\t"
+        "pand %%xmm4, %%xmm0\n\t"
+        "pand %%xmm5, %%xmm1\n\t"
+        "pcmpeqd %%xmm4, %%xmm0\n\t"      /* mask for pixels 0-3 */
+        "pcmpeqd %%xmm5, %%xmm1\n\t"      /* mask for pixels 4-7 */
+        "movdqa %%xmm0, %%xmm2\n\t"
+        "movdqa %%xmm1, %%xmm3\n\t"
+        "pand %%xmm6, %%xmm0\n\t"
+        "pand %%xmm6, %%xmm1\n\t"
+        "pandn %%xmm7, %%xmm2\n\t"
+        "pandn %%xmm7, %%xmm3\n\t"
+        "por %%xmm2, %%xmm0\n\t"
+        "por %%xmm3, %%xmm1\n\t"
+        "movdqu %%xmm0, (%[dst])\n\t"
+        "movdqu %%xmm1, 16(%[dst])\n\t"
+        "add %[pitch], %[dst]\n\t"
+        "inc %[glyph]\n\t"
+        "dec %%ecx\n\t"
+        "jnz 1b\n\t"
+        /* Spacing rows are plain background */
+        "mov $4, %%ecx\n\t"
+        "2:\n\t"
+        "movdqu %%xmm7, (%[dst])\n\t"
+        "movdqu %%xmm7, 16(%[dst])\n\t"
+        "add %[pitch], %[dst]\n\t"
+        "dec %%ecx\n\t"
+        "jnz 2b"
+        : [dst] "+r"(dst), [glyph] "+r"(glyph)
+        : [fg] "m"(fg), [bg] "m"(bg), [pitch] "m"(pitch_bytes),
+          [lo] "m"(bitsel_lo), [hi] "m"(bitsel_hi)
+        : "eax", "ecx", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+          "xmm6", "xmm7", "memory", "cc"
+    );
+}
+
+#endif
+
+/*
+ * Rebuild glyph cache for a color pair
+ */
+static void glyph_cache_build(uint32_t fg, uint32_t bg) {
+    int i;
     
-    /* Clear bottom line with fill_rect */
-    int bottom_y = (CONSOLE_ROWS - 1) * CHAR_HEIGHT;
-    gfx_fill_rect(0, bottom_y, fb_width, CHAR_HEIGHT, bg_color);
+    for (i = 0; i < GLYPH_COUNT; i++) {
+        expand_glyph(glyph_cache[i], CHAR_WIDTH, (char)(GLYPH_FIRST + i), fg, bg);
+    }
     
-    gfx_swap_buffers();
+    cache_fg = fg;
+    cache_bg = bg;
+    cache_built = 1;
 }
 
 /*
- * Initialize framebuffer console
+ * Copy a cached tile: twelve rows of 32 bytes (16 with RGB565),
+ * one SSE store per 16 bytes
  */
-void fb_console_init(void) {
-    cursor_x = 0;
-    cursor_y = 0;
-    fb_console_clear();
+static void copy_glyph_tile(gfx_pixel_t *dst, int pitch, char c) {
+    int i;
+    const gfx_pixel_t *tile = glyph_cache[(int)c - GLYPH_FIRST];
+    
+    for (i = 0; i < CHAR_HEIGHT; i++) {
+#ifdef GFX_BACKBUFFER_16
+        __asm__ __volatile__(
+            "movaps (%0), %%xmm0\n\t"
+            "movups %%xmm0, (%1)"
+            :
+            : "r"(tile), "r"(dst)
+            : "xmm0", "memory"
+        );
+#else
+        __asm__ __volatile__(
+            "movaps (%0), %%xmm0\n\t"
+            "movaps 16(%0), %%xmm1\n\t"
+            "movups %%xmm0, (%1)\n\t"
+            "movups %%xmm1, 16(%1)"
+            :
+            : "r"(tile), "r"(dst)
+            : "xmm0", "xmm1", "memory"
+        );
+#endif
+        tile += CHAR_WIDTH;
+        dst += pitch;
+    }
 }
 
 /*
- * Print a character
+ * Get the first pixel of a text row: video memory when hardware
+ * scrolling, otherwise the double buffer
  */
-void fb_putchar(char c) {
-    if (c == '\n') {
-        cursor_x = 0;
-        cursor_y++;
-        if (cursor_y >= CONSOLE_ROWS) {
-            scroll();
-            cursor_y = CONSOLE_ROWS - 1;
-        }
-        gfx_swap_buffers();  /* Flush on newline */
-    } else if (c == '\r') {
-        cursor_x = 0;
-    } else if (c == '\t') {
-        cursor_x = (cursor_x + 4) & ~3;
-        if (cursor_x >= CONSOLE_COLS) {
-            cursor_x = 0;
-            cursor_y++;
-            if (cursor_y >= CONSOLE_ROWS) {
-                scroll();
-                cursor_y = CONSOLE_ROWS - 1;
+static gfx_pixel_t *text_row_pixels(int y) {
+    int py = y * CHAR_HEIGHT;
+    
+    if (hw_scroll) {
+        return gfx_get_screen_line(hw_origin + py);
+    }
+    return gfx_get_double_buffer() + py * gfx_get_buffer_pitch();
+}
+
+/*
+ * Get the pixel pitch of the surface text is drawn to
+ */
+static int text_pitch(void) {
+    return hw_scroll ? gfx_get_pitch() / (int)sizeof(gfx_pixel_t) : gfx_get_buffer_pitch();
+}
+
+/*
+ * Draw a glyph at a pixel address (8x12 with 4 pixel spacing below)
+ * Uses the strategy selected with fb_set_render_mode()
+ */
+static void draw_glyph_at(gfx_pixel_t *dst, int fb_width, char c, uint32_t fg, uint32_t bg) {
+    int cached;
+    
+    /* Cell colors are XRGB8888 */
+    fg = gfx_color(fg);
+    bg = gfx_color(bg);
+    cached = cache_built && fg == cache_fg && bg == cache_bg;
+    
+    if ((int)c < 32 || (int)c > 126) {
+        c = '?';
+    }
+    
+    switch (render_mode) {
+        case FB_RENDER_SCALAR:
+            expand_glyph(dst, fb_width, c, fg, bg);
+            break;
+            
+        case FB_RENDER_SIMD:
+            expand_glyph_simd(dst, fb_width, c, fg, bg);
+            break;
+            
+        case FB_RENDER_CACHED:
+            if (!cached) {
+                glyph_cache_build(fg, bg);
+            }
+            copy_glyph_tile(dst, fb_width, c);
+            break;
+            
+        default:
+            /* Auto: cache for steady colors, SIMD while colors churn */
+            if (!cached) {
+                if (fg != run_fg || bg != run_bg) {
+                    run_fg = fg;
+                    run_bg = bg;
+                    pair_run = 0;
+                }
+                if (++pair_run >= GLYPH_COUNT) {
+                    glyph_cache_build(fg, bg);
+                    cached = 1;
+                }
+            }
+            if (cached) {
+                copy_glyph_tile(dst, fb_width, c);
+            } else {
+                expand_glyph_simd(dst, fb_width, c, fg, bg);
             }
+            break;
+    }
+}
+
+/*
+ * Draw a character at a cell position
+ */
+static void draw_char(char c, uint32_t fg, uint32_t bg, int x, int y) {
+    gfx_surface_t *saved = gfx_set_target((gfx_surface_t *)0);
+    int px = x * CHAR_WIDTH;
+    int py = hw_origin - gfx_get_display_start() + y * CHAR_HEIGHT;
+    
+    if (hw_scroll) {
+        gfx_hide_overlay(px, py, px + CHAR_WIDTH - 1, py + CHAR_HEIGHT - 1);
+    }
+    draw_glyph_at(text_row_pixels(y) + x * CHAR_WIDTH, text_pitch(), c, fg, bg);
+    
+    if (!hw_scroll) {
+        gfx_mark_dirty_rect(x * CHAR_WIDTH, y * CHAR_HEIGHT, CHAR_WIDTH, CHAR_HEIGHT);
+    } else {
+        gfx_show_overlay();
+    }
+    gfx_set_target(saved);
+}
+
+/*
+ * Get a logical row of a console's cell grid
+ */
+static fb_cell_t *vt_row(fb_vt_t *vt, int y) {
+    int r = vt->top_row + y;
+    if (r >= console_rows) {
+        r -= console_rows;
+    }
+    return vt->cells[r];
+}
+
+/*
+ * Get a logical row of the output console
+ */
+static fb_cell_t *cell_row(int y) {
+    return vt_row(out, y);
+}
+
+/*
+ * Note that a row of the output console changed
+ * Rows of a console in the background never reach the pixels
+ */
+static void touch_row(int y) {
+    if (out == shown) {
+        row_dirty[y] = 1;
+        flush_pending = 1;
+    }
+}
+
+/*
+ * Get a screen row of the shadow grid
+ */
+static fb_cell_t *shadow_row(int y) {
+    int r = shadow_top + y;
+    if (r >= console_rows) {
+        r -= console_rows;
+    }
+    return shadow[r];
+}
+
+/*
+ * Blank cells x1 to x2 - 1 of a logical row in the current colors
+ */
+static void erase_cells(int y, int x1, int x2) {
+    fb_cell_t *row = cell_row(y);
+    int x;
+    
+    for (x = x1; x < x2; x++) {
+        row[x].ch = ' ';
+        row[x].fg = out->fg_color;
+        row[x].bg = out->bg_color;
+    }
+    touch_row(y);
+}
+
+/*
+ * Fill a logical row with blanks in the current colors
+ */
+static void clear_row(int y) {
+    erase_cells(y, 0, console_cols);
+}
+
+/*
+ * Copy one logical row over another
+ */
+static void copy_row(int dst, int src) {
+    fb_cell_t *to = cell_row(dst);
+    fb_cell_t *from = cell_row(src);
+    int x;
+    
+    for (x = 0; x < console_cols; x++) {
+        to[x] = from[x];
+    }
+    touch_row(dst);
+}
+
+/*
+ * Mark all rows for redraw
+ */
+static void mark_all_rows(void) {
+    int y;
+    for (y = 0; y < console_rows; y++) {
+        row_dirty[y] = 1;
+    }
+}
+
+/*
+ * Move the double buffer pixels up by the rows scrolled since the last
+ * render, in one copy
+ */
+static void apply_scroll(void) {
+    gfx_surface_t *saved;
+    int lines;
+    
+    if (!scroll_pending) {
+        return;
+    }
+    if (scroll_pending < console_rows) {
+        lines = scroll_pending * CHAR_HEIGHT;
+        saved = gfx_set_target((gfx_surface_t *)0);
+        gfx_copy_rect(0, lines, 0, 0, console_cols * CHAR_WIDTH,
+                      console_rows * CHAR_HEIGHT - lines);
+        gfx_set_target(saved);
+    }
+    scroll_pending = 0;
+}
+
+/*
+ * Render dirty rows: only cells that differ from what is on screen
+ * The pixel row and pitch are fetched once per text row, and the
+ * changed span is marked dirty once.
+ */
+static void render(void) {
+    int x, y;
+    /* May run from the timer tick while something draws to a surface */
+    gfx_surface_t *saved = gfx_set_target((gfx_surface_t *)0);
+    int fb_width = text_pitch();
+    
+    apply_scroll();
+    
+    /* Hardware scrolling draws into video memory, under the overlay */
+    if (hw_scroll) {
+        gfx_hide_overlay(0, 0, gfx_get_width() - 1, gfx_get_height() - 1);
+    }
+    
+    for (y = 0; y < console_rows; y++) {
+        if (!row_dirty[y]) {
+            continue;
         }
-    } else if (c == '\b') {
-        /* Backspace - move cursor back and clear character */
-        if (cursor_x > 0) {
-            cursor_x--;
-            draw_char(' ', cursor_x, cursor_y);
-        }
-    } else if (c >= 32 && c <= 126) {
-        draw_char(c, cursor_x, cursor_y);
-        cursor_x++;
-        if (cursor_x >= CONSOLE_COLS) {
-            cursor_x = 0;
-            cursor_y++;
-            if (cursor_y >= CONSOLE_ROWS) {
-                scroll();
-                cursor_y = CONSOLE_ROWS - 1;
+        row_dirty[y] = 0;
+        
+        fb_cell_t *row = vt_row(shown, y);
+        fb_cell_t *seen = shadow_row(y);
+        gfx_pixel_t *pixels = text_row_pixels(y);
+        int first = console_cols;
+        int last = -1;
+        
+        for (x = 0; x < console_cols; x++) {
+            if (row[x].ch != seen[x].ch || row[x].fg != seen[x].fg ||
+                row[x].bg != seen[x].bg) {
+                draw_glyph_at(pixels + x * CHAR_WIDTH, fb_width,
+                              (char)row[x].ch, row[x].fg, row[x].bg);
+                seen[x] = row[x];
+                drawn_cells++;
+                if (x < first) {
+                    first = x;
+                }
+                last = x;
             }
         }
+        
+        if (last >= 0 && !hw_scroll) {
+            gfx_mark_dirty_rect(first * CHAR_WIDTH, y * CHAR_HEIGHT,
+                                (last - first + 1) * CHAR_WIDTH, CHAR_HEIGHT);
+        }
     }
-    /* No gfx_swap_buffers here - only flush at end of fb_print or on newline */
+    if (hw_scroll) {
+        gfx_show_overlay();
+    }
+    gfx_set_target(saved);
 }
 
 /*
- * Print a string
+ * Move the text area one row down the virtual screen
+ * Pending rows are rendered first; the pixels then stay where they are
+ * and only the display start changes (applied on the next flush).
  */
-void fb_print(const char *str) {
-    while (*str) {
-        fb_putchar(*str++);
+static void hw_scroll_up(void) {
+    int text_lines = console_rows * CHAR_HEIGHT;
+    fb_cell_t *bottom;
+    int x;
+    
+    render();
+    
+    hw_origin += CHAR_HEIGHT;
+    if (hw_origin + gfx_get_height() > gfx_get_virtual_height()) {
+        /* Ring exhausted: move the rows that stay visible to the top */
+        gfx_copy_screen_lines(0, hw_origin, text_lines - CHAR_HEIGHT);
+        hw_origin = 0;
+    }
+    
+    shadow_top++;
+    if (shadow_top >= console_rows) {
+        shadow_top = 0;
+    }
+    
+    /* Video memory under the new bottom row holds stale lines */
+    bottom = shadow_row(console_rows - 1);
+    for (x = 0; x < console_cols; x++) {
+        bottom[x].ch = 0;
     }
-    gfx_swap_buffers();  /* Flush after printing string */
 }
 
 /*
- * Convert nibble to hex character
+ * Move the text area one row up the double buffer
+ * The shadow and the dirty flags rotate now; the pixels are copied by
+ * the next render, and only the new bottom row needs glyphs.
  */
-static char nibble_to_hex(uint8_t nibble) {
-    nibble &= 0x0F;
-    if (nibble < 10) {
-        return '0' + nibble;
-    } else {
-        return 'A' + (nibble - 10);
+static void soft_scroll_up(void) {
+    fb_cell_t *bottom;
+    int x, y;
+    
+    if (scroll_pending < console_rows) {
+        scroll_pending++;
+    }
+    
+    shadow_top++;
+    if (shadow_top >= console_rows) {
+        shadow_top = 0;
+    }
+    for (y = 0; y < console_rows - 1; y++) {
+        row_dirty[y] = row_dirty[y + 1];
+    }
+    
+    /* The copy leaves stale lines under the new bottom row */
+    bottom = shadow_row(console_rows - 1);
+    for (x = 0; x < console_cols; x++) {
+        bottom[x].ch = 0;
     }
 }
 
 /*
- * Print hex number (without division or local arrays)
+ * Scroll console up one line
+ * Rotates the row ring; pixels follow on the next render
  */
-void fb_print_hex(uint32_t value) {
-    int i;
+static void scroll(void) {
+    if (out == shown) {
+        if (hw_scroll) {
+            hw_scroll_up();
+        } else {
+            soft_scroll_up();
+        }
+    }
     
-    fb_putchar('0');
-    fb_putchar('x');
+    out->top_row++;
+    if (out->top_row >= console_rows) {
+        out->top_row = 0;
+    }
+    clear_row(console_rows - 1);
+}
+
+/*
+ * Scroll rows top to bottom by n rows: up if n > 0, down if n < 0
+ * The whole screen scrolling up takes the row ring (and hardware
+ * scrolling); a region is shifted cell by cell, and the render only
+ * draws the cells that come out different.
+ */
+static void scroll_rows(int top, int bottom, int n) {
+    int height = bottom - top + 1;
+    int y;
+    
+    if (n > height) n = height;
+    if (n < -height) n = -height;
     
-    /* Print each nibble from high to low */
-    for (i = 28; i >= 0; i -= 4) {
-        fb_putchar(nibble_to_hex((value >> i) & 0xF));
+    if (n > 0 && top == 0 && bottom == console_rows - 1) {
+        while (n-- > 0) {
+            scroll();
+        }
+    } else if (n > 0) {
+        for (y = top; y + n <= bottom; y++) {
+            copy_row(y, y + n);
+        }
+        for (; y <= bottom; y++) {
+            clear_row(y);
+        }
+    } else if (n < 0) {
+        n = -n;
+        for (y = bottom; y - n >= top; y--) {
+            copy_row(y, y - n);
+        }
+        for (; y >= top; y--) {
+            clear_row(y);
+        }
     }
 }
 
 /*
- * Print decimal number (without division or local arrays)
+ * Move down a line, scrolling the region at its bottom margin
  */
-void fb_print_int(int value) {
-    uint32_t uvalue;
-    uint32_t divisor;
-    int started = 0;
+static void line_feed(void) {
+    out->wrap_pending = 0;
+    if (out->cursor_y == out->scroll_bottom) {
+        scroll_rows(out->scroll_top, out->scroll_bottom, 1);
+    } else if (out->cursor_y < console_rows - 1) {
+        out->cursor_y++;
+    }
+}
+
+/*
+ * Move to the start of the next line, scrolling if needed
+ */
+static void newline(void) {
+    out->cursor_x = 0;
+    line_feed();
+}
+
+/*
+ * Store a character in the cell under the cursor
+ */
+static void put_cell(char c) {
+    fb_cell_t *cell = &cell_row(out->cursor_y)[out->cursor_x];
+    cell->ch = (uint8_t)c;
+    cell->fg = out->fg_color;
+    cell->bg = out->bg_color;
+    touch_row(out->cursor_y);
+}
+
+/*
+ * Forget what is on screen so every cell is drawn on the next render
+ */
+static void invalidate_shadow(void) {
+    int x, y;
     
-    if (value < 0) {
-        fb_putchar('-');
-        uvalue = (uint32_t)(-value);
+    for (y = 0; y < console_rows; y++) {
+        for (x = 0; x < console_cols; x++) {
+            shadow[y][x].ch = 0;
+        }
+    }
+    shadow_top = 0;
+    scroll_pending = 0;
+    mark_all_rows();
+}
+
+/*
+ * Ask for the screen to be updated
+ * Immediate mode flushes now; deferred mode leaves it to the next tick,
+ * blocking read or explicit fb_flush()
+ */
+static void request_flush(void) {
+    if (out != shown) {
+        return;
+    }
+    flush_requests++;
+    if (flush_mode == FB_FLUSH_IMMEDIATE) {
+        fb_flush();
     } else {
-        uvalue = (uint32_t)value;
+        flush_pending = 1;
     }
+}
+
+/*
+ * Size the grids for the display mode and blank every console
+ * The console shown is cleared last, so its clear is what gets drawn.
+ */
+static void reset_grids(void) {
+    fb_vt_t *target = out;
+    int i;
     
-    /* Print digits from highest to lowest */
-    for (divisor = 1000000000; divisor > 0; divisor /= 10) {
-        uint8_t digit = (uint8_t)(uvalue / divisor);
-        uvalue %= divisor;
-        
-        if (digit != 0 || started || divisor == 1) {
-            fb_putchar('0' + digit);
-            started = 1;
+    console_cols = gfx_get_width() / CHAR_WIDTH;
+    console_rows = gfx_get_height() / CHAR_HEIGHT;
+    if (console_cols > CONSOLE_MAX_COLS) console_cols = CONSOLE_MAX_COLS;
+    if (console_rows > CONSOLE_MAX_ROWS) console_rows = CONSOLE_MAX_ROWS;
+    
+    invalidate_shadow();
+    for (i = 0; i < FB_VT_COUNT; i++) {
+        vts[i].scroll_top = 0;
+        vts[i].scroll_bottom = console_rows - 1;
+        vts[i].saved_x = 0;
+        vts[i].saved_y = 0;
+        vts[i].esc_state = ESC_GROUND;
+        if (&vts[i] != shown) {
+            out = &vts[i];
+            fb_console_clear();
         }
     }
+    out = shown;
+    fb_console_clear();
+    out = target;
 }
 
 /*
- * Clear console
+ * Initialize framebuffer console
  */
-void fb_console_clear(void) {
-    gfx_clear(bg_color);
-    cursor_x = 0;
-    cursor_y = 0;
-    gfx_swap_buffers();
+void fb_console_init(void) {
+    fb_vt_t *target = out;
+    int i;
+    
+    for (i = 0; i < FB_VT_COUNT; i++) {
+        out = &vts[i];
+        fb_set_text_color(0x00FFFFFF, 0x00000000);  /* White on black */
+    }
+    out = target;
+    reset_grids();
 }
 
 /*
- * Reset cursor to top-left without clearing
+ * Adapt the console to a new display mode
+ * The screen was cleared by the mode switch, so the grid starts empty;
+ * hardware scrolling is switched off (the virtual screen is gone).
  */
-void fb_console_reset_cursor(void) {
-    cursor_x = 0;
-    cursor_y = 0;
+void fb_console_resize(void) {
+    fb_console_drain();
+    busy++;
+    hw_scroll = 0;
+    hw_origin = 0;
+    hw_shown = 0;
+    reset_grids();
+    busy--;
 }
 
 /*
- * Flush buffer to screen (for interactive input)
+ * Handle one control character
  */
-void fb_flush(void) {
-    gfx_swap_buffers();
+static void put_special(char c) {
+    if (c == '\n') {
+        newline();
+        line_ended = 1;  /* Flush at the end of the write */
+    } else if (c == '\r') {
+        out->cursor_x = 0;
+        out->wrap_pending = 0;
+    } else if (c == '\t') {
+        if (out->wrap_pending) {
+            newline();
+            return;
+        }
+        out->cursor_x = (out->cursor_x + 4) & ~3;
+        if (out->cursor_x >= console_cols) {
+            newline();
+        }
+    } else if (c == '\b') {
+        /* Backspace - move cursor back and clear character */
+        if (out->wrap_pending) {
+            out->wrap_pending = 0;
+            put_cell(' ');
+        } else if (out->cursor_x > 0) {
+            out->cursor_x--;
+            put_cell(' ');
+        }
+    } else if (c == 0x1B) {
+        out->esc_state = ESC_ESCAPE;
+    }
 }
 
 /*
- * Set text colors
+ * Store a run of printable characters, at most up to the end of the row
+ * Writing the last column leaves the cursor there with a wrap pending,
+ * so a full-width line or the bottom right cell does not scroll early.
+ * Returns the number of characters stored
  */
-void fb_set_text_color(uint32_t fg, uint32_t bg) {
-    fg_color = fg;
-    bg_color = bg;
+static int put_run(const char *buf, int len) {
+    fb_cell_t *cell;
+    int room;
+    int n = 0;
+    
+    if (buf[0] < 32 || buf[0] > 126) {
+        return 0;
+    }
+    if (out->wrap_pending) {
+        newline();
+    }
+    
+    cell = &cell_row(out->cursor_y)[out->cursor_x];
+    room = console_cols - out->cursor_x;
+    if (len > room) {
+        len = room;
+    }
+    
+    while (n < len && buf[n] >= 32 && buf[n] <= 126) {
+        cell->ch = (uint8_t)buf[n];
+        cell->fg = out->fg_color;
+        cell->bg = out->bg_color;
+        cell++;
+        n++;
+    }
+    
+    touch_row(out->cursor_y);
+    out->cursor_x += n;
+    if (out->cursor_x >= console_cols) {
+        out->cursor_x = console_cols - 1;
+        out->wrap_pending = 1;
+    }
+    return n;
+}
+
+/*
+ * Work out the colors new cells get from the SGR state
+ */
+static void update_colors(fb_vt_t *vt) {
+    uint32_t fg = vt->sgr_fg;
+    
+    if (vt->bold && vt->fg_index >= 0 && vt->fg_index < 8) {
+        fg = ansi_palette[vt->fg_index + 8];
+    }
+    if (vt->reverse) {
+        vt->fg_color = vt->sgr_bg;
+        vt->bg_color = fg;
+    } else {
+        vt->fg_color = fg;
+        vt->bg_color = vt->sgr_bg;
+    }
+}
+
+/*
+ * Get CSI parameter i, def if it is missing or 0
+ */
+static int esc_param(int i, int def) {
+    int p = i < out->esc_count ? out->esc_params[i] : 0;
+    return p ? p : def;
+}
+
+/*
+ * Move the cursor, clamped to the screen
+ */
+static void set_cursor(int x, int y) {
+    if (x < 0) x = 0;
+    if (x >= console_cols) x = console_cols - 1;
+    if (y < 0) y = 0;
+    if (y >= console_rows) y = console_rows - 1;
+    out->cursor_x = x;
+    out->cursor_y = y;
+    out->wrap_pending = 0;
+}
+
+/* CUU, CUD: vertical moves stop at the margin of the region they start in */
+static void csi_cursor_up(void) {
+    int y = out->cursor_y - esc_param(0, 1);
+    if (out->cursor_y >= out->scroll_top && y < out->scroll_top) {
+        y = out->scroll_top;
+    }
+    set_cursor(out->cursor_x, y);
+}
+
+static void csi_cursor_down(void) {
+    int y = out->cursor_y + esc_param(0, 1);
+    if (out->cursor_y <= out->scroll_bottom && y > out->scroll_bottom) {
+        y = out->scroll_bottom;
+    }
+    set_cursor(out->cursor_x, y);
+}
+
+/* CUF, CUB */
+static void csi_cursor_forward(void) {
+    set_cursor(out->cursor_x + esc_param(0, 1), out->cursor_y);
+}
+
+static void csi_cursor_back(void) {
+    set_cursor(out->cursor_x - esc_param(0, 1), out->cursor_y);
+}
+
+/* CNL, CPL */
+static void csi_next_line(void) {
+    csi_cursor_down();
+    out->cursor_x = 0;
+}
+
+static void csi_prev_line(void) {
+    csi_cursor_up();
+    out->cursor_x = 0;
+}
+
+/* CHA, HPA: column; VPA: row; CUP, HVP: row and column (1-based) */
+static void csi_column(void) {
+    set_cursor(esc_param(0, 1) - 1, out->cursor_y);
+}
+
+static void csi_row(void) {
+    set_cursor(out->cursor_x, esc_param(0, 1) - 1);
+}
+
+static void csi_position(void) {
+    set_cursor(esc_param(1, 1) - 1, esc_param(0, 1) - 1);
+}
+
+/* ED: erase below (0), above (1) or all (2, 3) without moving the cursor */
+static void csi_erase_display(void) {
+    int mode = esc_param(0, 0);
+    int y;
+    
+    if (mode == 0) {
+        erase_cells(out->cursor_y, out->cursor_x, console_cols);
+        for (y = out->cursor_y + 1; y < console_rows; y++) {
+            clear_row(y);
+        }
+    } else if (mode == 1) {
+        for (y = 0; y < out->cursor_y; y++) {
+            clear_row(y);
+        }
+        erase_cells(out->cursor_y, 0, out->cursor_x + 1);
+    } else {
+        for (y = 0; y < console_rows; y++) {
+            clear_row(y);
+        }
+    }
+}
+
+/* EL: erase to the right (0), to the left (1) or the whole line (2) */
+static void csi_erase_line(void) {
+    int mode = esc_param(0, 0);
+    
+    if (mode == 0) {
+        erase_cells(out->cursor_y, out->cursor_x, console_cols);
+    } else if (mode == 1) {
+        erase_cells(out->cursor_y, 0, out->cursor_x + 1);
+    } else {
+        clear_row(out->cursor_y);
+    }
+}
+
+/* ECH: blank n cells from the cursor */
+static void csi_erase_chars(void) {
+    int x2 = out->cursor_x + esc_param(0, 1);
+    
+    if (x2 > console_cols) x2 = console_cols;
+    erase_cells(out->cursor_y, out->cursor_x, x2);
+}
+
+/* ICH, DCH: shift the rest of the line right or left by n cells */
+static void csi_insert_chars(void) {
+    fb_cell_t *row = cell_row(out->cursor_y);
+    int n = esc_param(0, 1);
+    int x;
+    
+    if (n > console_cols - out->cursor_x) n = console_cols - out->cursor_x;
+    for (x = console_cols - 1; x >= out->cursor_x + n; x--) {
+        row[x] = row[x - n];
+    }
+    erase_cells(out->cursor_y, out->cursor_x, out->cursor_x + n);
+}
+
+static void csi_delete_chars(void) {
+    fb_cell_t *row = cell_row(out->cursor_y);
+    int n = esc_param(0, 1);
+    int x;
+    
+    if (n > console_cols - out->cursor_x) n = console_cols - out->cursor_x;
+    for (x = out->cursor_x; x + n < console_cols; x++) {
+        row[x] = row[x + n];
+    }
+    erase_cells(out->cursor_y, console_cols - n, console_cols);
+}
+
+/* IL, DL: insert or delete n lines at the cursor, inside the region */
+static void csi_insert_lines(void) {
+    if (out->cursor_y >= out->scroll_top && out->cursor_y <= out->scroll_bottom) {
+        scroll_rows(out->cursor_y, out->scroll_bottom, -esc_param(0, 1));
+        out->cursor_x = 0;
+        out->wrap_pending = 0;
+    }
+}
+
+static void csi_delete_lines(void) {
+    if (out->cursor_y >= out->scroll_top && out->cursor_y <= out->scroll_bottom) {
+        scroll_rows(out->cursor_y, out->scroll_bottom, esc_param(0, 1));
+        out->cursor_x = 0;
+        out->wrap_pending = 0;
+    }
+}
+
+/* SU, SD: scroll the region up or down by n lines */
+static void csi_scroll_up(void) {
+    scroll_rows(out->scroll_top, out->scroll_bottom, esc_param(0, 1));
+}
+
+static void csi_scroll_down(void) {
+    scroll_rows(out->scroll_top, out->scroll_bottom, -esc_param(0, 1));
+}
+
+/* DECSTBM: set the scroll region (1-based, inclusive) and home the cursor */
+static void csi_scroll_region(void) {
+    int top = esc_param(0, 1) - 1;
+    int bottom = esc_param(1, console_rows) - 1;
+    
+    if (bottom >= console_rows) bottom = console_rows - 1;
+    if (top < bottom) {
+        out->scroll_top = top;
+        out->scroll_bottom = bottom;
+        set_cursor(0, 0);
+    }
+}
+
+/* SCOSC, SCORC (and DECSC, DECRC): save and restore the cursor */
+static void csi_save_cursor(void) {
+    out->saved_x = out->cursor_x;
+    out->saved_y = out->cursor_y;
+}
+
+static void csi_restore_cursor(void) {
+    set_cursor(out->saved_x, out->saved_y);
+}
+
+/*
+ * Read a 38/48 extended color starting at parameter i
+ * 5;n picks from the 256-color palette, 2;r;g;b gives it directly.
+ * Returns the index of the last parameter used
+ */
+static int sgr_extended(int i, uint32_t *color) {
+    int n;
+    
+    if (i + 2 < out->esc_count && out->esc_params[i + 1] == 5) {
+        n = out->esc_params[i + 2] & 0xFF;
+        if (n < 16) {
+            *color = ansi_palette[n];
+        } else if (n < 232) {
+            int r = (n - 16) / 36, g = (n - 16) / 6 % 6, b = (n - 16) % 6;
+            r = r ? 55 + r * 40 : 0;
+            g = g ? 55 + g * 40 : 0;
+            b = b ? 55 + b * 40 : 0;
+            *color = ((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b;
+        } else {
+            n = 8 + (n - 232) * 10;
+            *color = ((uint32_t)n << 16) | ((uint32_t)n << 8) | (uint32_t)n;
+        }
+        return i + 2;
+    }
+    if (i + 4 < out->esc_count && out->esc_params[i + 1] == 2) {
+        *color = ((uint32_t)(out->esc_params[i + 2] & 0xFF) << 16) |
+                 ((uint32_t)(out->esc_params[i + 3] & 0xFF) << 8) |
+                 (uint32_t)(out->esc_params[i + 4] & 0xFF);
+        return i + 4;
+    }
+    return out->esc_count;
+}
+
+/* SGR: attributes and colors */
+static void csi_attributes(void) {
+    fb_vt_t *vt = out;
+    uint32_t color;
+    int i, p, next;
+    
+    for (i = 0; i < vt->esc_count; i++) {
+        p = vt->esc_params[i];
+        if (p == 0) {
+            vt->sgr_fg = vt->default_fg;
+            vt->sgr_bg = vt->default_bg;
+            vt->fg_index = -1;
+            vt->bold = 0;
+            vt->reverse = 0;
+        } else if (p == 1) {
+            vt->bold = 1;
+        } else if (p == 22) {
+            vt->bold = 0;
+        } else if (p == 7) {
+            vt->reverse = 1;
+        } else if (p == 27) {
+            vt->reverse = 0;
+        } else if (p >= 30 && p <= 37) {
+            vt->sgr_fg = ansi_palette[p - 30];
+            vt->fg_index = p - 30;
+        } else if (p == 39) {
+            vt->sgr_fg = vt->default_fg;
+            vt->fg_index = -1;
+        } else if (p >= 40 && p <= 47) {
+            vt->sgr_bg = ansi_palette[p - 40];
+        } else if (p == 49) {
+            vt->sgr_bg = vt->default_bg;
+        } else if (p >= 90 && p <= 97) {
+            vt->sgr_fg = ansi_palette[p - 90 + 8];
+            vt->fg_index = -1;
+        } else if (p >= 100 && p <= 107) {
+            vt->sgr_bg = ansi_palette[p - 100 + 8];
+        } else if (p == 38 || p == 48) {
+            next = sgr_extended(i, &color);
+            if (next < vt->esc_count) {
+                if (p == 38) {
+                    vt->sgr_fg = color;
+                    vt->fg_index = -1;
+                } else {
+                    vt->sgr_bg = color;
+                }
+            }
+            i = next;
+        }
+    }
+    update_colors(vt);
+}
+
+/* IND, NEL, RI */
+static void esc_index(void) {
+    line_feed();
+}
+
+static void esc_next_line(void) {
+    newline();
+}
+
+static void esc_reverse_index(void) {
+    out->wrap_pending = 0;
+    if (out->cursor_y == out->scroll_top) {
+        scroll_rows(out->scroll_top, out->scroll_bottom, -1);
+    } else if (out->cursor_y > 0) {
+        out->cursor_y--;
+    }
+}
+
+/* RIS: default colors, full scroll region, blank screen */
+static void esc_reset(void) {
+    fb_set_text_color(out->default_fg, out->default_bg);
+    out->scroll_top = 0;
+    out->scroll_bottom = console_rows - 1;
+    fb_console_clear();
+}
+
+/* Final byte handlers: CSI sequences by final byte - 0x40, plain escape
+ * sequences by final byte - 0x30. Unlisted sequences are dropped. */
+typedef void (*esc_handler_t)(void);
+
+static const esc_handler_t csi_table[0x3F] = {
+    ['@' - 0x40] = csi_insert_chars,
+    ['A' - 0x40] = csi_cursor_up,
+    ['B' - 0x40] = csi_cursor_down,
+    ['C' - 0x40] = csi_cursor_forward,
+    ['D' - 0x40] = csi_cursor_back,
+    ['E' - 0x40] = csi_next_line,
+    ['F' - 0x40] = csi_prev_line,
+    ['G' - 0x40] = csi_column,
+    ['H' - 0x40] = csi_position,
+    ['J' - 0x40] = csi_erase_display,
+    ['K' - 0x40] = csi_erase_line,
+    ['L' - 0x40] = csi_insert_lines,
+    ['M' - 0x40] = csi_delete_lines,
+    ['P' - 0x40] = csi_delete_chars,
+    ['S' - 0x40] = csi_scroll_up,
+    ['T' - 0x40] = csi_scroll_down,
+    ['X' - 0x40] = csi_erase_chars,
+    ['`' - 0x40] = csi_column,
+    ['d' - 0x40] = csi_row,
+    ['f' - 0x40] = csi_position,
+    ['m' - 0x40] = csi_attributes,
+    ['r' - 0x40] = csi_scroll_region,
+    ['s' - 0x40] = csi_save_cursor,
+    ['u' - 0x40] = csi_restore_cursor,
+};
+
+static const esc_handler_t esc_table[0x4F] = {
+    ['7' - 0x30] = csi_save_cursor,
+    ['8' - 0x30] = csi_restore_cursor,
+    ['D' - 0x30] = esc_index,
+    ['E' - 0x30] = esc_next_line,
+    ['M' - 0x30] = esc_reverse_index,
+    ['c' - 0x30] = esc_reset,
+};
+
+/*
+ * Feed one byte of an escape sequence to the parser
+ * Only the cell grid changes; the damage is rendered with the rest of
+ * the write.
+ */
+static void put_escape(char ch) {
+    fb_vt_t *vt = out;
+    uint8_t c = (uint8_t)ch;
+    
+    /* CAN and SUB cancel a sequence anywhere */
+    if (c == 0x18 || c == 0x1A) {
+        vt->esc_state = ESC_GROUND;
+        return;
+    }
+    
+    switch (vt->esc_state) {
+    case ESC_ESCAPE:
+        vt->esc_state = ESC_GROUND;
+        if (c == '[') {
+            vt->esc_state = ESC_CSI;
+            vt->esc_ignore = 0;
+            vt->esc_count = 1;
+            vt->esc_params[0] = 0;
+        } else if (c == ']' || c == 'P' || c == 'X' || c == '^' || c == '_') {
+            vt->esc_state = ESC_STRING;
+        } else if (c >= 0x20 && c <= 0x2F) {
+            vt->esc_state = ESC_CHARSET;
+        } else if (c >= 0x30 && c <= 0x7E && esc_table[c - 0x30]) {
+            esc_table[c - 0x30]();
+        }
+        break;
+        
+    case ESC_CSI:
+        if (c >= '0' && c <= '9') {
+            int *p = &vt->esc_params[vt->esc_count - 1];
+            if (*p < 10000) {
+                *p = *p * 10 + (c - '0');
+            }
+        } else if (c == ';') {
+            if (vt->esc_count < ESC_MAX_PARAMS) {
+                vt->esc_params[vt->esc_count++] = 0;
+            }
+        } else if ((c >= 0x3C && c <= 0x3F) || (c >= 0x20 && c <= 0x2F)) {
+            vt->esc_ignore = 1;
+        } else if (c >= 0x40 && c <= 0x7E) {
+            vt->esc_state = ESC_GROUND;
+            if (!vt->esc_ignore && csi_table[c - 0x40]) {
+                csi_table[c - 0x40]();
+            }
+        } else if (c == 0x1B) {
+            vt->esc_state = ESC_ESCAPE;
+        } else if (c < 0x20) {
+            put_special(ch);   /* Controls still act inside a sequence */
+        }
+        break;
+        
+    case ESC_STRING:
+        if (c == 0x07) {
+            vt->esc_state = ESC_GROUND;
+        } else if (c == 0x1B) {
+            vt->esc_state = ESC_ESCAPE;   /* ESC \ ends the string */
+        }
+        break;
+        
+    default:
+        vt->esc_state = ESC_GROUND;
+        break;
+    }
+}
+
+/*
+ * Write a buffer of characters to the cell grid
+ * Printable characters are stored a row-sized run at a time; wrap and
+ * scroll are handled once per run. \n, \r, \t, \b and VT100/ANSI escape
+ * sequences (cursor moves, SGR colors, erases, scroll regions) update the
+ * cell grid; other control bytes are skipped. Whatever the write changed
+ * is presented once at its end, so a full-screen redraw is one render.
+ * Returns the number of bytes consumed.
+ */
+static int write_cells(const char *buf, int len) {
+    int pos = 0;
+    int n;
+    
+    busy++;
+    line_ended = 0;
+    while (pos < len) {
+        if (out->esc_state != ESC_GROUND) {
+            put_escape(buf[pos]);
+            n = 1;
+        } else {
+            n = put_run(buf + pos, len - pos);
+            if (n == 0) {
+                put_special(buf[pos]);
+                n = 1;
+            }
+        }
+        pos += n;
+    }
+    
+    /* Rendering happens on flush: end of a write with a newline in it,
+     * end of print, or the tick */
+    if (line_ended) {
+        request_flush();
+    }
+    busy--;
+    return pos;
+}
+
+/*
+ * Writes are queued in queued mode, unless console code is writing
+ */
+static int queueing(void) {
+    return flush_mode == FB_FLUSH_QUEUED && !busy;
+}
+
+/*
+ * Copy a write into the queue and publish it
+ * A full ring is drained by the writer itself, so nothing is dropped.
+ */
+static void queue_put(const char *buf, int len) {
+    uint32_t head, used, n, first;
+    
+    while (len > 0) {
+        head = queue_head;
+        used = head - queue_tail;
+        if (used == QUEUE_SIZE) {
+            queue_stalls++;
+            fb_console_drain();
+            continue;
+        }
+        
+        n = QUEUE_SIZE - used;
+        if (n > (uint32_t)len) n = (uint32_t)len;
+        first = QUEUE_SIZE - (head & QUEUE_MASK);
+        if (first > n) first = n;
+        memcpy(&queue[head & QUEUE_MASK], buf, first);
+        memcpy(queue, buf + first, n - first);
+        
+        __asm__ __volatile__("" ::: "memory");
+        queue_head = head + n;
+        
+        if (used + n > queue_peak) queue_peak = used + n;
+        queue_bytes += n;
+        buf += n;
+        len -= (int)n;
+    }
+    flush_pending = 1;
+}
+
+/*
+ * Write a buffer of characters
+ * In queued mode this only copies the bytes; see write_cells for what
+ * they do once drained. Returns the number of bytes consumed.
+ */
+int fb_write(const char *buf, int len) {
+    if (queueing()) {
+        queue_put(buf, len);
+        return len;
+    }
+    return write_cells(buf, len);
+}
+
+/*
+ * Apply queued writes to the cell grid
+ * Does nothing inside console code, which drained on the way in; the
+ * bytes go to the output console, which only changes after a drain.
+ */
+void fb_console_drain(void) {
+    uint32_t head, tail, n;
+    
+    if (busy) {
+        return;
+    }
+    
+    busy++;
+    while ((head = queue_head) != (tail = queue_tail)) {
+        __asm__ __volatile__("" ::: "memory");
+        n = head - tail;
+        if (n > QUEUE_SIZE - (tail & QUEUE_MASK)) {
+            n = QUEUE_SIZE - (tail & QUEUE_MASK);
+        }
+        write_cells(&queue[tail & QUEUE_MASK], (int)n);
+        __asm__ __volatile__("" ::: "memory");
+        queue_tail = tail + n;
+    }
+    busy--;
+}
+
+/*
+ * Print a character
+ */
+void fb_putchar(char c) {
+    fb_write(&c, 1);
+}
+
+/*
+ * Print a string
+ */
+void fb_print(const char *str) {
+    int len = 0;
+    
+    while (str[len]) {
+        len++;
+    }
+    
+    if (queueing()) {
+        queue_put(str, len);
+        return;
+    }
+    
+    busy++;
+    fb_write(str, len);
+    request_flush();  /* Flush after printing string */
+    busy--;
+}
+
+/*
+ * Convert nibble to hex character
+ */
+static char nibble_to_hex(uint8_t nibble) {
+    nibble &= 0x0F;
+    if (nibble < 10) {
+        return '0' + nibble;
+    } else {
+        return 'A' + (nibble - 10);
+    }
+}
+
+/*
+ * Print hex number (without division)
+ */
+void fb_print_hex(uint32_t value) {
+    char buf[10];
+    int i;
+    
+    buf[0] = '0';
+    buf[1] = 'x';
+    
+    /* Each nibble from high to low */
+    for (i = 0; i < 8; i++) {
+        buf[2 + i] = nibble_to_hex((value >> (28 - i * 4)) & 0xF);
+    }
+    
+    fb_write(buf, 10);
+}
+
+/*
+ * Print decimal number
+ */
+void fb_print_int(int value) {
+    char buf[11];
+    int len = 0;
+    uint32_t uvalue;
+    uint32_t divisor;
+    int started = 0;
+    
+    if (value < 0) {
+        buf[len++] = '-';
+        uvalue = (uint32_t)(-value);
+    } else {
+        uvalue = (uint32_t)value;
+    }
+    
+    /* Digits from highest to lowest */
+    for (divisor = 1000000000; divisor > 0; divisor /= 10) {
+        uint8_t digit = (uint8_t)(uvalue / divisor);
+        uvalue %= divisor;
+        
+        if (digit != 0 || started || divisor == 1) {
+            buf[len++] = '0' + digit;
+            started = 1;
+        }
+    }
+    
+    fb_write(buf, len);
+}
+
+/*
+ * Clear console
+ * Blanks the cell grid; only cells that were not already blank are drawn
+ */
+void fb_console_clear(void) {
+    int y;
+    
+    fb_console_drain();
+    busy++;
+    out->top_row = 0;
+    for (y = 0; y < console_rows; y++) {
+        clear_row(y);
+    }
+    out->cursor_x = 0;
+    out->cursor_y = 0;
+    out->wrap_pending = 0;
+    request_flush();
+    busy--;
+}
+
+/*
+ * Redraw the whole console from the cell grid
+ * For use after something else has drawn over the screen
+ */
+void fb_console_redraw(void) {
+    fb_console_drain();
+    busy++;
+    invalidate_shadow();
+    fb_flush();
+    busy--;
+}
+
+/*
+ * Reset cursor to top-left without clearing
+ */
+void fb_console_reset_cursor(void) {
+    fb_console_drain();
+    out->cursor_x = 0;
+    out->cursor_y = 0;
+    out->wrap_pending = 0;
+}
+
+/*
+ * Flush buffer to screen (for interactive input)
+ */
+void fb_flush(void) {
+    int request;
+    uint32_t drawn;
+    
+    fb_console_drain();
+    busy++;
+    
+    /* A switch repaints the whole screen: not while a fullscreen client
+     * has it. It stays requested for the redraw that follows. */
+    request = gfx_is_owned() ? 0 : switch_request;
+    if (request) {
+        switch_request = 0;
+        shown = &vts[request - 1];
+        mark_all_rows();
+    }
+    flush_pending = (switch_request != 0);
+    flush_count++;
+    drawn = drawn_cells;
+    render();
+    if (request) {
+        switch_cells = drawn_cells - drawn;
+        switch_count++;
+    }
+    
+    if (hw_scroll) {
+        /* Text is already in video memory: just show it */
+        if (hw_shown != hw_origin) {
+            gfx_set_display_start(hw_origin);
+            hw_shown = hw_origin;
+        }
+    } else {
+        gfx_swap_buffers();
+    }
+    busy--;
+}
+
+/*
+ * Periodic flush, called from the timer interrupt
+ * In queued mode this is where writes are parsed and rendered.
+ * Skipped while console code is running or someone else holds the
+ * screen (a demo, a swap in progress); it will be retried next tick
+ */
+void fb_console_tick(void) {
+    if (busy || !flush_pending || gfx_is_owned()) {
+        return;
+    }
+    fb_flush();
+}
+
+/*
+ * Flush only if something is waiting to be presented
+ */
+void fb_flush_pending(void) {
+    if (flush_pending) {
+        fb_flush();
+    }
+}
+
+/*
+ * Select flush policy
+ * Queued writes are drained first. Switching to immediate presents
+ * anything still pending; the busy guard is dropped so a panic can
+ * print over an interrupted write and still drain the queue.
+ */
+void fb_set_flush_mode(int mode) {
+    if (mode == FB_FLUSH_IMMEDIATE) {
+        busy = 0;
+    }
+    fb_console_drain();
+    flush_mode = mode;
+    if (mode == FB_FLUSH_IMMEDIATE) {
+        fb_flush_pending();
+    }
+}
+
+/*
+ * Get flush policy
+ */
+int fb_get_flush_mode(void) {
+    return flush_mode;
+}
+
+/*
+ * Get flush statistics: flush requests and swaps actually done
+ */
+void fb_get_flush_stats(uint32_t *requests, uint32_t *flushes) {
+    *requests = flush_requests;
+    *flushes = flush_count;
+}
+
+/*
+ * Reset flush statistics
+ */
+void fb_reset_flush_stats(void) {
+    flush_requests = 0;
+    flush_count = 0;
+    queue_bytes = 0;
+    queue_peak = 0;
+    queue_stalls = 0;
+}
+
+/*
+ * Get queue statistics: bytes queued, peak fill and full-ring stalls
+ */
+void fb_get_queue_stats(uint32_t *bytes, uint32_t *peak, uint32_t *stalls) {
+    *bytes = queue_bytes;
+    *peak = queue_peak;
+    *stalls = queue_stalls;
+}
+
+/*
+ * Set text colors
+ * They also become the default colors escape sequences return to.
+ */
+void fb_set_text_color(uint32_t fg, uint32_t bg) {
+    fb_console_drain();
+    out->default_fg = fg;
+    out->default_bg = bg;
+    out->sgr_fg = fg;
+    out->sgr_bg = bg;
+    out->fg_index = -1;
+    out->bold = 0;
+    out->reverse = 0;
+    update_colors(out);
+}
+
+/*
+ * Select glyph rendering strategy
+ */
+void fb_set_render_mode(int mode) {
+    render_mode = mode;
+}
+
+/*
+ * Get glyph rendering strategy
+ */
+int fb_get_render_mode(void) {
+    return render_mode;
+}
+
+/*
+ * Draw a character into a cell without moving the cursor
+ * Bypasses the cell grid; the cell is repaired on the next render
+ */
+void fb_draw_glyph(char c, int col, int row) {
+    if (col < 0 || col >= console_cols || row < 0 || row >= console_rows ||
+        out != shown) {
+        return;
+    }
+    fb_cell_t *seen = &shadow_row(row)[col];
+    
+    busy++;
+    apply_scroll();
+    draw_char(c, out->fg_color, out->bg_color, col, row);
+    seen->ch = (uint8_t)c;
+    seen->fg = out->fg_color;
+    seen->bg = out->bg_color;
+    row_dirty[row] = 1;
+    flush_pending = 1;
+    busy--;
+}
+
+/*
+ * Get the font bitmap of a character
+ */
+const uint8_t *fb_get_glyph(char c) {
+    return font[(uint8_t)c & 0x7F];
+}
+
+/*
+ * Draw a string at a pixel position on the current draw target
+ * Only glyph pixels are written, in the back buffer format color
+ */
+int fb_draw_text(int x, int y, const char *str, uint32_t color) {
+    gfx_pixel_t *buffer = gfx_get_double_buffer();
+    int pitch = gfx_get_buffer_pitch();
+    int clip_x1, clip_y1, clip_x2, clip_y2;
+    int row1, row2, col1, col2, len, i, row, col;
+    int written = 0;
+    
+    for (len = 0; str[len]; len++);
+    gfx_get_clip(&clip_x1, &clip_y1, &clip_x2, &clip_y2);
+    
+    row1 = clip_y1 > y ? clip_y1 - y : 0;
+    row2 = clip_y2 < y + 7 ? clip_y2 - y : 7;
+    if (len == 0 || row1 > row2 || x + len * 8 <= clip_x1 || x > clip_x2) return 0;
+    
+    for (i = 0; i < len; i++) {
+        const uint8_t *glyph = fb_get_glyph(str[i]);
+        int gx = x + i * 8;
+        
+        col1 = clip_x1 > gx ? clip_x1 - gx : 0;
+        col2 = clip_x2 < gx + 7 ? clip_x2 - gx : 7;
+        if (col1 > col2) continue;
+        for (row = row1; row <= row2; row++) {
+            gfx_pixel_t *dst = buffer + (y + row) * pitch + gx;
+            uint8_t bits = glyph[row];
+            
+            for (col = col1; col <= col2; col++) {
+                if (bits & (0x80 >> col)) {
+                    dst[col] = (gfx_pixel_t)color;
+                    written++;
+                }
+            }
+        }
+    }
+    
+    col1 = x > clip_x1 ? x : clip_x1;
+    col2 = x + len * 8 - 1 < clip_x2 ? x + len * 8 - 1 : clip_x2;
+    gfx_mark_dirty_rect(col1, y + row1, col2 - col1 + 1, row2 - row1 + 1);
+    return written;
+}
+
+/*
+ * Console size in character cells
+ */
+int fb_console_cols(void) {
+    return console_cols;
+}
+
+int fb_console_rows(void) {
+    return console_rows;
+}
+
+/*
+ * Enable or disable hardware scrolling
+ * Returns 0 on success, -1 if the adapter cannot provide a virtual screen
+ */
+int fb_console_set_hw_scroll(int enable) {
+    if (enable) {
+        /* The display start already belongs to page flipping */
+        if (gfx_get_present_mode() != GFX_PRESENT_COPY) {
+            return -1;
+        }
+        
+        /* Glyphs are written to video memory in the back buffer format */
+        if (gfx_get_bpp() != GFX_BUFFER_BPP) {
+            return -1;
+        }
+        
+        int lines = gfx_set_virtual_height(HW_SCROLL_MAX_LINES);
+        if (lines < gfx_get_height() + CHAR_HEIGHT) {
+            return -1;
+        }
+    }
+    
+    hw_scroll = enable ? 1 : 0;
+    hw_origin = 0;
+    hw_shown = 0;
+    gfx_set_display_start(0);
+    
+    /* Pixels now come from a different place; repaint everything */
+    fb_console_redraw();
+    return 0;
+}
+
+/*
+ * Check if hardware scrolling is enabled
+ */
+int fb_console_get_hw_scroll(void) {
+    return hw_scroll;
+}
+
+/*
+ * Show a virtual console now
+ * Only the cells that differ from the screen are drawn, in one render.
+ * Returns 0, or -1 if there is no such console
+ */
+int fb_vt_switch(int vt) {
+    if (vt < 0 || vt >= FB_VT_COUNT) {
+        return -1;
+    }
+    switch_request = vt + 1;
+    fb_flush();
+    return 0;
+}
+
+/*
+ * Ask for a virtual console to be shown, safe from interrupts
+ * Done by the next tick or flush, once no console code is running and
+ * no fullscreen client holds the screen.
+ */
+void fb_vt_request(int vt) {
+    if (vt < 0 || vt >= FB_VT_COUNT) {
+        return;
+    }
+    switch_request = vt + 1;
+    flush_pending = 1;
+}
+
+/*
+ * Get the virtual console shown (or about to be)
+ */
+int fb_vt_get_active(void) {
+    int request = switch_request;
+    
+    if (request) {
+        return request - 1;
+    }
+    return (int)(shown - vts);
+}
+
+/*
+ * Select the virtual console that fb_write and friends print to
+ */
+void fb_vt_set_output(int vt) {
+    if (vt < 0 || vt >= FB_VT_COUNT) {
+        return;
+    }
+    fb_console_drain();
+    out = &vts[vt];
+}
+
+/*
+ * Get the output virtual console
+ */
+int fb_vt_get_output(void) {
+    return (int)(out - vts);
+}
+
+/*
+ * Write to a virtual console other than the output one
+ * Returns bytes consumed, or -1 if there is no such console
+ */
+int fb_vt_write(int vt, const char *buf, int len) {
+    fb_vt_t *target = out;
+    int n;
+    
+    if (vt < 0 || vt >= FB_VT_COUNT) {
+        return -1;
+    }
+    fb_console_drain();
+    busy++;
+    out = &vts[vt];
+    n = fb_write(buf, len);
+    out = target;
+    busy--;
+    return n;
+}
+
+/*
+ * Print a string to a virtual console
+ */
+void fb_vt_print(int vt, const char *str) {
+    fb_vt_t *target = out;
+    
+    if (vt < 0 || vt >= FB_VT_COUNT) {
+        return;
+    }
+    fb_console_drain();
+    busy++;
+    out = &vts[vt];
+    fb_print(str);
+    out = target;
+    busy--;
+}
+
+/*
+ * Get switch statistics: switches done and cells the last one drew
+ */
+void fb_vt_get_stats(uint32_t *switches, uint32_t *cells) {
+    *switches = switch_count;
+    *cells = switch_cells;
 }
@@ -1,6 +1,6 @@
 /*
  * fb_console.h - Framebuffer console header
- * version 0.0.2
+ * version 0.0.12
  * Text console for VBE graphics mode
  */
 
@@ -9,12 +9,36 @@
 
 #include "../../stdint.h"
 
+/* Glyph rendering strategies */
+#define FB_RENDER_AUTO    0   /* Cached tiles, SIMD while colors change often */
+#define FB_RENDER_SCALAR  1   /* Per-pixel bit test loop */
+#define FB_RENDER_CACHED  2   /* Pre-expanded tiles for the current color pair */
+#define FB_RENDER_SIMD    3   /* SSE2 mask expansion, any colors */
+
+/* Virtual consoles */
+#define FB_VT_COUNT 6
+
+/* Flush policies */
+#define FB_FLUSH_IMMEDIATE  0   /* Swap on every newline and end of print */
+#define FB_FLUSH_DEFERRED   1   /* Record damage, swap on tick or fb_flush */
+#define FB_FLUSH_QUEUED     2   /* Writes only copy into a ring; the tick
+                                 * parses, renders and swaps */
+
 /* Initialize framebuffer console */
 void fb_console_init(void);
 
+/* Adapt the console to a new display mode (after gfx_set_mode) */
+void fb_console_resize(void);
+
 /* Print a character to framebuffer console */
 void fb_putchar(char c);
 
+/* Write len bytes to framebuffer console, returns bytes consumed
+ * VT100/ANSI sequences are understood: cursor moves (CUU..CUP, VPA),
+ * SGR colors (8/16, 256 and direct), ED/EL/ECH, ICH/DCH, IL/DL, SU/SD,
+ * scroll regions (DECSTBM), cursor save/restore, IND/NEL/RI and RIS */
+int fb_write(const char *buf, int len);
+
 /* Print a string to framebuffer console */
 void fb_print(const char *str);
 
@@ -27,13 +51,91 @@ void fb_print_int(int value);
 /* Clear the console */
 void fb_console_clear(void);
 
+/* Redraw the whole console from its cell grid */
+void fb_console_redraw(void);
+
 /* Reset cursor to top-left */
 void fb_console_reset_cursor(void);
 
-/* Set text color */
+/* Set text color, also the default escape sequences return to */
 void fb_set_text_color(uint32_t fg, uint32_t bg);
 
 /* Flush buffer to screen */
 void fb_flush(void);
 
+/* Flush only if there is unpresented damage */
+void fb_flush_pending(void);
+
+/* Periodic flush for deferred mode (timer callback) */
+void fb_console_tick(void);
+
+/* Apply every queued write to the cell grid now (panics, or before
+ * reading the screen); other console calls drain first on their own.
+ * Queued writes come from one writer at a time and not from interrupt
+ * handlers, which switch to immediate mode before printing */
+void fb_console_drain(void);
+
+/* Select flush policy (FB_FLUSH_*) */
+void fb_set_flush_mode(int mode);
+
+/* Get flush policy */
+int fb_get_flush_mode(void);
+
+/* Flush statistics: requests vs swaps actually done */
+void fb_get_flush_stats(uint32_t *requests, uint32_t *flushes);
+void fb_reset_flush_stats(void);
+
+/* Queue statistics: bytes queued, most bytes waiting at once, and
+ * writes that found the ring full and drained it themselves */
+void fb_get_queue_stats(uint32_t *bytes, uint32_t *peak, uint32_t *stalls);
+
+/* Select glyph rendering strategy (FB_RENDER_*) */
+void fb_set_render_mode(int mode);
+
+/* Get glyph rendering strategy */
+int fb_get_render_mode(void);
+
+/* Draw a character into a cell without moving the cursor */
+void fb_draw_glyph(char c, int col, int row);
+
+/* Font bitmap of a character: 8 rows of 8 pixels, leftmost pixel in bit 7 */
+const uint8_t *fb_get_glyph(char c);
+
+/* Draw a string of 8x8 glyphs at pixel x, y on the graphics draw target
+ * Clipped, background left as is; returns the number of pixels written */
+int fb_draw_text(int x, int y, const char *str, uint32_t color);
+
+/* Enable/disable hardware scrolling (Bochs/QEMU DISPI Y offset)
+ * Returns 0 on success, -1 if not supported */
+int fb_console_set_hw_scroll(int enable);
+
+/* Check if hardware scrolling is enabled */
+int fb_console_get_hw_scroll(void);
+
+/* Console size in character cells */
+int fb_console_cols(void);
+int fb_console_rows(void);
+
+/* Show virtual console vt (0..FB_VT_COUNT - 1) now; not from interrupts
+ * Returns 0, or -1 if there is no such console */
+int fb_vt_switch(int vt);
+
+/* Show virtual console vt on the next tick or flush (interrupt safe) */
+void fb_vt_request(int vt);
+
+/* Virtual console shown, or about to be */
+int fb_vt_get_active(void);
+
+/* Select the virtual console printed to; the others keep their text
+ * in their cell grids and draw nothing until shown */
+void fb_vt_set_output(int vt);
+int fb_vt_get_output(void);
+
+/* Write or print to a given virtual console, output one unchanged */
+int fb_vt_write(int vt, const char *buf, int len);
+void fb_vt_print(int vt, const char *str);
+
+/* Switches done, and cells drawn by the last one */
+void fb_vt_get_stats(uint32_t *switches, uint32_t *cells);
+
 #endif /* FB_CONSOLE_H */
@@ -1,10 +1,23 @@
 /*
  * graphics.c - Graphics driver implementation
- * version 0.0.7
+ * version 0.0.18
  * Optimized with SSE for faster memory operations
+ * Virtual screen and display start line on Bochs/QEMU DISPI
+ * Page flipping: two pages in video memory, drawing goes to the back page
+ * Runtime mode setting; swaps convert to the framebuffer's depth and pitch
+ * Back buffer is XRGB8888, or RGB565 when built with GFX_BACKBUFFER_16
+ * Drawing goes to a target: the screen or an off-screen surface
+ * Blits clip once and copy whole rows; copies within a buffer may overlap
+ * An overlay (the mouse cursor) is taken off the visible screen around
+ * every change to it
+ * Screen ownership count keeps interrupt-time presenting out of frames
+ * being drawn or swapped on the main thread
  */
 
 #include "graphics.h"
+#include "bochs_vbe.h"
+#include "pixfmt.h"
+#include "raster.h"
 #include "../../utils.h"
 #include "../../string.h"
 
@@ -12,20 +25,85 @@
 static uint32_t *framebuffer = (uint32_t *)0;
 static int fb_width = 800;
 static int fb_height = 600;
-static int fb_pitch = 800 * 4;
+static int fb_pitch = 800 * 4;   /* In bytes */
+static int fb_bpp = 32;
+static const pixfmt_t *fb_format = (const pixfmt_t *)0;
+
+/* Virtual screen: visible window starts at display_start (in lines) */
+static int has_dispi = 0;
+static int virt_height = 600;
+static int display_start = 0;
 
 /* Double buffer - aligned for SSE */
-static uint32_t double_buffer[800 * 600] __attribute__((aligned(16)));
+static gfx_pixel_t double_buffer[GFX_MAX_WIDTH * GFX_MAX_HEIGHT] __attribute__((aligned(16)));
+
+/* Draw target: the double buffer, or the back page when page flipping */
+static gfx_pixel_t *back_buffer = double_buffer;
+static int back_pitch = 800;   /* In pixels */
+
+/* Page flipping state */
+static int present_mode = GFX_PRESENT_COPY;
+static int front_page = 0;
 
-/* Dirty rectangle tracking */
-static int dirty_x1 = 0, dirty_y1 = 0;
-static int dirty_x2 = 799, dirty_y2 = 599;
+/* Region of the front page the back page is missing (copied on demand) */
+static int stale_x1 = 0, stale_y1 = 0;
+static int stale_x2 = -1, stale_y2 = -1;
+
+/* The screen as a draw target; its dirty rectangle is what the next
+ * swap presents. pixels and pitch follow the back buffer. */
+static gfx_surface_t screen = {
+    double_buffer, 800, 600, 800,
+    0, 0, 799, 599,
+    0, 0, 799, 599
+};
 static int dirty_enabled = 1;  /* Start with dirty enabled */
 
+/* Screen area the last swap presented, x2/y2 inclusive (empty if x1 > x2) */
+static int presented_x1 = 0, presented_y1 = 0;
+static int presented_x2 = -1, presented_y2 = -1;
+
+/* Overlay on the visible screen */
+static gfx_overlay_hide_fn overlay_hide = (gfx_overlay_hide_fn)0;
+static gfx_overlay_show_fn overlay_show = (gfx_overlay_show_fn)0;
+
+/* Current draw target; 0 means the screen */
+static gfx_surface_t *target = (gfx_surface_t *)0;
+
+/* Screen owners; interrupts only ever see it back at the value they
+ * interrupted, so a plain increment is enough on one CPU */
+static volatile int owners = 0;
+
 /* External functions from kernel.c */
 extern uint32_t *gfx_get_framebuffer_from_multiboot(void);
 extern int gfx_get_width_from_multiboot(void);
 extern int gfx_get_height_from_multiboot(void);
+extern int gfx_get_pitch_from_multiboot(void);
+extern int gfx_get_bpp_from_multiboot(void);
+
+/* Swap row kernel for the back buffer format */
+#ifdef GFX_BACKBUFFER_16
+#define SWAP_BLIT(format) ((format)->blit_row_565)
+typedef pixfmt_blit565_fn swap_blit_fn;
+#else
+#define SWAP_BLIT(format) ((format)->blit_row)
+typedef pixfmt_blit_fn swap_blit_fn;
+#endif
+
+/* Back buffer pixels per SSE register, and the compare for them */
+#define XMM_PIXELS ((int)(16 / sizeof(gfx_pixel_t)))
+#ifdef GFX_BACKBUFFER_16
+#define PCMPEQ_PIXELS "pcmpeqw"
+#else
+#define PCMPEQ_PIXELS "pcmpeqd"
+#endif
+
+/* Modes offered through DISPI */
+static const gfx_mode_t dispi_modes[] = {
+    {640, 480, 32}, {640, 480, 24}, {640, 480, 16},
+    {800, 600, 32}, {800, 600, 24}, {800, 600, 16},
+    {1024, 768, 32}, {1024, 768, 24}, {1024, 768, 16},
+};
+#define DISPI_MODE_COUNT ((int)(sizeof(dispi_modes) / sizeof(dispi_modes[0])))
 
 /*
  * SSE-optimized memory copy (16 bytes at a time)
@@ -81,6 +159,191 @@ static void sse_memset32(void *dst, uint32_t value, int count) {
     }
 }
 
+/*
+ * Fill count back buffer pixels with a native color
+ */
+static void fill_pixels(gfx_pixel_t *dst, uint32_t color, int count) {
+#ifdef GFX_BACKBUFFER_16
+    /* Align to 4 bytes, then fill pixel pairs */
+    if (count > 0 && ((uint32_t)dst & 2)) {
+        *dst++ = (gfx_pixel_t)color;
+        count--;
+    }
+    sse_memset32(dst, (color & 0xFFFF) | (color << 16), count / 2);
+    if (count & 1) {
+        dst[count - 1] = (gfx_pixel_t)color;
+    }
+#else
+    sse_memset32(dst, color, count);
+#endif
+}
+
+/*
+ * Copy count pixels, like memmove
+ * Stores are 16-byte aligned. A destination inside the source past its
+ * start is copied from the end, so overlapping pixels are read first.
+ */
+static void copy_row(gfx_pixel_t *dst, const gfx_pixel_t *src, int count) {
+    if (dst > src && dst < src + count) {
+        while (count > 0 && ((uint32_t)(dst + count) & 15)) {
+            count--;
+            dst[count] = src[count];
+        }
+        while (count >= 4 * XMM_PIXELS) {
+            count -= 4 * XMM_PIXELS;
+            __asm__ __volatile__(
+                "movdqu 48(%1), %%xmm3\n\t"
+                "movdqu 32(%1), %%xmm2\n\t"
+                "movdqu 16(%1), %%xmm1\n\t"
+                "movdqu (%1), %%xmm0\n\t"
+                "movdqa %%xmm3, 48(%0)\n\t"
+                "movdqa %%xmm2, 32(%0)\n\t"
+                "movdqa %%xmm1, 16(%0)\n\t"
+                "movdqa %%xmm0, (%0)"
+                :
+                : "r"(dst + count), "r"(src + count)
+                : "xmm0", "xmm1", "xmm2", "xmm3", "memory"
+            );
+        }
+        while (count >= XMM_PIXELS) {
+            count -= XMM_PIXELS;
+            __asm__ __volatile__(
+                "movdqu (%1), %%xmm0\n\t"
+                "movdqa %%xmm0, (%0)"
+                :
+                : "r"(dst + count), "r"(src + count)
+                : "xmm0", "memory"
+            );
+        }
+        while (count > 0) {
+            count--;
+            dst[count] = src[count];
+        }
+        return;
+    }
+    
+    while (count > 0 && ((uint32_t)dst & 15)) {
+        *dst++ = *src++;
+        count--;
+    }
+    for (; count >= 4 * XMM_PIXELS; count -= 4 * XMM_PIXELS) {
+        __asm__ __volatile__(
+            "movdqu (%1), %%xmm0\n\t"
+            "movdqu 16(%1), %%xmm1\n\t"
+            "movdqu 32(%1), %%xmm2\n\t"
+            "movdqu 48(%1), %%xmm3\n\t"
+            "movdqa %%xmm0, (%0)\n\t"
+            "movdqa %%xmm1, 16(%0)\n\t"
+            "movdqa %%xmm2, 32(%0)\n\t"
+            "movdqa %%xmm3, 48(%0)"
+            :
+            : "r"(dst), "r"(src)
+            : "xmm0", "xmm1", "xmm2", "xmm3", "memory"
+        );
+        dst += 4 * XMM_PIXELS;
+        src += 4 * XMM_PIXELS;
+    }
+    for (; count >= XMM_PIXELS; count -= XMM_PIXELS) {
+        __asm__ __volatile__(
+            "movdqu (%1), %%xmm0\n\t"
+            "movdqa %%xmm0, (%0)"
+            :
+            : "r"(dst), "r"(src)
+            : "xmm0", "memory"
+        );
+        dst += XMM_PIXELS;
+        src += XMM_PIXELS;
+    }
+    while (count-- > 0) {
+        *dst++ = *src++;
+    }
+}
+
+/*
+ * Copy count pixels, skipping those equal to key; overlap as copy_row
+ * With masked set the pixels go out through maskmovdqu and dst is never
+ * read, which is what video memory wants; otherwise dst is read and
+ * merged, which keeps a back buffer in RAM in the cache.
+ */
+static void key_row(gfx_pixel_t *dst, const gfx_pixel_t *src, int count,
+                    uint32_t key, int masked) {
+    gfx_pixel_t k = (gfx_pixel_t)key;
+    uint32_t key32 = k;
+    int backward = dst > src && dst < src + count;
+    int blocks = count / XMM_PIXELS;
+    int b, i;
+    
+#ifdef GFX_BACKBUFFER_16
+    key32 |= key32 << 16;
+#endif
+    
+    if (backward) {
+        for (i = count - 1; i >= blocks * XMM_PIXELS; i--) {
+            if (src[i] != k) dst[i] = src[i];
+        }
+    }
+    
+    for (b = 0; b < blocks; b++) {
+        i = (backward ? blocks - 1 - b : b) * XMM_PIXELS;
+        if (masked) {
+            __asm__ __volatile__(
+                "movd %1, %%xmm3\n\t"
+                "pshufd $0, %%xmm3, %%xmm3\n\t"
+                "movdqu (%0), %%xmm0\n\t"
+                /* Mask of the pixels that are not the key */
+                "movdqa %%xmm0, %%xmm2\n\t"
+                PCMPEQ_PIXELS " %%xmm3, %%xmm2\n\t"
+                "pcmpeqd %%xmm4, %%xmm4\n\t"
+                "pxor %%xmm4, %%xmm2\n\t"
+                "maskmovdqu %%xmm2, %%xmm0"
+                :
+                : "r"(src + i), "r"(key32), "D"(dst + i)
+                : "xmm0", "xmm2", "xmm3", "xmm4", "memory"
+            );
+        } else {
+            __asm__ __volatile__(
+                "movd %2, %%xmm3\n\t"
+                "pshufd $0, %%xmm3, %%xmm3\n\t"
+                "movdqu (%1), %%xmm0\n\t"
+                "movdqu (%0), %%xmm1\n\t"
+                /* Mask of the pixels that are the key */
+                "movdqa %%xmm0, %%xmm2\n\t"
+                PCMPEQ_PIXELS " %%xmm3, %%xmm2\n\t"
+                /* Keep dst there, take src elsewhere */
+                "pand %%xmm2, %%xmm1\n\t"
+                "pandn %%xmm0, %%xmm2\n\t"
+                "por %%xmm2, %%xmm1\n\t"
+                "movdqu %%xmm1, (%0)"
+                :
+                : "r"(dst + i), "r"(src + i), "r"(key32)
+                : "xmm0", "xmm1", "xmm2", "xmm3", "memory"
+            );
+        }
+    }
+    
+    if (!backward) {
+        for (i = blocks * XMM_PIXELS; i < count; i++) {
+            if (src[i] != k) dst[i] = src[i];
+        }
+    }
+}
+
+/*
+ * Size the screen target to the mode and open its clip rectangle
+ */
+static void reset_screen(void) {
+    screen.pixels = back_buffer;
+    screen.pitch = back_pitch;
+    screen.width = fb_width;
+    screen.height = fb_height;
+    screen.clip_x1 = 0;
+    screen.clip_y1 = 0;
+    screen.clip_x2 = fb_width - 1;
+    screen.clip_y2 = fb_height - 1;
+    presented_x2 = -1;
+    presented_y2 = -1;
+}
+
 /*
  * Initialize graphics mode
  */
@@ -89,7 +352,31 @@ int graphics_init(void) {
     framebuffer = gfx_get_framebuffer_from_multiboot();
     fb_width = gfx_get_width_from_multiboot();
     fb_height = gfx_get_height_from_multiboot();
-    fb_pitch = fb_width * 4;
+    fb_pitch = gfx_get_pitch_from_multiboot();
+    fb_bpp = gfx_get_bpp_from_multiboot();
+    
+    fb_format = pixfmt_get(fb_bpp);
+    if (!fb_format) {
+        /* Unknown depth: assume 32 bpp, as before */
+        fb_bpp = 32;
+        fb_format = pixfmt_get(32);
+    }
+    if (fb_pitch < fb_width * fb_format->bytes) {
+        fb_pitch = fb_width * fb_format->bytes;
+    }
+    
+    /* Only the top-left part of larger modes is used */
+    if (fb_width > GFX_MAX_WIDTH) fb_width = GFX_MAX_WIDTH;
+    if (fb_height > GFX_MAX_HEIGHT) fb_height = GFX_MAX_HEIGHT;
+    
+    has_dispi = bochs_vbe_detect();
+    virt_height = fb_height;
+    display_start = 0;
+    
+    back_buffer = double_buffer;
+    back_pitch = fb_width;
+    present_mode = GFX_PRESENT_COPY;
+    reset_screen();
     
     print("GFX: Framebuffer at ");
     print_hex((unsigned int)framebuffer);
@@ -98,10 +385,12 @@ int graphics_init(void) {
     print_int(fb_width);
     print("x");
     print_int(fb_height);
+    print("x");
+    print_int(fb_bpp);
     print("\n");
     
     /* Clear the double buffer using SSE */
-    sse_memset32(double_buffer, 0, fb_width * fb_height);
+    fill_pixels(double_buffer, 0, fb_width * fb_height);
     
     /* Mark entire screen as dirty initially - force full redraw */
     gfx_mark_all_dirty();
@@ -110,44 +399,131 @@ int graphics_init(void) {
 }
 
 /*
- * Mark a region as dirty (needs redraw)
+ * Remember what a swap presented
+ */
+static void set_presented(int x1, int y1, int x2, int y2) {
+    presented_x1 = x1;
+    presented_y1 = y1;
+    presented_x2 = x2;
+    presented_y2 = y2;
+}
+
+/*
+ * Empty the dirty region; tracking stays on so later draws are
+ * collected for the next swap
+ */
+static void reset_dirty(void) {
+    screen.dirty_x1 = fb_width;
+    screen.dirty_y1 = fb_height;
+    screen.dirty_x2 = 0;
+    screen.dirty_y2 = 0;
+    dirty_enabled = 1;
+}
+
+/*
+ * Bring the back page up to date with the front page
+ * After a flip the back page holds an older frame; the area changed in
+ * the frame just shown is copied over before anything reads or draws.
+ */
+static void sync_back(void) {
+    int y;
+    
+    if (stale_x1 > stale_x2 || stale_y1 > stale_y2) return;
+    
+    gfx_pixel_t *front = gfx_get_screen_line(front_page * fb_height);
+    int bytes = (stale_x2 - stale_x1 + 1) * (int)sizeof(gfx_pixel_t);
+    
+    /* The overlay is on the front page and must not be copied */
+    gfx_hide_overlay(stale_x1, stale_y1, stale_x2, stale_y2);
+    for (y = stale_y1; y <= stale_y2; y++) {
+        sse_memcpy(&back_buffer[y * back_pitch + stale_x1],
+                   &front[y * back_pitch + stale_x1], bytes);
+    }
+    gfx_show_overlay();
+    
+    stale_x2 = -1;
+    stale_y2 = -1;
+}
+
+/*
+ * Get the current draw target, ready for drawing
+ * The screen entry follows the back buffer, which moves when pages flip
+ */
+static gfx_surface_t *draw_target(void) {
+    if (target) return target;
+    
+    sync_back();
+    screen.pixels = back_buffer;
+    screen.pitch = back_pitch;
+    return &screen;
+}
+
+/*
+ * Grow the dirty rectangle of a target (inclusive coordinates)
+ */
+static void damage(gfx_surface_t *s, int x1, int y1, int x2, int y2) {
+    if (s == &screen && !dirty_enabled) return;
+    
+    if (x1 < s->dirty_x1) s->dirty_x1 = x1;
+    if (y1 < s->dirty_y1) s->dirty_y1 = y1;
+    if (x2 > s->dirty_x2) s->dirty_x2 = x2;
+    if (y2 > s->dirty_y2) s->dirty_y2 = y2;
+}
+
+/*
+ * Clip a rectangle to the clip rectangle of a target
+ * Returns 0 if nothing is left
  */
-static void mark_dirty(int x, int y) {
-    if (!dirty_enabled) return;
+static int clip_to(const gfx_surface_t *s, int *x, int *y, int *width, int *height) {
+    if (*x < s->clip_x1) { *width -= s->clip_x1 - *x; *x = s->clip_x1; }
+    if (*y < s->clip_y1) { *height -= s->clip_y1 - *y; *y = s->clip_y1; }
+    if (*x + *width > s->clip_x2 + 1) *width = s->clip_x2 + 1 - *x;
+    if (*y + *height > s->clip_y2 + 1) *height = s->clip_y2 + 1 - *y;
     
-    if (x < dirty_x1) dirty_x1 = x;
-    if (y < dirty_y1) dirty_y1 = y;
-    if (x > dirty_x2) dirty_x2 = x;
-    if (y > dirty_y2) dirty_y2 = y;
+    return *width > 0 && *height > 0;
 }
 
 /*
  * Mark entire screen as dirty
  */
 void gfx_mark_all_dirty(void) {
-    dirty_x1 = 0;
-    dirty_y1 = 0;
-    dirty_x2 = fb_width - 1;
-    dirty_y2 = fb_height - 1;
+    screen.dirty_x1 = 0;
+    screen.dirty_y1 = 0;
+    screen.dirty_x2 = fb_width - 1;
+    screen.dirty_y2 = fb_height - 1;
     dirty_enabled = 1;
 }
 
+/*
+ * Mark a rectangle of the draw target as dirty
+ * Used by code that writes the double buffer directly
+ */
+void gfx_mark_dirty_rect(int x, int y, int width, int height) {
+    if (width <= 0 || height <= 0) return;
+    
+    damage(target ? target : &screen, x, y, x + width - 1, y + height - 1);
+}
+
 /*
  * Set a pixel color
  */
 void gfx_set_pixel(int x, int y, uint32_t color) {
-    if (x >= 0 && x < fb_width && y >= 0 && y < fb_height) {
-        double_buffer[y * fb_width + x] = color;
-        mark_dirty(x, y);
+    gfx_surface_t *s = draw_target();
+    
+    if (x >= s->clip_x1 && x <= s->clip_x2 && y >= s->clip_y1 && y <= s->clip_y2) {
+        s->pixels[y * s->pitch + x] = color;
+        damage(s, x, y, x, y);
     }
 }
 
 /*
- * Get a pixel color from double buffer
+ * Get a pixel color from the draw target
  */
 uint32_t gfx_get_pixel(int x, int y) {
-    if (x >= 0 && x < fb_width && y >= 0 && y < fb_height) {
-        return double_buffer[y * fb_width + x];
+    gfx_surface_t *s = draw_target();
+    
+    if (x >= 0 && x < s->width && y >= 0 && y < s->height) {
+        return s->pixels[y * s->pitch + x];
     }
     return 0;
 }
@@ -157,7 +533,8 @@ uint32_t gfx_get_pixel(int x, int y) {
  */
 uint32_t gfx_get_screen_pixel(int x, int y) {
     if (x >= 0 && x < fb_width && y >= 0 && y < fb_height && framebuffer) {
-        return framebuffer[y * fb_width + x];
+        uint8_t *line = (uint8_t *)gfx_get_screen_line(display_start + y);
+        return gfx_color(fb_format->read_pixel(line + x * fb_format->bytes));
     }
     return 0;
 }
@@ -165,9 +542,30 @@ uint32_t gfx_get_screen_pixel(int x, int y) {
 /*
  * Clear screen with color (marks entire screen dirty)
  * Uses SSE for faster clearing
+ * On a surface, or with a clip rectangle set, the clip area is filled
  */
 void gfx_clear(uint32_t color) {
-    sse_memset32(double_buffer, color, fb_width * fb_height);
+    int y;
+    
+    if (target || screen.clip_x1 > 0 || screen.clip_y1 > 0 ||
+        screen.clip_x2 < fb_width - 1 || screen.clip_y2 < fb_height - 1) {
+        gfx_surface_t *s = target ? target : &screen;
+        gfx_fill_rect(s->clip_x1, s->clip_y1, s->clip_x2 - s->clip_x1 + 1,
+                      s->clip_y2 - s->clip_y1 + 1, color);
+        return;
+    }
+    
+    /* Everything is overwritten: the back page needs no catching up */
+    stale_x2 = -1;
+    stale_y2 = -1;
+    
+    if (back_pitch == fb_width) {
+        fill_pixels(back_buffer, color, fb_width * fb_height);
+    } else {
+        for (y = 0; y < fb_height; y++) {
+            fill_pixels(&back_buffer[y * back_pitch], color, fb_width);
+        }
+    }
     gfx_mark_all_dirty();
 }
 
@@ -176,54 +574,30 @@ void gfx_clear(uint32_t color) {
  * Fills only the area that has been modified
  */
 void gfx_clear_dirty(uint32_t color) {
-    int x, y;
-    for (y = dirty_y1; y <= dirty_y2; y++) {
-        for (x = dirty_x1; x <= dirty_x2; x++) {
-            double_buffer[y * fb_width + x] = color;
-        }
+    gfx_surface_t *s = draw_target();
+    int y;
+    
+    if (s->dirty_x1 > s->dirty_x2) return;
+    
+    for (y = s->dirty_y1; y <= s->dirty_y2; y++) {
+        fill_pixels(&s->pixels[y * s->pitch + s->dirty_x1], color,
+                    s->dirty_x2 - s->dirty_x1 + 1);
     }
-    /* Reset dirty region */
-    dirty_x1 = fb_width;
-    dirty_y1 = fb_height;
-    dirty_x2 = 0;
-    dirty_y2 = 0;
-    dirty_enabled = 0;
+    /* The region stays dirty so the cleared pixels reach the screen */
 }
 
 /*
- * Draw a filled circle (optimized with horizontal lines)
+ * Draw a filled circle (midpoint spans, see raster.c)
  */
 void gfx_draw_circle(int cx, int cy, int radius, uint32_t color) {
-    int y;
-    int r2 = radius * radius;
-    
-    for (y = -radius; y <= radius; y++) {
-        /* Calculate width of this scanline using circle equation */
-        int y2 = y * y;
-        int max_x = 0;
-        int x;
-        
-        /* Find the rightmost x for this y */
-        for (x = 0; x <= radius; x++) {
-            if (x * x + y2 <= r2) {
-                max_x = x;
-            }
-        }
-        
-        /* Draw horizontal line from -max_x to +max_x */
-        if (max_x > 0) {
-            gfx_draw_hline(cx - max_x, cy + y, max_x * 2 + 1, color);
-        } else if (max_x == 0) {
-            gfx_set_pixel(cx, cy + y, color);
-        }
-    }
+    gfx_fill_circle(cx, cy, radius, color);
 }
 
 /*
- * Create RGB color
+ * Create RGB color in the back buffer format
  */
 uint32_t gfx_rgb(uint8_t r, uint8_t g, uint8_t b) {
-    return ((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b;
+    return gfx_color(((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b);
 }
 
 /*
@@ -278,34 +652,140 @@ int gfx_get_height(void) {
 }
 
 /*
- * Swap buffers - copy only dirty region to screen
- * Uses SSE for faster copying
+ * Wait for the start of vertical retrace (VGA input status register)
+ * Bounded, so a device without the status bit cannot hang the caller
  */
-void gfx_swap_buffers(void) {
-    if (!framebuffer) return;
+static void wait_vretrace(void) {
+    int spin;
+    
+    for (spin = 0; spin < 100000 && (inb(0x3DA) & 0x08); spin++) {
+        /* Leave the current retrace */
+    }
+    for (spin = 0; spin < 100000 && !(inb(0x3DA) & 0x08); spin++) {
+        /* Wait for the next one */
+    }
+}
+
+/*
+ * Get a page of the virtual screen
+ */
+static gfx_pixel_t *page_pixels(int page) {
+    return gfx_get_screen_line(page * fb_height);
+}
+
+/*
+ * Present the back page by moving the display start to it
+ * The old front page becomes the new back page. In GFX_PRESENT_FLIP
+ * mode it is caught up with the frame just shown (lazily, see
+ * sync_back); GFX_PRESENT_FLIP_DISCARD leaves the frame before last
+ * in it. A full flip always catches up the whole page.
+ */
+static void flip_pages(int full) {
+    int x1 = screen.dirty_x1, y1 = screen.dirty_y1, x2 = screen.dirty_x2, y2 = screen.dirty_y2;
+    
+    if (full || !dirty_enabled) {
+        x1 = 0;
+        y1 = 0;
+        x2 = fb_width - 1;
+        y2 = fb_height - 1;
+    } else if (x1 > x2 || y1 > y2) {
+        /* Nothing drawn since the last flip */
+        return;
+    }
+    
+    /* The page about to be shown must be complete */
+    gfx_hide_overlay(0, 0, fb_width - 1, fb_height - 1);
+    sync_back();
+    
+    wait_vretrace();
+    front_page ^= 1;
+    gfx_set_display_start(front_page * fb_height);
+    back_buffer = page_pixels(front_page ^ 1);
+    gfx_show_overlay();
+    
+    if (full || present_mode == GFX_PRESENT_FLIP) {
+        stale_x1 = x1;
+        stale_y1 = y1;
+        stale_x2 = x2;
+        stale_y2 = y2;
+    }
     
-    /* If no dirty region or invalid, do full swap */
-    if (!dirty_enabled || dirty_x1 > dirty_x2 || dirty_y1 > dirty_y2) {
+    set_presented(x1, y1, x2, y2);
+    reset_dirty();
+}
+
+/*
+ * Take the screen for drawing and presenting on this thread
+ */
+void gfx_acquire(void) {
+    owners++;
+}
+
+/*
+ * Give the screen back
+ */
+void gfx_release(void) {
+    if (owners > 0) {
+        owners--;
+    }
+}
+
+/*
+ * Check if someone holds the screen
+ */
+int gfx_is_owned(void) {
+    return owners > 0;
+}
+
+/*
+ * Copy the dirty region to the screen, or flip to the back page
+ */
+static void swap_dirty(void) {
+    if (present_mode != GFX_PRESENT_COPY) {
+        flip_pages(0);
+        return;
+    }
+    
+    /* Tracking lost: full swap */
+    if (!dirty_enabled) {
         gfx_swap_buffers_full();
         return;
     }
     
-    /* Copy only the dirty rectangle using SSE */
+    /* Nothing drawn since the last swap */
+    if (screen.dirty_x1 > screen.dirty_x2 || screen.dirty_y1 > screen.dirty_y2) {
+        return;
+    }
+    
+    /* Convert only the dirty rectangle, row by row */
     int y;
-    int row_bytes = (dirty_x2 - dirty_x1 + 1) * 4;
+    int count = screen.dirty_x2 - screen.dirty_x1 + 1;
+    swap_blit_fn blit = SWAP_BLIT(fb_format);
+    uint8_t *dst = (uint8_t *)gfx_get_screen_line(display_start + screen.dirty_y1) +
+                   screen.dirty_x1 * fb_format->bytes;
     
-    for (y = dirty_y1; y <= dirty_y2; y++) {
-        uint32_t *src = &double_buffer[y * fb_width + dirty_x1];
-        uint32_t *dst = &framebuffer[y * fb_width + dirty_x1];
-        sse_memcpy(dst, src, row_bytes);
+    gfx_hide_overlay(screen.dirty_x1, screen.dirty_y1, screen.dirty_x2, screen.dirty_y2);
+    for (y = screen.dirty_y1; y <= screen.dirty_y2; y++) {
+        blit(dst, &double_buffer[y * fb_width + screen.dirty_x1], count);
+        dst += fb_pitch;
     }
+    gfx_show_overlay();
     
     /* Reset dirty region after swap */
-    dirty_x1 = fb_width;
-    dirty_y1 = fb_height;
-    dirty_x2 = 0;
-    dirty_y2 = 0;
-    dirty_enabled = 0;
+    set_presented(screen.dirty_x1, screen.dirty_y1, screen.dirty_x2, screen.dirty_y2);
+    reset_dirty();
+}
+
+/*
+ * Swap buffers - copy only dirty region to screen
+ * Uses SSE for faster copying
+ */
+void gfx_swap_buffers(void) {
+    if (!framebuffer) return;
+    
+    gfx_acquire();
+    swap_dirty();
+    gfx_release();
 }
 
 /*
@@ -313,15 +793,29 @@ void gfx_swap_buffers(void) {
  * Uses SSE for faster copying
  */
 void gfx_swap_buffers_full(void) {
+    gfx_acquire();
+    if (present_mode != GFX_PRESENT_COPY) {
+        flip_pages(1);
+        gfx_release();
+        return;
+    }
+    
     if (framebuffer) {
-        sse_memcpy(framebuffer, double_buffer, fb_width * fb_height * 4);
+        int y;
+        swap_blit_fn blit = SWAP_BLIT(fb_format);
+        uint8_t *dst = (uint8_t *)gfx_get_screen_line(display_start);
+        
+        gfx_hide_overlay(0, 0, fb_width - 1, fb_height - 1);
+        for (y = 0; y < fb_height; y++) {
+            blit(dst, &double_buffer[y * fb_width], fb_width);
+            dst += fb_pitch;
+        }
+        gfx_show_overlay();
     }
     /* Reset dirty region */
-    dirty_x1 = fb_width;
-    dirty_y1 = fb_height;
-    dirty_x2 = 0;
-    dirty_y2 = 0;
-    dirty_enabled = 0;
+    set_presented(0, 0, fb_width - 1, fb_height - 1);
+    reset_dirty();
+    gfx_release();
 }
 
 /*
@@ -329,96 +823,541 @@ void gfx_swap_buffers_full(void) {
  * Uses SSE for faster filling
  */
 void gfx_fill_rect(int x, int y, int width, int height, uint32_t color) {
+    gfx_surface_t *s = draw_target();
     int row;
     
-    /* Clip to screen bounds */
-    if (x < 0) { width += x; x = 0; }
-    if (y < 0) { height += y; y = 0; }
-    if (x + width > fb_width) width = fb_width - x;
-    if (y + height > fb_height) height = fb_height - y;
-    
-    if (width <= 0 || height <= 0) return;
+    /* Clip to the target */
+    if (!clip_to(s, &x, &y, &width, &height)) return;
     
     /* Fill each row using SSE */
     for (row = 0; row < height; row++) {
-        uint32_t *row_ptr = &double_buffer[(y + row) * fb_width + x];
-        sse_memset32(row_ptr, color, width);
+        gfx_pixel_t *row_ptr = &s->pixels[(y + row) * s->pitch + x];
+        fill_pixels(row_ptr, color, width);
     }
     
     /* Mark region as dirty */
-    if (dirty_enabled) {
-        if (x < dirty_x1) dirty_x1 = x;
-        if (y < dirty_y1) dirty_y1 = y;
-        if (x + width - 1 > dirty_x2) dirty_x2 = x + width - 1;
-        if (y + height - 1 > dirty_y2) dirty_y2 = y + height - 1;
-    }
+    damage(s, x, y, x + width - 1, y + height - 1);
 }
 
 /*
- * Copy a rectangular region (for scrolling)
- * Uses SSE for faster copying
+ * Clip a blit to a source of src_width x src_height pixels
+ * The destination origin moves with the source. Returns 0 if nothing
+ * is left
  */
-void gfx_copy_rect(int src_x, int src_y, int dst_x, int dst_y, int width, int height) {
-    int row;
+static int clip_source(int src_width, int src_height, int *src_x, int *src_y,
+                       int *x, int *y, int *width, int *height) {
+    if (*src_x < 0) { *width += *src_x; *x -= *src_x; *src_x = 0; }
+    if (*src_y < 0) { *height += *src_y; *y -= *src_y; *src_y = 0; }
+    if (*src_x + *width > src_width) *width = src_width - *src_x;
+    if (*src_y + *height > src_height) *height = src_height - *src_y;
     
-    /* Clip to screen bounds */
-    if (src_x < 0 || src_y < 0 || dst_x < 0 || dst_y < 0) return;
-    if (src_x + width > fb_width || dst_x + width > fb_width) return;
-    if (src_y + height > fb_height || dst_y + height > fb_height) return;
-    
-    /* Handle overlapping regions (scrolling up vs down) */
-    if (src_y < dst_y) {
-        /* Copy from bottom to top to avoid overwriting source */
-        for (row = height - 1; row >= 0; row--) {
-            uint32_t *src = &double_buffer[(src_y + row) * fb_width + src_x];
-            uint32_t *dst = &double_buffer[(dst_y + row) * fb_width + dst_x];
-            sse_memcpy(dst, src, width * 4);
-        }
-    } else {
-        /* Copy from top to bottom */
-        for (row = 0; row < height; row++) {
-            uint32_t *src = &double_buffer[(src_y + row) * fb_width + src_x];
-            uint32_t *dst = &double_buffer[(dst_y + row) * fb_width + dst_x];
-            sse_memcpy(dst, src, width * 4);
-        }
+    return *width > 0 && *height > 0;
+}
+
+/*
+ * Clip a blit to the draw target and copy it row by row
+ * A destination after the source in memory is done bottom up, and
+ * copy_row/key_row handle rows that overlap, so a blit within one
+ * buffer works in every direction.
+ */
+static void blit(const gfx_pixel_t *src, int src_pitch, int src_x, int src_y,
+                 int width, int height, int x, int y, int keyed, uint32_t key) {
+    gfx_surface_t *s = draw_target();
+    int x0 = x, y0 = y;
+    int src_step, dst_step;
+    int masked, row;
+    gfx_pixel_t *dst;
+    
+    if (!clip_to(s, &x, &y, &width, &height)) return;
+    src += (src_y + y - y0) * src_pitch + src_x + x - x0;
+    dst = &s->pixels[y * s->pitch + x];
+    
+    src_step = src_pitch;
+    dst_step = s->pitch;
+    if (dst > src) {
+        src += (height - 1) * src_pitch;
+        dst += (height - 1) * s->pitch;
+        src_step = -src_pitch;
+        dst_step = -s->pitch;
     }
     
-    /* Mark destination region as dirty */
-    if (dirty_enabled) {
-        if (dst_x < dirty_x1) dirty_x1 = dst_x;
-        if (dst_y < dirty_y1) dirty_y1 = dst_y;
-        if (dst_x + width - 1 > dirty_x2) dirty_x2 = dst_x + width - 1;
-        if (dst_y + height - 1 > dirty_y2) dirty_y2 = dst_y + height - 1;
+    /* The back page is in video memory when page flipping */
+    masked = keyed && s == &screen && present_mode != GFX_PRESENT_COPY;
+    
+    for (row = 0; row < height; row++) {
+        if (keyed) {
+            key_row(dst, src, width, key, masked);
+        } else {
+            copy_row(dst, src, width);
+        }
+        src += src_step;
+        dst += dst_step;
+    }
+    if (masked) {
+        __asm__ __volatile__("sfence" ::: "memory");
     }
+    
+    damage(s, x, y, x + width - 1, y + height - 1);
+}
+
+/*
+ * Copy a block of back buffer pixels to the draw target
+ */
+void gfx_blit(const gfx_pixel_t *src, int src_pitch, int src_x, int src_y,
+              int width, int height, int x, int y) {
+    blit(src, src_pitch, src_x, src_y, width, height, x, y, 0, 0);
+}
+
+/*
+ * Copy a block of back buffer pixels, skipping those equal to key
+ */
+void gfx_blit_key(const gfx_pixel_t *src, int src_pitch, int src_x, int src_y,
+                  int width, int height, int x, int y, uint32_t key) {
+    blit(src, src_pitch, src_x, src_y, width, height, x, y, 1, key);
+}
+
+/*
+ * Copy a rectangular region of the draw target (for scrolling)
+ * The source is clipped to the target, the destination to its clip
+ * rectangle; the two may overlap in any direction
+ */
+void gfx_copy_rect(int src_x, int src_y, int dst_x, int dst_y, int width, int height) {
+    gfx_surface_t *s = draw_target();
+    
+    if (!clip_source(s->width, s->height, &src_x, &src_y, &dst_x, &dst_y, &width, &height)) return;
+    blit(s->pixels, s->pitch, src_x, src_y, width, height, dst_x, dst_y, 0, 0);
 }
 
 /*
  * Draw a horizontal line (optimized with SSE)
  */
 void gfx_draw_hline(int x, int y, int length, uint32_t color) {
-    /* Clip to screen bounds */
-    if (y < 0 || y >= fb_height) return;
-    if (x < 0) { length += x; x = 0; }
-    if (x + length > fb_width) length = fb_width - x;
+    gfx_surface_t *s = draw_target();
+    int height = 1;
     
-    if (length <= 0) return;
+    /* Clip to the target */
+    if (!clip_to(s, &x, &y, &length, &height)) return;
     
     /* Fill the line using SSE */
-    uint32_t *line_ptr = &double_buffer[y * fb_width + x];
-    sse_memset32(line_ptr, color, length);
+    gfx_pixel_t *line_ptr = &s->pixels[y * s->pitch + x];
+    fill_pixels(line_ptr, color, length);
     
     /* Mark as dirty */
-    if (dirty_enabled) {
-        if (x < dirty_x1) dirty_x1 = x;
-        if (y < dirty_y1) dirty_y1 = y;
-        if (x + length - 1 > dirty_x2) dirty_x2 = x + length - 1;
-        if (y > dirty_y2) dirty_y2 = y;
+    damage(s, x, y, x + length - 1, y);
+}
+
+/*
+ * Fill a span the caller has already clipped to the draw target
+ * The rasterizer clips and marks dirty once per primitive, not per span
+ */
+void gfx_fill_span(int x, int y, int length, uint32_t color) {
+    gfx_surface_t *s = draw_target();
+    
+    fill_pixels(&s->pixels[y * s->pitch + x], color, length);
+}
+
+/*
+ * Get the screen area the last swap presented
+ * Returns 0 if it presented nothing
+ */
+int gfx_get_presented_rect(int *x, int *y, int *width, int *height) {
+    *x = presented_x1;
+    *y = presented_y1;
+    *width = presented_x2 - presented_x1 + 1;
+    *height = presented_y2 - presented_y1 + 1;
+    return *width > 0 && *height > 0;
+}
+
+/*
+ * Install the overlay drawn on top of the visible screen
+ */
+void gfx_set_overlay(gfx_overlay_hide_fn hide, gfx_overlay_show_fn show) {
+    overlay_hide = hide;
+    overlay_show = show;
+}
+
+/*
+ * Take the overlay off before part of the visible screen changes
+ */
+void gfx_hide_overlay(int x1, int y1, int x2, int y2) {
+    if (overlay_hide) {
+        overlay_hide(x1, y1, x2, y2);
+    }
+}
+
+/*
+ * Put the overlay back once the visible screen is complete again
+ */
+void gfx_show_overlay(void) {
+    if (overlay_show) {
+        overlay_show();
     }
 }
 
 /*
- * Get direct access to double buffer (for fast character rendering)
+ * Get direct access to the draw target's pixels (for fast character
+ * rendering). When page flipping the screen is the back page in video
+ * memory
  */
-uint32_t *gfx_get_double_buffer(void) {
-    return double_buffer;
+gfx_pixel_t *gfx_get_double_buffer(void) {
+    return draw_target()->pixels;
+}
+
+/*
+ * Get the line pitch of the draw target in pixels
+ */
+int gfx_get_buffer_pitch(void) {
+    return target ? target->pitch : back_pitch;
+}
+
+/*
+ * Set up a surface over caller-owned pixels
+ * The clip rectangle covers the surface; the dirty rectangle is empty
+ */
+void gfx_surface_init(gfx_surface_t *surface, gfx_pixel_t *pixels, int width, int height, int pitch) {
+    surface->pixels = pixels;
+    surface->width = width;
+    surface->height = height;
+    surface->pitch = pitch;
+    surface->clip_x1 = 0;
+    surface->clip_y1 = 0;
+    surface->clip_x2 = width - 1;
+    surface->clip_y2 = height - 1;
+    gfx_surface_clear_dirty(surface);
+}
+
+/*
+ * Empty a surface's dirty rectangle
+ */
+void gfx_surface_clear_dirty(gfx_surface_t *surface) {
+    surface->dirty_x1 = surface->width;
+    surface->dirty_y1 = surface->height;
+    surface->dirty_x2 = -1;
+    surface->dirty_y2 = -1;
+}
+
+/*
+ * Select the draw target, 0 for the screen
+ * Returns the previous target so callers can restore it
+ */
+gfx_surface_t *gfx_set_target(gfx_surface_t *surface) {
+    gfx_surface_t *previous = target;
+    
+    target = surface;
+    return previous;
+}
+
+/*
+ * Get the draw target, 0 for the screen
+ */
+gfx_surface_t *gfx_get_target(void) {
+    return target;
+}
+
+/*
+ * Limit drawing on the current target to a rectangle
+ */
+void gfx_set_clip(int x, int y, int width, int height) {
+    gfx_surface_t *s = target ? target : &screen;
+    
+    if (x < 0) { width += x; x = 0; }
+    if (y < 0) { height += y; y = 0; }
+    if (x + width > s->width) width = s->width - x;
+    if (y + height > s->height) height = s->height - y;
+    
+    /* An empty clip rectangle rejects everything */
+    s->clip_x1 = x;
+    s->clip_y1 = y;
+    s->clip_x2 = x + width - 1;
+    s->clip_y2 = y + height - 1;
+}
+
+/*
+ * Let drawing cover the whole current target again
+ */
+void gfx_reset_clip(void) {
+    gfx_surface_t *s = target ? target : &screen;
+    
+    s->clip_x1 = 0;
+    s->clip_y1 = 0;
+    s->clip_x2 = s->width - 1;
+    s->clip_y2 = s->height - 1;
+}
+
+/*
+ * Get the clip rectangle of the current target (inclusive)
+ */
+void gfx_get_clip(int *x1, int *y1, int *x2, int *y2) {
+    const gfx_surface_t *s = target ? target : &screen;
+    
+    *x1 = s->clip_x1;
+    *y1 = s->clip_y1;
+    *x2 = s->clip_x2;
+    *y2 = s->clip_y2;
+}
+
+/*
+ * Copy part of a surface to the draw target
+ * The destination is clipped and the source origin moves with it
+ */
+void gfx_blit_surface(const gfx_surface_t *src, int src_x, int src_y,
+                      int x, int y, int width, int height) {
+    if (!clip_source(src->width, src->height, &src_x, &src_y, &x, &y, &width, &height)) return;
+    blit(src->pixels, src->pitch, src_x, src_y, width, height, x, y, 0, 0);
+}
+
+/*
+ * Copy part of a surface to the draw target, skipping pixels equal to
+ * key (in back buffer format)
+ */
+void gfx_blit_surface_key(const gfx_surface_t *src, int src_x, int src_y,
+                          int x, int y, int width, int height, uint32_t key) {
+    if (!clip_source(src->width, src->height, &src_x, &src_y, &x, &y, &width, &height)) return;
+    blit(src->pixels, src->pitch, src_x, src_y, width, height, x, y, 1, key);
+}
+
+/*
+ * Request a taller virtual screen (Bochs/QEMU DISPI only)
+ * Returns the virtual height in lines; equals the screen height if
+ * the adapter has no DISPI interface
+ */
+int gfx_set_virtual_height(int lines) {
+    if (!has_dispi || !framebuffer) {
+        return fb_height;
+    }
+    
+    virt_height = bochs_vbe_set_virtual_height(lines);
+    if (virt_height < fb_height) {
+        virt_height = fb_height;
+    }
+    return virt_height;
+}
+
+/*
+ * Get virtual screen height in lines
+ */
+int gfx_get_virtual_height(void) {
+    return virt_height;
+}
+
+/*
+ * Set the first visible line of the virtual screen
+ * Swaps are redirected to the visible window
+ */
+void gfx_set_display_start(int line) {
+    if (line < 0) line = 0;
+    if (line > virt_height - fb_height) line = virt_height - fb_height;
+    
+    gfx_hide_overlay(0, 0, fb_width - 1, fb_height - 1);
+    display_start = line;
+    if (has_dispi) {
+        bochs_vbe_set_y_offset(line);
+    }
+    gfx_show_overlay();
+}
+
+/*
+ * Get the first visible line of the virtual screen
+ */
+int gfx_get_display_start(void) {
+    return display_start;
+}
+
+/*
+ * Get a pointer to a line of the virtual screen (video memory)
+ */
+gfx_pixel_t *gfx_get_screen_line(int line) {
+    return (gfx_pixel_t *)((uint8_t *)framebuffer + line * fb_pitch);
+}
+
+/*
+ * Copy whole lines within the virtual screen (video memory)
+ */
+void gfx_copy_screen_lines(int dst_line, int src_line, int count) {
+    int i;
+    int bytes;
+    
+    if (!framebuffer || count <= 0) return;
+    
+    bytes = fb_width * fb_format->bytes;
+    
+    gfx_hide_overlay(0, 0, fb_width - 1, fb_height - 1);
+    if (dst_line < src_line) {
+        for (i = 0; i < count; i++) {
+            sse_memcpy(gfx_get_screen_line(dst_line + i),
+                       gfx_get_screen_line(src_line + i), bytes);
+        }
+    } else {
+        for (i = count - 1; i >= 0; i--) {
+            sse_memcpy(gfx_get_screen_line(dst_line + i),
+                       gfx_get_screen_line(src_line + i), bytes);
+        }
+    }
+    gfx_show_overlay();
+}
+
+/*
+ * Select how frames are presented
+ * GFX_PRESENT_FLIP* need a DISPI adapter with room for two pages;
+ * otherwise the copy path stays in use. Returns the mode now active.
+ */
+int gfx_set_present_mode(int mode) {
+    int y;
+    
+    if (mode == present_mode) {
+        return present_mode;
+    }
+    
+    /* Pages are written directly below */
+    gfx_hide_overlay(0, 0, fb_width - 1, fb_height - 1);
+    
+    if (mode == GFX_PRESENT_COPY) {
+        /* Keep what was drawn: back page contents go to the double buffer */
+        sync_back();
+        for (y = 0; y < fb_height; y++) {
+            sse_memcpy(&double_buffer[y * fb_width], &back_buffer[y * back_pitch],
+                       fb_width * (int)sizeof(gfx_pixel_t));
+        }
+        back_buffer = double_buffer;
+        back_pitch = fb_width;
+        present_mode = GFX_PRESENT_COPY;
+        front_page = 0;
+        gfx_set_display_start(0);
+        gfx_swap_buffers_full();
+        gfx_show_overlay();
+        return present_mode;
+    }
+    
+    if (present_mode == GFX_PRESENT_COPY) {
+        /* Pages are drawn to directly, so they must be in buffer format */
+        if (!has_dispi || !framebuffer || fb_bpp != GFX_BUFFER_BPP) {
+            gfx_show_overlay();
+            return present_mode;
+        }
+        if (virt_height < fb_height * 2 &&
+            gfx_set_virtual_height(fb_height * 2) < fb_height * 2) {
+            gfx_show_overlay();
+            return present_mode;
+        }
+        
+        /* Both pages start out as the current frame */
+        for (y = 0; y < fb_height; y++) {
+            sse_memcpy(gfx_get_screen_line(y), &double_buffer[y * fb_width],
+                       fb_width * (int)sizeof(gfx_pixel_t));
+            sse_memcpy(gfx_get_screen_line(fb_height + y), &double_buffer[y * fb_width],
+                       fb_width * (int)sizeof(gfx_pixel_t));
+        }
+        front_page = 0;
+        gfx_set_display_start(0);
+        back_buffer = page_pixels(1);
+        back_pitch = fb_pitch / (int)sizeof(gfx_pixel_t);
+        stale_x2 = -1;
+        stale_y2 = -1;
+        reset_dirty();
+    }
+    
+    present_mode = mode;
+    gfx_show_overlay();
+    return present_mode;
+}
+
+/*
+ * Get the active present mode
+ */
+int gfx_get_present_mode(void) {
+    return present_mode;
+}
+
+/*
+ * Get framebuffer depth in bits per pixel
+ */
+int gfx_get_bpp(void) {
+    return fb_bpp;
+}
+
+/*
+ * Get framebuffer line pitch in bytes
+ */
+int gfx_get_pitch(void) {
+    return fb_pitch;
+}
+
+/*
+ * Number of modes gfx_set_mode() accepts
+ * Without DISPI only the mode set up by the boot loader is available
+ */
+int gfx_get_mode_count(void) {
+    return has_dispi ? DISPI_MODE_COUNT : 1;
+}
+
+/*
+ * Get a mode from the list
+ */
+int gfx_get_mode(int index, gfx_mode_t *mode) {
+    if (index < 0 || index >= gfx_get_mode_count()) {
+        return -1;
+    }
+    
+    if (!has_dispi) {
+        mode->width = fb_width;
+        mode->height = fb_height;
+        mode->bpp = fb_bpp;
+    } else {
+        *mode = dispi_modes[index];
+    }
+    return 0;
+}
+
+/*
+ * Switch resolution and depth (Bochs/QEMU DISPI only)
+ * Drawing state is reset: copy present mode, display start 0 and a
+ * cleared screen. Returns 0 on success, -1 if the mode is not possible.
+ */
+int gfx_set_mode(int width, int height, int bpp) {
+    const pixfmt_t *format = pixfmt_get(bpp);
+    gfx_surface_t *saved;
+    
+    if (!has_dispi || !framebuffer || !format) {
+        return -1;
+    }
+    if (width <= 0 || width > GFX_MAX_WIDTH || height <= 0 || height > GFX_MAX_HEIGHT) {
+        return -1;
+    }
+    
+    gfx_acquire();
+    gfx_hide_overlay(0, 0, fb_width - 1, fb_height - 1);
+    gfx_set_present_mode(GFX_PRESENT_COPY);
+    
+    if (bochs_vbe_set_mode(width, height, bpp) != 0) {
+        /* Put the previous mode back */
+        bochs_vbe_set_mode(fb_width, fb_height, fb_bpp);
+        gfx_mark_all_dirty();
+        gfx_swap_buffers_full();
+        gfx_show_overlay();
+        gfx_release();
+        return -1;
+    }
+    
+    fb_width = width;
+    fb_height = height;
+    fb_bpp = bpp;
+    fb_format = format;
+    fb_pitch = width * format->bytes;
+    
+    virt_height = fb_height;
+    display_start = 0;
+    back_buffer = double_buffer;
+    back_pitch = fb_width;
+    stale_x2 = -1;
+    stale_y2 = -1;
+    reset_screen();
+    
+    /* Clear the screen even if a surface is the draw target */
+    saved = gfx_set_target((gfx_surface_t *)0);
+    gfx_clear(0x00000000);
+    gfx_swap_buffers_full();
+    gfx_set_target(saved);
+    gfx_show_overlay();
+    gfx_release();
+    return 0;
 }
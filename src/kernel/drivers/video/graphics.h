@@ -1,6 +1,6 @@
 /*
  * graphics.h - Graphics driver header
- * version 0.0.2
+ * version 0.0.11
  */
 
 #ifndef GRAPHICS_H
@@ -13,9 +13,55 @@
 #define GFX_HEIGHT 600
 #define GFX_BPP    32   /* Bits per pixel */
 
+/* Back buffer pixel format: XRGB8888, or RGB565 with GFX_BACKBUFFER_16
+ * Drawing colors are in this format; gfx_rgb/gfx_hsv/gfx_color make them */
+#ifdef GFX_BACKBUFFER_16
+typedef uint16_t gfx_pixel_t;
+#define GFX_BUFFER_BPP 16
+#else
+typedef uint32_t gfx_pixel_t;
+#define GFX_BUFFER_BPP 32
+#endif
+
+/* Convert an XRGB8888 color to the back buffer format */
+static inline uint32_t gfx_color(uint32_t xrgb) {
+#ifdef GFX_BACKBUFFER_16
+    return ((xrgb >> 8) & 0xF800) | ((xrgb >> 5) & 0x07E0) | ((xrgb >> 3) & 0x001F);
+#else
+    return xrgb;
+#endif
+}
+
+/* Largest mode the double buffer can hold */
+#define GFX_MAX_WIDTH   1024
+#define GFX_MAX_HEIGHT  768
+
 /* VBE mode number for 800x600x32 */
 #define VBE_MODE_800x600x32 0x115
 
+/* Present modes */
+#define GFX_PRESENT_COPY          0   /* Copy dirty region of the double buffer to the screen */
+#define GFX_PRESENT_FLIP          1   /* Two VRAM pages, back page kept in sync after a flip */
+#define GFX_PRESENT_FLIP_DISCARD  2   /* Two VRAM pages, back page holds the frame before last */
+
+/* Display mode */
+typedef struct {
+    int width;
+    int height;
+    int bpp;
+} gfx_mode_t;
+
+/* Off-screen drawing surface in back buffer format
+ * The pixel storage belongs to whoever sets the surface up */
+typedef struct {
+    gfx_pixel_t *pixels;
+    int width;
+    int height;
+    int pitch;                                  /* In pixels */
+    int clip_x1, clip_y1, clip_x2, clip_y2;     /* Drawing limits, inclusive */
+    int dirty_x1, dirty_y1, dirty_x2, dirty_y2; /* Drawn area, inclusive */
+} gfx_surface_t;
+
 /* Color structure */
 typedef struct {
     uint8_t b;
@@ -30,9 +76,48 @@ int graphics_init(void);
 /* Set a pixel color */
 void gfx_set_pixel(int x, int y, uint32_t color);
 
-/* Get a pixel color from double buffer */
+/* Get a pixel color from the draw target */
 uint32_t gfx_get_pixel(int x, int y);
 
+/* Set up a surface over caller-owned pixels (pitch in pixels) */
+void gfx_surface_init(gfx_surface_t *surface, gfx_pixel_t *pixels, int width, int height, int pitch);
+
+/* Empty a surface's dirty rectangle */
+void gfx_surface_clear_dirty(gfx_surface_t *surface);
+
+/* Select where drawing goes: a surface, or the screen with 0
+ * Applies to every drawing call here and in raster.h and blend.h
+ * Returns the previous target */
+gfx_surface_t *gfx_set_target(gfx_surface_t *surface);
+gfx_surface_t *gfx_get_target(void);
+
+/* Limit drawing on the current target to a rectangle, or lift the limit */
+void gfx_set_clip(int x, int y, int width, int height);
+void gfx_reset_clip(void);
+
+/* Clip rectangle of the current target (inclusive) */
+void gfx_get_clip(int *x1, int *y1, int *x2, int *y2);
+
+/* Copy a width x height block of back buffer pixels, starting at src_x,
+ * src_y in an image of src_pitch pixels per line, to x, y on the draw
+ * target. Only the destination is clipped. src may point into the
+ * target itself; overlapping blits come out as if the source were read
+ * first. */
+void gfx_blit(const gfx_pixel_t *src, int src_pitch, int src_x, int src_y,
+              int width, int height, int x, int y);
+
+/* Same, skipping source pixels equal to key (back buffer format) */
+void gfx_blit_key(const gfx_pixel_t *src, int src_pitch, int src_x, int src_y,
+                  int width, int height, int x, int y, uint32_t key);
+
+/* Copy part of a surface to the current target at x, y (clipped) */
+void gfx_blit_surface(const gfx_surface_t *src, int src_x, int src_y,
+                      int x, int y, int width, int height);
+
+/* Same, skipping source pixels equal to key (back buffer format) */
+void gfx_blit_surface_key(const gfx_surface_t *src, int src_x, int src_y,
+                          int x, int y, int width, int height, uint32_t key);
+
 /* Get pixel from actual framebuffer */
 uint32_t gfx_get_screen_pixel(int x, int y);
 
@@ -45,10 +130,13 @@ void gfx_clear_dirty(uint32_t color);
 /* Mark entire screen as dirty */
 void gfx_mark_all_dirty(void);
 
-/* Draw a filled circle */
+/* Mark a rectangle of the draw target as dirty (after writing it directly) */
+void gfx_mark_dirty_rect(int x, int y, int width, int height);
+
+/* Draw a filled circle (same as gfx_fill_circle in raster.h) */
 void gfx_draw_circle(int cx, int cy, int radius, uint32_t color);
 
-/* Create RGB color */
+/* Create RGB color (back buffer format) */
 uint32_t gfx_rgb(uint8_t r, uint8_t g, uint8_t b);
 
 /* Create HSV color and convert to RGB (integer version)
@@ -62,22 +150,95 @@ uint32_t *gfx_get_framebuffer(void);
 int gfx_get_width(void);
 int gfx_get_height(void);
 
+/* Get framebuffer depth (bits per pixel) and line pitch (bytes) */
+int gfx_get_bpp(void);
+int gfx_get_pitch(void);
+
+/* Available modes: count, and entry by index (returns -1 if out of range) */
+int gfx_get_mode_count(void);
+int gfx_get_mode(int index, gfx_mode_t *mode);
+
+/* Switch resolution and depth (Bochs/QEMU DISPI)
+ * Returns 0 on success, -1 if not possible */
+int gfx_set_mode(int width, int height, int bpp);
+
+/* Screen ownership: fullscreen clients (demos, the benchmarks) hold the
+ * screen while they draw and present frames, and so do swaps. Presenters
+ * running from interrupts (the console tick) leave the screen alone
+ * while it is held. Calls nest. */
+void gfx_acquire(void);
+void gfx_release(void);
+int gfx_is_owned(void);
+
 /* Swap buffers - copy only dirty region */
 void gfx_swap_buffers(void);
 
 /* Force full screen swap */
 void gfx_swap_buffers_full(void);
 
+/* Screen area the last swap presented (what changed in the last frame)
+ * Returns 0 if it presented nothing */
+int gfx_get_presented_rect(int *x, int *y, int *width, int *height);
+
+/* Overlay: pixels written straight onto the visible screen, over what
+ * was presented (the mouse cursor). hide is called with the screen area
+ * (inclusive) about to change and must leave it as the overlay found it;
+ * show is called once the change is complete. Nothing else may touch
+ * the screen in between. Calls nest. */
+typedef void (*gfx_overlay_hide_fn)(int x1, int y1, int x2, int y2);
+typedef void (*gfx_overlay_show_fn)(void);
+
+/* Install the overlay, or remove it with two null pointers */
+void gfx_set_overlay(gfx_overlay_hide_fn hide, gfx_overlay_show_fn show);
+
+/* Bracket writes to the visible screen made through gfx_get_screen_line
+ * (swaps and display start changes do this themselves) */
+void gfx_hide_overlay(int x1, int y1, int x2, int y2);
+void gfx_show_overlay(void);
+
 /* Fill a rectangle with a color (optimized batch operation) */
 void gfx_fill_rect(int x, int y, int width, int height, uint32_t color);
 
-/* Copy a rectangular region (for scrolling) */
+/* Copy a rectangle of the draw target to dst_x, dst_y (for scrolling)
+ * Clipped like a blit; source and destination may overlap */
 void gfx_copy_rect(int src_x, int src_y, int dst_x, int dst_y, int width, int height);
 
 /* Draw a horizontal line (optimized) */
 void gfx_draw_hline(int x, int y, int length, uint32_t color);
 
-/* Get direct access to double buffer (for fast character rendering) */
-uint32_t *gfx_get_double_buffer(void);
+/* Fill a span with no clipping or dirty tracking (rasterizer back end)
+ * The span must lie in the clip rectangle; the caller marks it dirty */
+void gfx_fill_span(int x, int y, int length, uint32_t color);
+
+/* Get direct access to the draw target (for fast character rendering)
+ * For the screen when page flipping this is the back page in video memory */
+gfx_pixel_t *gfx_get_double_buffer(void);
+
+/* Line pitch of the draw target in pixels */
+int gfx_get_buffer_pitch(void);
+
+/* Select present mode (GFX_PRESENT_*), returns the mode now active */
+int gfx_set_present_mode(int mode);
+
+/* Get the active present mode */
+int gfx_get_present_mode(void);
+
+/* Virtual screen (Bochs/QEMU DISPI): request a taller virtual
+ * framebuffer, returns the height actually available in lines */
+int gfx_set_virtual_height(int lines);
+
+/* Get virtual screen height in lines */
+int gfx_get_virtual_height(void);
+
+/* Set/get the first visible line of the virtual screen */
+void gfx_set_display_start(int line);
+int gfx_get_display_start(void);
+
+/* Get a pointer to a line of the virtual screen (video memory)
+ * Pixels are only in gfx_pixel_t format if the depth is GFX_BUFFER_BPP */
+gfx_pixel_t *gfx_get_screen_line(int line);
+
+/* Copy whole lines within the virtual screen */
+void gfx_copy_screen_lines(int dst_line, int src_line, int count);
 
 #endif /* GRAPHICS_H */
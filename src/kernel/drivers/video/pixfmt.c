@@ -0,0 +1,342 @@
+/*
+ * pixfmt.c - Framebuffer pixel format implementation
+ * version 0.0.3
+ * Each depth has its own blit, fill and read routine; the graphics
+ * driver picks one set when the mode is set, so the per-row loops
+ * carry no format checks. Blits exist for XRGB8888 and RGB565 sources.
+ */
+
+#include "pixfmt.h"
+
+/*
+ * 32 bpp: straight copy, 16 pixels per iteration with SSE
+ */
+static void blit_row_32(void *dst, const uint32_t *src, int count) {
+    uint32_t *d = (uint32_t *)dst;
+    int i;
+    int chunks = count / 16;
+    
+    for (i = 0; i < chunks; i++) {
+        __asm__ __volatile__(
+            "movups (%0), %%xmm0\n\t"
+            "movups 16(%0), %%xmm1\n\t"
+            "movups 32(%0), %%xmm2\n\t"
+            "movups 48(%0), %%xmm3\n\t"
+            "movups %%xmm0, (%1)\n\t"
+            "movups %%xmm1, 16(%1)\n\t"
+            "movups %%xmm2, 32(%1)\n\t"
+            "movups %%xmm3, 48(%1)"
+            :
+            : "r"(src), "r"(d)
+            : "xmm0", "xmm1", "xmm2", "xmm3", "memory"
+        );
+        src += 16;
+        d += 16;
+    }
+    
+    for (i = chunks * 16; i < count; i++) {
+        *d++ = *src++;
+    }
+}
+
+static void fill_row_32(void *dst, uint32_t color, int count) {
+    uint32_t *d = (uint32_t *)dst;
+    int chunks = count / 4;
+    int i;
+    
+    if (chunks > 0) {
+        __asm__ __volatile__(
+            "movd %2, %%xmm0\n\t"
+            "pshufd $0, %%xmm0, %%xmm0\n\t"
+            "1:\n\t"
+            "movups %%xmm0, (%0)\n\t"
+            "add $16, %0\n\t"
+            "dec %1\n\t"
+            "jnz 1b"
+            : "+r"(d), "+r"(chunks)
+            : "r"(color)
+            : "xmm0", "memory", "cc"
+        );
+    }
+    
+    for (i = 0; i < (count & 3); i++) {
+        *d++ = color;
+    }
+}
+
+/*
+ * RGB565 source to 32 bpp: eight pixels per iteration with SSE2
+ * Fields are widened to 8 bits with their top bits replicated, merged
+ * into G:B and R words and interleaved into XRGB dwords.
+ */
+static const uint16_t mask_f8[8] __attribute__((aligned(16))) = {0xF8, 0xF8, 0xF8, 0xF8, 0xF8, 0xF8, 0xF8, 0xF8};
+static const uint16_t mask_fc[8] __attribute__((aligned(16))) = {0xFC, 0xFC, 0xFC, 0xFC, 0xFC, 0xFC, 0xFC, 0xFC};
+static const uint16_t mask_07[8] __attribute__((aligned(16))) = {0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07};
+static const uint16_t mask_03[8] __attribute__((aligned(16))) = {0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03};
+
+static void blit_row_565_32(void *dst, const uint16_t *src, int count) {
+    uint32_t *d = (uint32_t *)dst;
+    int i;
+    int chunks = count / 8;
+    
+    for (i = 0; i < chunks; i++) {
+        __asm__ __volatile__(
+            "movdqu (%0), %%xmm0\n\t"
+            /* r8 = ((x >> 8) & 0xF8) | (x >> 13) */
+            "movdqa %%xmm0, %%xmm1\n\t"
+            "movdqa %%xmm0, %%xmm2\n\t"
+            "psrlw $8, %%xmm1\n\t"
+            "pand %[f8], %%xmm1\n\t"
+            "psrlw $13, %%xmm2\n\t"
+            "por %%xmm2, %%xmm1\n\t"
+            /* g8 = ((x >> 3) & 0xFC) | ((x >> 9) & 0x03) */
+            "movdqa %%xmm0, %%xmm2\n\t"
+            "movdqa %%xmm0, %%xmm3\n\t"
+            "psrlw $3, %%xmm2\n\t"
+            "pand %[fc], %%xmm2\n\t"
+            "psrlw $9, %%xmm3\n\t"
+            "pand %[m03], %%xmm3\n\t"
+            "por %%xmm3, %%xmm2\n\t"
+            /* b8 = ((x << 3) & 0xF8) | ((x >> 2) & 0x07) */
+            "movdqa %%xmm0, %%xmm3\n\t"
+            "psllw $3, %%xmm0\n\t"
+            "pand %[f8], %%xmm0\n\t"
+            "psrlw $2, %%xmm3\n\t"
+            "pand %[m07], %%xmm3\n\t"
+            "por %%xmm3, %%xmm0\n\t"
+            /* G:B words, then interleave with R words */
+            "psllw $8, %%xmm2\n\t"
+            "por %%xmm2, %%xmm0\n\t"
+            "movdqa %%xmm0, %%xmm3\n\t"
+            "punpcklwd %%xmm1, %%xmm0\n\t"
+            "punpckhwd %%xmm1, %%xmm3\n\t"
+            "movdqu %%xmm0, (%1)\n\t"
+            "movdqu %%xmm3, 16(%1)"
+            :
+            : "r"(src), "r"(d), [f8] "m"(mask_f8), [fc] "m"(mask_fc),
+              [m07] "m"(mask_07), [m03] "m"(mask_03)
+            : "xmm0", "xmm1", "xmm2", "xmm3", "memory"
+        );
+        src += 8;
+        d += 8;
+    }
+    
+    for (i = chunks * 8; i < count; i++) {
+        *d++ = pixfmt_from_565(*src++);
+    }
+}
+
+static uint32_t read_pixel_32(const void *src) {
+    return *(const uint32_t *)src & 0x00FFFFFF;
+}
+
+/*
+ * 24 bpp: four pixels are packed into three 32-bit stores
+ */
+static void blit_row_24(void *dst, const uint32_t *src, int count) {
+    uint32_t *d = (uint32_t *)dst;
+    uint8_t *b;
+    int i;
+    int quads = count / 4;
+    
+    for (i = 0; i < quads; i++) {
+        uint32_t p0 = src[0] & 0x00FFFFFF;
+        uint32_t p1 = src[1] & 0x00FFFFFF;
+        uint32_t p2 = src[2] & 0x00FFFFFF;
+        uint32_t p3 = src[3] & 0x00FFFFFF;
+        
+        d[0] = p0 | (p1 << 24);
+        d[1] = (p1 >> 8) | (p2 << 16);
+        d[2] = (p2 >> 16) | (p3 << 8);
+        src += 4;
+        d += 3;
+    }
+    
+    b = (uint8_t *)d;
+    for (i = quads * 4; i < count; i++) {
+        b[0] = (uint8_t)*src;
+        b[1] = (uint8_t)(*src >> 8);
+        b[2] = (uint8_t)(*src >> 16);
+        src++;
+        b += 3;
+    }
+}
+
+static void blit_row_565_24(void *dst, const uint16_t *src, int count) {
+    uint8_t *b = (uint8_t *)dst;
+    int i;
+    
+    for (i = 0; i < count; i++) {
+        uint32_t c = pixfmt_from_565(src[i]);
+        b[0] = (uint8_t)c;
+        b[1] = (uint8_t)(c >> 8);
+        b[2] = (uint8_t)(c >> 16);
+        b += 3;
+    }
+}
+
+static void fill_row_24(void *dst, uint32_t color, int count) {
+    uint32_t *d = (uint32_t *)dst;
+    uint8_t *b;
+    uint32_t c = color & 0x00FFFFFF;
+    uint32_t w0 = c | (c << 24);
+    uint32_t w1 = (c >> 8) | (c << 16);
+    uint32_t w2 = (c >> 16) | (c << 8);
+    int i;
+    int quads = count / 4;
+    
+    for (i = 0; i < quads; i++) {
+        d[0] = w0;
+        d[1] = w1;
+        d[2] = w2;
+        d += 3;
+    }
+    
+    b = (uint8_t *)d;
+    for (i = quads * 4; i < count; i++) {
+        b[0] = (uint8_t)c;
+        b[1] = (uint8_t)(c >> 8);
+        b[2] = (uint8_t)(c >> 16);
+        b += 3;
+    }
+}
+
+static uint32_t read_pixel_24(const void *src) {
+    const uint8_t *b = (const uint8_t *)src;
+    return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16);
+}
+
+/*
+ * 16 bpp (RGB565): eight pixels per iteration with SSE2
+ * The fields are shifted into place and merged in 32-bit lanes; the
+ * lanes are sign-extended from bit 15 first so packssdw keeps the low
+ * halves exactly instead of saturating.
+ */
+static const uint32_t mask_r565[4] __attribute__((aligned(16))) = {0xF800, 0xF800, 0xF800, 0xF800};
+static const uint32_t mask_g565[4] __attribute__((aligned(16))) = {0x07E0, 0x07E0, 0x07E0, 0x07E0};
+static const uint32_t mask_b565[4] __attribute__((aligned(16))) = {0x001F, 0x001F, 0x001F, 0x001F};
+
+static void blit_row_16(void *dst, const uint32_t *src, int count) {
+    uint16_t *d = (uint16_t *)dst;
+    int i;
+    int chunks = count / 8;
+    
+    for (i = 0; i < chunks; i++) {
+        __asm__ __volatile__(
+            "movups (%0), %%xmm0\n\t"
+            "movups 16(%0), %%xmm4\n\t"
+            /* Pixels 0-3 */
+            "movdqa %%xmm0, %%xmm1\n\t"
+            "movdqa %%xmm0, %%xmm2\n\t"
+            "psrld $8, %%xmm0\n\t"
+            "psrld $5, %%xmm1\n\t"
+            "psrld $3, %%xmm2\n\t"
+            "pand %[r], %%xmm0\n\t"
+            "pand %[g], %%xmm1\n\t"
+            "pand %[b], %%xmm2\n\t"
+            "por %%xmm1, %%xmm0\n\t"
+            "por %%xmm2, %%xmm0\n\t"
+            "pslld $16, %%xmm0\n\t"
+            "psrad $16, %%xmm0\n\t"
+            /* Pixels 4-7 */
+            "movdqa %%xmm4, %%xmm1\n\t"
+            "movdqa %%xmm4, %%xmm2\n\t"
+            "psrld $8, %%xmm4\n\t"
+            "psrld $5, %%xmm1\n\t"
+            "psrld $3, %%xmm2\n\t"
+            "pand %[r], %%xmm4\n\t"
+            "pand %[g], %%xmm1\n\t"
+            "pand %[b], %%xmm2\n\t"
+            "por %%xmm1, %%xmm4\n\t"
+            "por %%xmm2, %%xmm4\n\t"
+            "pslld $16, %%xmm4\n\t"
+            "psrad $16, %%xmm4\n\t"
+            "packssdw %%xmm4, %%xmm0\n\t"
+            "movdqu %%xmm0, (%1)"
+            :
+            : "r"(src), "r"(d), [r] "m"(mask_r565), [g] "m"(mask_g565), [b] "m"(mask_b565)
+            : "xmm0", "xmm1", "xmm2", "xmm4", "memory"
+        );
+        src += 8;
+        d += 8;
+    }
+    
+    for (i = chunks * 8; i < count; i++) {
+        *d++ = pixfmt_to_565(*src++);
+    }
+}
+
+/*
+ * RGB565 source to 16 bpp: straight copy, 32 pixels per iteration
+ */
+static void blit_row_565_16(void *dst, const uint16_t *src, int count) {
+    uint16_t *d = (uint16_t *)dst;
+    int i;
+    int chunks = count / 32;
+    
+    for (i = 0; i < chunks; i++) {
+        __asm__ __volatile__(
+            "movdqu (%0), %%xmm0\n\t"
+            "movdqu 16(%0), %%xmm1\n\t"
+            "movdqu 32(%0), %%xmm2\n\t"
+            "movdqu 48(%0), %%xmm3\n\t"
+            "movdqu %%xmm0, (%1)\n\t"
+            "movdqu %%xmm1, 16(%1)\n\t"
+            "movdqu %%xmm2, 32(%1)\n\t"
+            "movdqu %%xmm3, 48(%1)"
+            :
+            : "r"(src), "r"(d)
+            : "xmm0", "xmm1", "xmm2", "xmm3", "memory"
+        );
+        src += 32;
+        d += 32;
+    }
+    
+    for (i = chunks * 32; i < count; i++) {
+        *d++ = *src++;
+    }
+}
+
+static void fill_row_16(void *dst, uint32_t color, int count) {
+    uint16_t *d = (uint16_t *)dst;
+    uint16_t p = pixfmt_to_565(color);
+    uint32_t pair = ((uint32_t)p << 16) | p;
+    int i;
+    
+    /* Align to 4 bytes, then two pixels per store */
+    if (count > 0 && ((uint32_t)d & 2)) {
+        *d++ = p;
+        count--;
+    }
+    for (i = 0; i < count / 2; i++) {
+        *(uint32_t *)d = pair;
+        d += 2;
+    }
+    if (count & 1) {
+        *d = p;
+    }
+}
+
+static uint32_t read_pixel_16(const void *src) {
+    return pixfmt_from_565(*(const uint16_t *)src);
+}
+
+static const pixfmt_t formats[] = {
+    {32, 4, blit_row_32, blit_row_565_32, fill_row_32, read_pixel_32},
+    {24, 3, blit_row_24, blit_row_565_24, fill_row_24, read_pixel_24},
+    {16, 2, blit_row_16, blit_row_565_16, fill_row_16, read_pixel_16},
+};
+
+/*
+ * Get the format for a depth
+ */
+const pixfmt_t *pixfmt_get(int bpp) {
+    int i;
+    
+    for (i = 0; i < (int)(sizeof(formats) / sizeof(formats[0])); i++) {
+        if (formats[i].bpp == bpp) {
+            return &formats[i];
+        }
+    }
+    return (const pixfmt_t *)0;
+}
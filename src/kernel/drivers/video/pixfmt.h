@@ -0,0 +1,54 @@
+/*
+ * pixfmt.h - Framebuffer pixel format header
+ * version 0.0.3
+ * Row kernels for 32, 24 and 16 bpp linear framebuffers
+ */
+
+#ifndef PIXFMT_H
+#define PIXFMT_H
+
+#include "../../stdint.h"
+
+/* Convert count XRGB8888 pixels to the framebuffer format */
+typedef void (*pixfmt_blit_fn)(void *dst, const uint32_t *src, int count);
+
+/* Convert count RGB565 pixels to the framebuffer format */
+typedef void (*pixfmt_blit565_fn)(void *dst, const uint16_t *src, int count);
+
+/* Fill count framebuffer pixels with an XRGB8888 color */
+typedef void (*pixfmt_fill_fn)(void *dst, uint32_t color, int count);
+
+/* Read one framebuffer pixel as XRGB8888 */
+typedef uint32_t (*pixfmt_read_fn)(const void *src);
+
+/* Pixel format description */
+typedef struct {
+    int bpp;                    /* Bits per pixel */
+    int bytes;                  /* Bytes per pixel */
+    pixfmt_blit_fn blit_row;        /* From an XRGB8888 buffer */
+    pixfmt_blit565_fn blit_row_565; /* From an RGB565 buffer */
+    pixfmt_fill_fn fill_row;
+    pixfmt_read_fn read_pixel;
+} pixfmt_t;
+
+/* Get the format for a depth, or 0 if unsupported */
+const pixfmt_t *pixfmt_get(int bpp);
+
+/* Convert an XRGB8888 color to RGB565 */
+static inline uint16_t pixfmt_to_565(uint32_t c) {
+    return (uint16_t)(((c >> 8) & 0xF800) | ((c >> 5) & 0x07E0) | ((c >> 3) & 0x001F));
+}
+
+/* Convert an RGB565 color to XRGB8888 (low bits replicated) */
+static inline uint32_t pixfmt_from_565(uint16_t p) {
+    uint32_t r = (p >> 11) & 0x1F;
+    uint32_t g = (p >> 5) & 0x3F;
+    uint32_t b = p & 0x1F;
+    
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+    return (r << 16) | (g << 8) | b;
+}
+
+#endif /* PIXFMT_H */
@@ -0,0 +1,489 @@
+/*
+ * raster.c - Scanline rasterizer implementation
+ * version 0.0.4
+ * Every primitive is reduced to horizontal spans. The bounds of a
+ * primitive are clipped and marked dirty once; each span is then only
+ * clamped to the clip rectangle of the draw target and filled with
+ * gfx_fill_span.
+ */
+
+#include "raster.h"
+#include "graphics.h"
+
+/* Clip rectangle for the primitive being drawn (inclusive) */
+static int clip_x1 = 0, clip_y1 = 0;
+static int clip_x2 = -1, clip_y2 = -1;
+
+/* Edge table for polygon fill (16.16 fixed point x) */
+typedef struct {
+    int y_top;      /* First row crossed */
+    int y_end;      /* Row after the last one crossed */
+    int32_t x;      /* x at y_top, in 16.16 */
+    int32_t dx;     /* x step per row, in 16.16 */
+} raster_edge_t;
+
+static raster_edge_t edges[RASTER_MAX_VERTICES];
+static int32_t crossings[RASTER_MAX_VERTICES];
+
+/* Half-widths per row for gfx_fill_annulus */
+static int outer_widths[RASTER_MAX_RADIUS + 1];
+static int inner_widths[RASTER_MAX_RADIUS + 1];
+
+/* Statistics */
+static uint32_t span_count = 0;
+static uint32_t pixel_count = 0;
+
+static int clamp_coord(int v) {
+    if (v < -RASTER_COORD_LIMIT) return -RASTER_COORD_LIMIT;
+    if (v > RASTER_COORD_LIMIT) return RASTER_COORD_LIMIT;
+    return v;
+}
+
+/*
+ * Start a primitive: clip its bounding box and mark the visible part
+ * dirty. Returns 0 if nothing of it is visible.
+ */
+static int begin(int x1, int y1, int x2, int y2) {
+    gfx_get_clip(&clip_x1, &clip_y1, &clip_x2, &clip_y2);
+    
+    if (x2 < clip_x1 || y2 < clip_y1 || x1 > clip_x2 || y1 > clip_y2) return 0;
+    
+    if (x1 < clip_x1) x1 = clip_x1;
+    if (y1 < clip_y1) y1 = clip_y1;
+    if (x2 > clip_x2) x2 = clip_x2;
+    if (y2 > clip_y2) y2 = clip_y2;
+    
+    gfx_mark_dirty_rect(x1, y1, x2 - x1 + 1, y2 - y1 + 1);
+    return 1;
+}
+
+/*
+ * Fill columns x1..x2 of row y, clamped to the clip rectangle
+ */
+static void span(int x1, int x2, int y, uint32_t color) {
+    if (y < clip_y1 || y > clip_y2) return;
+    if (x1 < clip_x1) x1 = clip_x1;
+    if (x2 > clip_x2) x2 = clip_x2;
+    if (x1 > x2) return;
+    
+    gfx_fill_span(x1, y, x2 - x1 + 1, color);
+    span_count++;
+    pixel_count += x2 - x1 + 1;
+}
+
+/*
+ * Draw a circle outline (midpoint)
+ * Where the outline is steep each row gets one pixel per side; where
+ * it is flat the pixels sharing a row are collected into one span.
+ */
+void gfx_circle(int cx, int cy, int radius, uint32_t color) {
+    int x = radius;
+    int y = 0;
+    int d = 1 - radius;
+    int run = 0;    /* First y of the flat run on rows cy +/- x */
+    
+    if (radius < 0) return;
+    if (!begin(cx - radius, cy - radius, cx + radius, cy + radius)) return;
+    
+    while (y <= x) {
+        /* Steep octants */
+        span(cx - x, cx - x, cy + y, color);
+        span(cx + x, cx + x, cy + y, color);
+        span(cx - x, cx - x, cy - y, color);
+        span(cx + x, cx + x, cy - y, color);
+        
+        if (d < 0) {
+            d += 2 * y + 3;
+        } else {
+            /* Flat octants: x is about to change, emit the run */
+            span(cx - y, cx - run, cy + x, color);
+            span(cx + run, cx + y, cy + x, color);
+            span(cx - y, cx - run, cy - x, color);
+            span(cx + run, cx + y, cy - x, color);
+            run = y + 1;
+            d += 2 * (y - x) + 5;
+            x--;
+        }
+        y++;
+    }
+    
+    if (run < y) {
+        span(cx - (y - 1), cx - run, cy + x, color);
+        span(cx + run, cx + y - 1, cy + x, color);
+        span(cx - (y - 1), cx - run, cy - x, color);
+        span(cx + run, cx + y - 1, cy - x, color);
+    }
+}
+
+/*
+ * Draw a filled circle (midpoint)
+ * One span per row, O(r) in total with no multiplications. Rows cy +/- x
+ * are only emitted when x is about to change, so none is drawn twice.
+ */
+void gfx_fill_circle(int cx, int cy, int radius, uint32_t color) {
+    int x = radius;
+    int y = 0;
+    int d = 1 - radius;
+    
+    if (radius < 0) return;
+    if (!begin(cx - radius, cy - radius, cx + radius, cy + radius)) return;
+    
+    while (y <= x) {
+        span(cx - x, cx + x, cy + y, color);
+        if (y != 0) span(cx - x, cx + x, cy - y, color);
+        
+        if (d < 0) {
+            d += 2 * y + 3;
+        } else {
+            if (x != y) {
+                span(cx - y, cx + y, cy + x, color);
+                span(cx - y, cx + y, cy - x, color);
+            }
+            d += 2 * (y - x) + 5;
+            x--;
+        }
+        y++;
+    }
+}
+
+/*
+ * Record the half-width of each row of a midpoint disc
+ * Same walk as gfx_fill_circle, so widths[dy] matches what it draws
+ */
+static void circle_widths(int radius, int *widths) {
+    int x = radius;
+    int y = 0;
+    int d = 1 - radius;
+    
+    while (y <= x) {
+        widths[y] = x;
+        if (d < 0) {
+            d += 2 * y + 3;
+        } else {
+            widths[x] = y;
+            d += 2 * (y - x) + 5;
+            x--;
+        }
+        y++;
+    }
+}
+
+/*
+ * Fill the ring between two midpoint circles
+ * Rows above the inner circle get one span, rows beside it two. The
+ * work is proportional to the ring area, not the disc.
+ */
+void gfx_fill_annulus(int cx, int cy, int r_inner, int r_outer, uint32_t color) {
+    int dy;
+    
+    if (r_outer < 0 || r_outer > RASTER_MAX_RADIUS || r_inner >= r_outer) return;
+    if (!begin(cx - r_outer, cy - r_outer, cx + r_outer, cy + r_outer)) return;
+    
+    circle_widths(r_outer, outer_widths);
+    if (r_inner >= 0) circle_widths(r_inner, inner_widths);
+    
+    for (dy = 0; dy <= r_outer; dy++) {
+        int xo = outer_widths[dy];
+        int xi = (dy <= r_inner) ? inner_widths[dy] : -1;
+        
+        if (xi < 0) {
+            span(cx - xo, cx + xo, cy + dy, color);
+            if (dy != 0) span(cx - xo, cx + xo, cy - dy, color);
+        } else if (xi < xo) {
+            span(cx - xo, cx - xi - 1, cy + dy, color);
+            span(cx + xi + 1, cx + xo, cy + dy, color);
+            if (dy != 0) {
+                span(cx - xo, cx - xi - 1, cy - dy, color);
+                span(cx + xi + 1, cx + xo, cy - dy, color);
+            }
+        }
+    }
+}
+
+/*
+ * Walk the right half-width of an ellipse row by row
+ * Returns the largest x with (x/rx)^2 + (dy/ry)^2 <= 1. x only
+ * shrinks as dy grows, so the walk is O(rx + ry).
+ */
+static int ellipse_step(int x, int dy, int rx, int ry) {
+    int64_t rx2 = (int64_t)rx * rx;
+    int64_t ry2 = (int64_t)ry * ry;
+    int64_t limit = rx2 * ry2 - (int64_t)dy * dy * rx2;
+    
+    while (x > 0 && (int64_t)x * x * ry2 > limit) {
+        x--;
+    }
+    return x;
+}
+
+/*
+ * Draw an ellipse outline
+ * Each row covers the columns between its own half-width and the one
+ * of the row inside it, so the outline stays connected where it is flat.
+ */
+void gfx_ellipse(int cx, int cy, int rx, int ry, uint32_t color) {
+    int dy;
+    int x = rx;
+    int prev = rx;
+    
+    if (rx < 0 || ry < 0) return;
+    rx = clamp_coord(rx);
+    ry = clamp_coord(ry);
+    if (!begin(cx - rx, cy - ry, cx + rx, cy + ry)) return;
+    
+    for (dy = 0; dy <= ry; dy++) {
+        int inner, edge;
+        
+        x = ellipse_step(x, dy, rx, ry);
+        inner = (dy == 0 || prev - 1 < x) ? x : prev - 1;
+        edge = (dy == ry) ? 0 : x;  /* Top and bottom rows are solid */
+        
+        span(cx - inner, cx - edge, cy + dy, color);
+        span(cx + edge, cx + inner, cy + dy, color);
+        if (dy != 0) {
+            span(cx - inner, cx - edge, cy - dy, color);
+            span(cx + edge, cx + inner, cy - dy, color);
+        }
+        prev = x;
+    }
+}
+
+/*
+ * Draw a filled ellipse
+ */
+void gfx_fill_ellipse(int cx, int cy, int rx, int ry, uint32_t color) {
+    int dy;
+    int x = rx;
+    
+    if (rx < 0 || ry < 0) return;
+    rx = clamp_coord(rx);
+    ry = clamp_coord(ry);
+    if (!begin(cx - rx, cy - ry, cx + rx, cy + ry)) return;
+    
+    for (dy = 0; dy <= ry; dy++) {
+        x = ellipse_step(x, dy, rx, ry);
+        span(cx - x, cx + x, cy + dy, color);
+        if (dy != 0) span(cx - x, cx + x, cy - dy, color);
+    }
+}
+
+/*
+ * Range of steps i in 0..n for which start + i * step lies in lo..hi
+ * Returns 0 if there are none.
+ */
+static int step_range(int start, int step, int n, int lo, int hi, int *first, int *last) {
+    if (step > 0) {
+        *first = lo - start;
+        *last = hi - start;
+    } else {
+        *first = start - hi;
+        *last = start - lo;
+    }
+    if (*first < 0) *first = 0;
+    if (*last > n) *last = n;
+    return *first <= *last;
+}
+
+/*
+ * Draw a line (Bresenham)
+ * Step i along the major axis is i minor steps of (2 * i * d_minor +
+ * d_major) / (2 * d_major) in. That gives the visible steps directly
+ * from the clip rectangle, and the walk starts at the first one with
+ * the error term it would have had there, so the pixels do not depend
+ * on the clip. Pixels on the same row are emitted as one span.
+ */
+void gfx_draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
+    int steep, d_major, d_minor, s_major, s_minor;
+    int major0, minor0, major_lo, major_hi, minor_lo, minor_hi;
+    int i, i1, i2, k1, k2, lo, hi;
+    int major, minor, run, den, num, r;
+    
+    x0 = clamp_coord(x0);
+    y0 = clamp_coord(y0);
+    x1 = clamp_coord(x1);
+    y1 = clamp_coord(y1);
+    
+    gfx_get_clip(&clip_x1, &clip_y1, &clip_x2, &clip_y2);
+    
+    steep = (y1 > y0 ? y1 - y0 : y0 - y1) > (x1 > x0 ? x1 - x0 : x0 - x1);
+    if (steep) {
+        major0 = y0; minor0 = x0;
+        d_major = y1 - y0; d_minor = x1 - x0;
+        major_lo = clip_y1; major_hi = clip_y2;
+        minor_lo = clip_x1; minor_hi = clip_x2;
+    } else {
+        major0 = x0; minor0 = y0;
+        d_major = x1 - x0; d_minor = y1 - y0;
+        major_lo = clip_x1; major_hi = clip_x2;
+        minor_lo = clip_y1; minor_hi = clip_y2;
+    }
+    s_major = d_major < 0 ? -1 : 1;
+    s_minor = d_minor < 0 ? -1 : 1;
+    d_major *= s_major;
+    d_minor *= s_minor;
+    
+    /* Steps whose minor coordinate is visible, then whose major one is */
+    if (!step_range(minor0, s_minor, d_minor, minor_lo, minor_hi, &k1, &k2)) return;
+    i1 = k1 == 0 ? 0 : (2 * d_major * k1 - d_major + 2 * d_minor - 1) / (2 * d_minor);
+    i2 = k2 == d_minor ? d_major
+                       : (2 * d_major * (k2 + 1) - d_major + 2 * d_minor - 1) / (2 * d_minor) - 1;
+    if (!step_range(major0, s_major, d_major, major_lo, major_hi, &lo, &hi)) return;
+    if (lo > i1) i1 = lo;
+    if (hi < i2) i2 = hi;
+    if (i1 > i2) return;
+    
+    /* Mark the visible part dirty: its first and last pixels */
+    den = d_major ? 2 * d_major : 1;
+    major = major0 + i2 * s_major;
+    minor = minor0 + (2 * i2 * d_minor + d_major) / den * s_minor;
+    x1 = steep ? minor : major;
+    y1 = steep ? major : minor;
+    
+    num = 2 * i1 * d_minor + d_major;
+    r = num % den;
+    major = major0 + i1 * s_major;
+    minor = minor0 + num / den * s_minor;
+    x0 = steep ? minor : major;
+    y0 = steep ? major : minor;
+    
+    begin(x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1,
+          x0 > x1 ? x0 : x1, y0 > y1 ? y0 : y1);
+    
+    run = major;
+    for (i = i1; i <= i2; i++) {
+        int next = r + 2 * d_minor;
+        
+        if (steep) {
+            span(minor, minor, major, color);
+        } else if (i == i2 || next >= den) {
+            /* Last pixel of this row */
+            span(run < major ? run : major, run < major ? major : run, minor, color);
+            run = major + s_major;
+        }
+        if (next >= den) {
+            next -= den;
+            minor += s_minor;
+        }
+        r = next;
+        major += s_major;
+    }
+}
+
+/*
+ * Draw a closed polygon outline
+ */
+void gfx_draw_polygon(const gfx_point_t *points, int count, uint32_t color) {
+    int i;
+    
+    for (i = 0; i < count; i++) {
+        const gfx_point_t *a = &points[i];
+        const gfx_point_t *b = &points[(i + 1) % count];
+        gfx_draw_line(a->x, a->y, b->x, b->y, color);
+    }
+}
+
+/*
+ * Fill a polygon (even-odd rule)
+ * Edges are set up once with a 16.16 x and slope. For each row the
+ * crossings at the pixel centers are sorted and filled in pairs, which
+ * handles concave and self-intersecting outlines alike.
+ */
+void gfx_fill_polygon(const gfx_point_t *points, int count, uint32_t color) {
+    int i, y;
+    int edge_count = 0;
+    int min_x, min_y, max_x, max_y;
+    
+    if (count < 3 || count > RASTER_MAX_VERTICES) return;
+    
+    min_x = max_x = clamp_coord(points[0].x);
+    min_y = max_y = clamp_coord(points[0].y);
+    
+    for (i = 0; i < count; i++) {
+        int ax = clamp_coord(points[i].x);
+        int ay = clamp_coord(points[i].y);
+        int bx = clamp_coord(points[(i + 1) % count].x);
+        int by = clamp_coord(points[(i + 1) % count].y);
+        raster_edge_t *e;
+        
+        if (ax < min_x) min_x = ax;
+        if (ax > max_x) max_x = ax;
+        if (ay < min_y) min_y = ay;
+        if (ay > max_y) max_y = ay;
+        
+        /* Horizontal edges cross no row centers */
+        if (ay == by) continue;
+        
+        if (ay > by) {
+            int t;
+            t = ax; ax = bx; bx = t;
+            t = ay; ay = by; by = t;
+        }
+        
+        /* Rows y_top..y_end-1 have their centers y + 0.5 on the edge */
+        e = &edges[edge_count++];
+        e->y_top = ay;
+        e->y_end = by;
+        e->dx = ((bx - ax) << 16) / (by - ay);
+        e->x = (ax << 16) + e->dx / 2;
+    }
+    
+    if (!begin(min_x, min_y, max_x, max_y - 1)) return;
+    
+    if (min_y < clip_y1) min_y = clip_y1;
+    if (max_y > clip_y2 + 1) max_y = clip_y2 + 1;
+    
+    for (y = min_y; y < max_y; y++) {
+        int n = 0;
+        
+        for (i = 0; i < edge_count; i++) {
+            const raster_edge_t *e = &edges[i];
+            int32_t cx;
+            int j;
+            
+            if (y < e->y_top || y >= e->y_end) continue;
+            
+            /* Insertion sort; polygons here have few edges per row */
+            cx = e->x + e->dx * (y - e->y_top);
+            for (j = n; j > 0 && crossings[j - 1] > cx; j--) {
+                crossings[j] = crossings[j - 1];
+            }
+            crossings[j] = cx;
+            n++;
+        }
+        
+        /* Fill the pixels whose centers fall in [left, right) */
+        for (i = 0; i + 1 < n; i += 2) {
+            int x1 = (crossings[i] + 0x7FFF) >> 16;
+            int x2 = ((crossings[i + 1] + 0x7FFF) >> 16) - 1;
+            span(x1, x2, y, color);
+        }
+    }
+}
+
+/*
+ * Fill a triangle
+ */
+void gfx_fill_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color) {
+    gfx_point_t points[3];
+    
+    points[0].x = x0; points[0].y = y0;
+    points[1].x = x1; points[1].y = y1;
+    points[2].x = x2; points[2].y = y2;
+    gfx_fill_polygon(points, 3, color);
+}
+
+/*
+ * Get rasterizer statistics
+ */
+void raster_get_stats(uint32_t *spans, uint32_t *pixels) {
+    if (spans) *spans = span_count;
+    if (pixels) *pixels = pixel_count;
+}
+
+/*
+ * Reset rasterizer statistics
+ */
+void raster_reset_stats(void) {
+    span_count = 0;
+    pixel_count = 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * raster.h - Scanline rasterizer header
+ * version 0.0.2
+ * Circles, ellipses, lines and polygons drawn as horizontal spans
+ */
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include "../../stdint.h"
+
+/* Most vertices gfx_fill_polygon accepts */
+#define RASTER_MAX_VERTICES 64
+
+/* Coordinates are clamped to +/- this before any edge math */
+#define RASTER_COORD_LIMIT  8191
+
+/* Largest outer radius gfx_fill_annulus accepts */
+#define RASTER_MAX_RADIUS   2047
+
+/* Polygon vertex */
+typedef struct {
+    int x;
+    int y;
+} gfx_point_t;
+
+/* Circle outline and filled circle (midpoint) */
+void gfx_circle(int cx, int cy, int radius, uint32_t color);
+void gfx_fill_circle(int cx, int cy, int radius, uint32_t color);
+
+/* Fill the pixels of gfx_fill_circle(r_outer) that gfx_fill_circle(r_inner)
+ * does not cover; r_inner < 0 fills the whole disc */
+void gfx_fill_annulus(int cx, int cy, int r_inner, int r_outer, uint32_t color);
+
+/* Axis-aligned ellipse outline and filled ellipse */
+void gfx_ellipse(int cx, int cy, int rx, int ry, uint32_t color);
+void gfx_fill_ellipse(int cx, int cy, int rx, int ry, uint32_t color);
+
+/* Line between two points, both inclusive (Bresenham, clipped) */
+void gfx_draw_line(int x0, int y0, int x1, int y1, uint32_t color);
+
+/* Closed polygon outline */
+void gfx_draw_polygon(const gfx_point_t *points, int count, uint32_t color);
+
+/* Filled polygon, convex or concave (even-odd rule)
+ * Pixels whose centers lie inside are filled, so shared edges are
+ * drawn once */
+void gfx_fill_polygon(const gfx_point_t *points, int count, uint32_t color);
+
+/* Filled triangle */
+void gfx_fill_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
+
+/* Spans and pixels filled since the last reset */
+void raster_get_stats(uint32_t *spans, uint32_t *pixels);
+void raster_reset_stats(void);
+
+#endif /* RASTER_H */
@@ -0,0 +1,568 @@
+/*
+ * scale.c - Image scaling and pixel format conversion implementation
+ * version 0.0.2
+ * Scaled blits convert a source row to XRGB8888 at most once, into a
+ * row cache, and write the result straight into the draw target, so
+ * source and destination are each gone over once. XRGB8888 sources
+ * are read in place.
+ * Positions are 16.16 fixed point. The source column and weight of
+ * every destination column are worked out once per blit.
+ * Nearest neighbour picks a pixel per column and repeats whole rows
+ * when enlarging. Bilinear first scales a source row across (kept, so
+ * each source row is done once however many output rows use it), then
+ * blends two such rows down; both passes do four pixels per SSE2
+ * iteration with weights of 0-256.
+ * RGB565 and BGR888 go through the pixfmt row kernels; gray is widened,
+ * or weighted with pmaddwd, eight to sixteen pixels at a time.
+ */
+
+#include "scale.h"
+#include "pixfmt.h"
+#include "../../string.h"
+
+/* Per destination column: source column (relative to the source
+ * rectangle) and, for bilinear, the weight of the pixel to its right
+ * four times over */
+static int column_x[GFX_MAX_WIDTH];
+static uint16_t column_w[GFX_MAX_WIDTH * 4] __attribute__((aligned(16)));
+
+/* Source row converted to XRGB8888, plus a copy of its last pixel */
+static uint32_t source_row[GFX_SCALE_MAX_WIDTH + 1] __attribute__((aligned(16)));
+
+/* Bilinear: source rows scaled across, and the rows they came from */
+static uint32_t across[2][GFX_MAX_WIDTH] __attribute__((aligned(16)));
+static int across_y[2];
+
+#ifdef GFX_BACKBUFFER_16
+/* Finished XRGB8888 row, converted as it is stored */
+static uint32_t out_row[GFX_MAX_WIDTH] __attribute__((aligned(16)));
+#endif
+
+/* SSE2 constants */
+static const uint32_t mask_rgb[4] __attribute__((aligned(16))) = {
+    0x00FFFFFF, 0x00FFFFFF, 0x00FFFFFF, 0x00FFFFFF
+};
+static const int16_t luma_weights[8] __attribute__((aligned(16))) = {29, 150, 77, 0, 29, 150, 77, 0};
+static const uint32_t luma_round[4] __attribute__((aligned(16))) = {128, 128, 128, 128};
+static const uint16_t words_256[8] __attribute__((aligned(16))) = {256, 256, 256, 256, 256, 256, 256, 256};
+
+/*
+ * Gray to XRGB8888: sixteen pixels per iteration
+ * Each byte is doubled to a word and the word to a dword.
+ */
+static void gray_to_xrgb(uint32_t *dst, const uint8_t *src, int count) {
+    int chunks = count / 16;
+    int i;
+    
+    for (i = 0; i < chunks; i++) {
+        __asm__ __volatile__(
+            "movdqu (%0), %%xmm0\n\t"
+            "movdqa %%xmm0, %%xmm1\n\t"
+            "punpcklbw %%xmm0, %%xmm0\n\t"
+            "punpckhbw %%xmm1, %%xmm1\n\t"
+            "movdqa %%xmm0, %%xmm2\n\t"
+            "movdqa %%xmm1, %%xmm3\n\t"
+            "punpcklwd %%xmm0, %%xmm0\n\t"
+            "punpckhwd %%xmm2, %%xmm2\n\t"
+            "punpcklwd %%xmm1, %%xmm1\n\t"
+            "punpckhwd %%xmm3, %%xmm3\n\t"
+            "pand %[m], %%xmm0\n\t"
+            "pand %[m], %%xmm2\n\t"
+            "pand %[m], %%xmm1\n\t"
+            "pand %[m], %%xmm3\n\t"
+            "movdqu %%xmm0, (%1)\n\t"
+            "movdqu %%xmm2, 16(%1)\n\t"
+            "movdqu %%xmm1, 32(%1)\n\t"
+            "movdqu %%xmm3, 48(%1)"
+            :
+            : "r"(src), "r"(dst), [m] "m"(mask_rgb)
+            : "xmm0", "xmm1", "xmm2", "xmm3", "memory"
+        );
+        src += 16;
+        dst += 16;
+    }
+    
+    for (i = chunks * 16; i < count; i++) {
+        uint32_t g = *src++;
+        *dst++ = (g << 16) | (g << 8) | g;
+    }
+}
+
+/*
+ * XRGB8888 to gray: eight pixels per iteration
+ * pmaddwd gives B*29 + G*150 and R*77 per pixel; shufps sorts the two
+ * halves of four pixels into two vectors to be added.
+ */
+static void xrgb_to_gray(uint8_t *dst, const uint32_t *src, int count) {
+    int chunks = count / 8;
+    int i;
+    
+    for (i = 0; i < chunks; i++) {
+        __asm__ __volatile__(
+            "pxor %%xmm7, %%xmm7\n\t"
+            "movdqu (%0), %%xmm0\n\t"
+            "movdqu 16(%0), %%xmm4\n\t"
+            /* Pixels 0-3 */
+            "movdqa %%xmm0, %%xmm1\n\t"
+            "punpcklbw %%xmm7, %%xmm0\n\t"
+            "punpckhbw %%xmm7, %%xmm1\n\t"
+            "pmaddwd %[w], %%xmm0\n\t"
+            "pmaddwd %[w], %%xmm1\n\t"
+            "movaps %%xmm0, %%xmm2\n\t"
+            "shufps $0x88, %%xmm1, %%xmm0\n\t"
+            "shufps $0xDD, %%xmm1, %%xmm2\n\t"
+            "paddd %%xmm2, %%xmm0\n\t"
+            "paddd %[r], %%xmm0\n\t"
+            "psrld $8, %%xmm0\n\t"
+            /* Pixels 4-7 */
+            "movdqa %%xmm4, %%xmm5\n\t"
+            "punpcklbw %%xmm7, %%xmm4\n\t"
+            "punpckhbw %%xmm7, %%xmm5\n\t"
+            "pmaddwd %[w], %%xmm4\n\t"
+            "pmaddwd %[w], %%xmm5\n\t"
+            "movaps %%xmm4, %%xmm6\n\t"
+            "shufps $0x88, %%xmm5, %%xmm4\n\t"
+            "shufps $0xDD, %%xmm5, %%xmm6\n\t"
+            "paddd %%xmm6, %%xmm4\n\t"
+            "paddd %[r], %%xmm4\n\t"
+            "psrld $8, %%xmm4\n\t"
+            "packssdw %%xmm4, %%xmm0\n\t"
+            "packuswb %%xmm0, %%xmm0\n\t"
+            "movq %%xmm0, (%1)"
+            :
+            : "r"(src), "r"(dst), [w] "m"(luma_weights), [r] "m"(luma_round)
+            : "xmm0", "xmm1", "xmm2", "xmm4", "xmm5", "xmm6", "xmm7", "memory"
+        );
+        src += 8;
+        dst += 8;
+    }
+    
+    for (i = chunks * 8; i < count; i++) {
+        uint32_t c = *src++;
+        *dst++ = (uint8_t)((((c >> 16) & 0xFF) * 77 + ((c >> 8) & 0xFF) * 150 +
+                            (c & 0xFF) * 29 + 128) >> 8);
+    }
+}
+
+/*
+ * BGR888 to XRGB8888: four pixels are unpacked from three 32-bit loads
+ */
+static void bgr_to_xrgb(uint32_t *dst, const uint8_t *src, int count) {
+    const uint32_t *s = (const uint32_t *)src;
+    int quads = count / 4;
+    int i;
+    
+    for (i = 0; i < quads; i++) {
+        uint32_t w0 = s[0];
+        uint32_t w1 = s[1];
+        uint32_t w2 = s[2];
+        
+        dst[0] = w0 & 0x00FFFFFF;
+        dst[1] = (w0 >> 24) | ((w1 & 0xFFFF) << 8);
+        dst[2] = (w1 >> 16) | ((w2 & 0xFF) << 16);
+        dst[3] = w2 >> 8;
+        s += 3;
+        dst += 4;
+    }
+    
+    src = (const uint8_t *)s;
+    for (i = quads * 4; i < count; i++) {
+        *dst++ = (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16);
+        src += 3;
+    }
+}
+
+/*
+ * Convert pixels of an image format to XRGB8888
+ */
+void gfx_convert_to_xrgb(uint32_t *dst, const void *src, int format, int count) {
+    switch (format) {
+        case GFX_FORMAT_XRGB8888:
+            pixfmt_get(32)->blit_row(dst, (const uint32_t *)src, count);
+            break;
+        case GFX_FORMAT_RGB565:
+            pixfmt_get(32)->blit_row_565(dst, (const uint16_t *)src, count);
+            break;
+        case GFX_FORMAT_BGR888:
+            bgr_to_xrgb(dst, (const uint8_t *)src, count);
+            break;
+        case GFX_FORMAT_GRAY8:
+            gray_to_xrgb(dst, (const uint8_t *)src, count);
+            break;
+    }
+}
+
+/*
+ * Convert XRGB8888 pixels to an image format
+ */
+void gfx_convert_from_xrgb(void *dst, const uint32_t *src, int format, int count) {
+    switch (format) {
+        case GFX_FORMAT_XRGB8888:
+            pixfmt_get(32)->blit_row(dst, src, count);
+            break;
+        case GFX_FORMAT_RGB565:
+            pixfmt_get(16)->blit_row(dst, src, count);
+            break;
+        case GFX_FORMAT_BGR888:
+            pixfmt_get(24)->blit_row(dst, src, count);
+            break;
+        case GFX_FORMAT_GRAY8:
+            xrgb_to_gray((uint8_t *)dst, src, count);
+            break;
+    }
+}
+
+/*
+ * Bytes per pixel of an image format, 0 if unknown
+ */
+static int format_bytes(int format) {
+    switch (format) {
+        case GFX_FORMAT_XRGB8888: return 4;
+        case GFX_FORMAT_RGB565:   return 2;
+        case GFX_FORMAT_BGR888:   return 3;
+        case GFX_FORMAT_GRAY8:    return 1;
+    }
+    return 0;
+}
+
+/*
+ * Get a source row as XRGB8888, starting at the source rectangle
+ * XRGB8888 images are used in place unless the last pixel has to be
+ * repeated for bilinear pairs.
+ */
+static const uint32_t *get_source_row(const gfx_image_t *image, int src_x, int row,
+                                      int count, int pad) {
+    const uint8_t *p = (const uint8_t *)image->pixels + row * image->pitch +
+                       src_x * format_bytes(image->format);
+    
+    if (image->format == GFX_FORMAT_XRGB8888 && !pad) {
+        return (const uint32_t *)p;
+    }
+    gfx_convert_to_xrgb(source_row, p, image->format, count);
+    source_row[count] = source_row[count - 1];
+    return source_row;
+}
+
+/*
+ * Nearest neighbour: pick the source pixel of every column
+ */
+static void nearest_row(uint32_t *dst, const uint32_t *src, int count) {
+    int i;
+    
+    for (i = 0; i + 4 <= count; i += 4) {
+        dst[i] = src[column_x[i]];
+        dst[i + 1] = src[column_x[i + 1]];
+        dst[i + 2] = src[column_x[i + 2]];
+        dst[i + 3] = src[column_x[i + 3]];
+    }
+    for (; i < count; i++) {
+        dst[i] = src[column_x[i]];
+    }
+}
+
+/*
+ * Bilinear across: blend each column's source pixel with the one to
+ * its right, four columns per iteration
+ * The pairs are gathered first (left pixels, then right pixels) so the
+ * arithmetic runs on whole vectors: widen to words, multiply by
+ * 256 - w and w, add, divide by 256.
+ */
+static void across_row(uint32_t *dst, const uint32_t *src, int count) {
+    uint32_t pairs[8] __attribute__((aligned(16)));
+    int i;
+    
+    for (i = 0; i + 4 <= count; i += 4) {
+        pairs[0] = src[column_x[i]];
+        pairs[1] = src[column_x[i + 1]];
+        pairs[2] = src[column_x[i + 2]];
+        pairs[3] = src[column_x[i + 3]];
+        pairs[4] = src[column_x[i] + 1];
+        pairs[5] = src[column_x[i + 1] + 1];
+        pairs[6] = src[column_x[i + 2] + 1];
+        pairs[7] = src[column_x[i + 3] + 1];
+        __asm__ __volatile__(
+            "pxor %%xmm7, %%xmm7\n\t"
+            "movdqa (%0), %%xmm0\n\t"
+            "movdqa 16(%0), %%xmm2\n\t"
+            "movdqa %%xmm0, %%xmm1\n\t"
+            "movdqa %%xmm2, %%xmm3\n\t"
+            "punpcklbw %%xmm7, %%xmm0\n\t"
+            "punpckhbw %%xmm7, %%xmm1\n\t"
+            "punpcklbw %%xmm7, %%xmm2\n\t"
+            "punpckhbw %%xmm7, %%xmm3\n\t"
+            /* Right pixels times w */
+            "movdqa (%1), %%xmm4\n\t"
+            "movdqa 16(%1), %%xmm5\n\t"
+            "pmullw %%xmm4, %%xmm2\n\t"
+            "pmullw %%xmm5, %%xmm3\n\t"
+            /* Left pixels times 256 - w */
+            "movdqa %[c256], %%xmm6\n\t"
+            "psubw %%xmm4, %%xmm6\n\t"
+            "pmullw %%xmm6, %%xmm0\n\t"
+            "movdqa %[c256], %%xmm6\n\t"
+            "psubw %%xmm5, %%xmm6\n\t"
+            "pmullw %%xmm6, %%xmm1\n\t"
+            "paddw %%xmm2, %%xmm0\n\t"
+            "paddw %%xmm3, %%xmm1\n\t"
+            "psrlw $8, %%xmm0\n\t"
+            "psrlw $8, %%xmm1\n\t"
+            "packuswb %%xmm1, %%xmm0\n\t"
+            "movdqu %%xmm0, (%2)"
+            :
+            : "r"(pairs), "r"(&column_w[i * 4]), "r"(&dst[i]), [c256] "m"(words_256)
+            : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", "memory"
+        );
+    }
+    
+    for (; i < count; i++) {
+        uint32_t a = src[column_x[i]];
+        uint32_t b = src[column_x[i] + 1];
+        uint32_t w = column_w[i * 4];
+        uint32_t out = 0;
+        int shift;
+        
+        for (shift = 0; shift < 32; shift += 8) {
+            uint32_t c = (((a >> shift) & 0xFF) * (256 - w) + ((b >> shift) & 0xFF) * w) >> 8;
+            out |= c << shift;
+        }
+        dst[i] = out;
+    }
+}
+
+/*
+ * Bilinear down: blend two rows with weights 256 - w and w, four pixels
+ * per iteration
+ */
+static void down_row(uint32_t *dst, const uint32_t *top, const uint32_t *bottom,
+                     int count, int w) {
+    uint16_t weights[16] __attribute__((aligned(16)));
+    int i;
+    
+    for (i = 0; i < 8; i++) {
+        weights[i] = (uint16_t)(256 - w);
+        weights[i + 8] = (uint16_t)w;
+    }
+    
+    for (i = 0; i + 4 <= count; i += 4) {
+        __asm__ __volatile__(
+            "pxor %%xmm7, %%xmm7\n\t"
+            "movdqu (%3), %%xmm5\n\t"
+            "movdqu 16(%3), %%xmm6\n\t"
+            "movdqu (%0), %%xmm0\n\t"
+            "movdqu (%1), %%xmm2\n\t"
+            "movdqa %%xmm0, %%xmm1\n\t"
+            "movdqa %%xmm2, %%xmm3\n\t"
+            "punpcklbw %%xmm7, %%xmm0\n\t"
+            "punpckhbw %%xmm7, %%xmm1\n\t"
+            "punpcklbw %%xmm7, %%xmm2\n\t"
+            "punpckhbw %%xmm7, %%xmm3\n\t"
+            "pmullw %%xmm5, %%xmm0\n\t"
+            "pmullw %%xmm5, %%xmm1\n\t"
+            "pmullw %%xmm6, %%xmm2\n\t"
+            "pmullw %%xmm6, %%xmm3\n\t"
+            "paddw %%xmm2, %%xmm0\n\t"
+            "paddw %%xmm3, %%xmm1\n\t"
+            "psrlw $8, %%xmm0\n\t"
+            "psrlw $8, %%xmm1\n\t"
+            "packuswb %%xmm1, %%xmm0\n\t"
+            "movdqu %%xmm0, (%2)"
+            :
+            : "r"(&top[i]), "r"(&bottom[i]), "r"(&dst[i]), "r"(weights)
+            : "xmm0", "xmm1", "xmm2", "xmm3", "xmm5", "xmm6", "xmm7", "memory"
+        );
+    }
+    
+    for (; i < count; i++) {
+        uint32_t a = top[i];
+        uint32_t b = bottom[i];
+        uint32_t out = 0;
+        int shift;
+        
+        for (shift = 0; shift < 32; shift += 8) {
+            uint32_t c = (((a >> shift) & 0xFF) * (256 - w) + ((b >> shift) & 0xFF) * w) >> 8;
+            out |= c << shift;
+        }
+        dst[i] = out;
+    }
+}
+
+/*
+ * Get source row sy scaled across, without evicting row keep
+ */
+static const uint32_t *across_cached(const gfx_image_t *image, int src_x, int src_y,
+                                     int src_w, int sy, int keep, int count) {
+    int slot;
+    
+    if (across_y[0] == sy) return across[0];
+    if (across_y[1] == sy) return across[1];
+    
+    slot = across_y[0] == keep ? 1 : 0;
+    across_row(across[slot], get_source_row(image, src_x, src_y + sy, src_w, src_w < 2),
+               count);
+    across_y[slot] = sy;
+    return across[slot];
+}
+
+/*
+ * Position of output pixel i in the source, 16.16
+ * Pixel centers are mapped onto pixel centers; bilinear positions are
+ * shifted half a pixel so the weight is that of the next pixel.
+ */
+static int source_position(int i, uint32_t step, int filter) {
+    int pos = (int)(i * step + step / 2);
+    
+    if (filter == GFX_SCALE_BILINEAR) {
+        pos -= 0x8000;
+        if (pos < 0) pos = 0;
+    }
+    return pos;
+}
+
+/*
+ * Scale a rectangle of an image onto the draw target
+ */
+int gfx_blit_scaled(const gfx_image_t *image, int src_x, int src_y, int src_w, int src_h,
+                    int x, int y, int width, int height, int filter) {
+    gfx_pixel_t *pixels;
+    uint32_t step_x, step_y;
+    int cx1, cy1, cx2, cy2;
+    int first_x, first_y, count, rows;
+    int pitch, prev_sy, i, j;
+    
+    if (format_bytes(image->format) == 0) return -1;
+    
+    /* Cut the source rectangle to the image */
+    if (src_x < 0) { src_w += src_x; src_x = 0; }
+    if (src_y < 0) { src_h += src_y; src_y = 0; }
+    if (src_x + src_w > image->width) src_w = image->width - src_x;
+    if (src_y + src_h > image->height) src_h = image->height - src_y;
+    if (src_w <= 0 || src_h <= 0 || width <= 0 || height <= 0) return 0;
+    if (src_w > GFX_SCALE_MAX_WIDTH || src_h > GFX_SCALE_MAX_HEIGHT ||
+        height > GFX_SCALE_MAX_HEIGHT) {
+        return -1;
+    }
+    
+    step_x = ((uint32_t)src_w << 16) / (uint32_t)width;
+    step_y = ((uint32_t)src_h << 16) / (uint32_t)height;
+    
+    /* Clip the destination; the scale stays that of the whole rectangle */
+    gfx_get_clip(&cx1, &cy1, &cx2, &cy2);
+    first_x = x < cx1 ? cx1 - x : 0;
+    first_y = y < cy1 ? cy1 - y : 0;
+    count = (x + width - 1 > cx2 ? cx2 - x + 1 : width) - first_x;
+    rows = (y + height - 1 > cy2 ? cy2 - y + 1 : height) - first_y;
+    if (count <= 0 || rows <= 0) return 0;
+    if (count > GFX_MAX_WIDTH) return -1;
+    
+    /* Source column and weight per destination column */
+    for (i = 0; i < count; i++) {
+        int pos = source_position(first_x + i, step_x, filter);
+        int sx = pos >> 16;
+        int w = (pos >> 8) & 0xFF;
+        
+        if (filter == GFX_SCALE_BILINEAR && sx >= src_w - 1) {
+            /* Past the last center: all of the last pixel */
+            sx = src_w >= 2 ? src_w - 2 : 0;
+            w = src_w >= 2 ? 256 : 0;
+        }
+        column_x[i] = sx;
+        column_w[i * 4] = column_w[i * 4 + 1] = column_w[i * 4 + 2] = column_w[i * 4 + 3] =
+            (uint16_t)w;
+    }
+    
+    pitch = gfx_get_buffer_pitch();
+    pixels = gfx_get_double_buffer() + (y + first_y) * pitch + x + first_x;
+    prev_sy = -1;
+    across_y[0] = across_y[1] = -1;
+    
+    for (j = 0; j < rows; j++) {
+        int pos = source_position(first_y + j, step_y, filter);
+        int sy = pos >> 16;
+        gfx_pixel_t *dst = pixels + j * pitch;
+        
+        if (filter == GFX_SCALE_BILINEAR) {
+            int w = (pos >> 8) & 0xFF;
+            int sy2 = sy + 1 < src_h ? sy + 1 : sy;
+            const uint32_t *top = across_cached(image, src_x, src_y, src_w, sy, sy2, count);
+            const uint32_t *bottom = across_cached(image, src_x, src_y, src_w, sy2, sy, count);
+            
+#ifdef GFX_BACKBUFFER_16
+            down_row(out_row, top, bottom, count, w);
+            pixfmt_get(16)->blit_row(dst, out_row, count);
+#else
+            down_row(dst, top, bottom, count, w);
+#endif
+        } else if (sy == prev_sy) {
+            /* Enlarging: the row is the one above again */
+            memcpy(dst, dst - pitch, count * sizeof(gfx_pixel_t));
+        } else if (step_x == 0x10000 &&
+                   (image->format == GFX_FORMAT_BACKBUFFER || sizeof(gfx_pixel_t) == 4)) {
+            /* Same width: a converting copy straight into the target */
+            const uint8_t *src = (const uint8_t *)image->pixels + (src_y + sy) * image->pitch +
+                                 (src_x + first_x) * format_bytes(image->format);
+#ifdef GFX_BACKBUFFER_16
+            memcpy(dst, src, count * sizeof(gfx_pixel_t));
+#else
+            gfx_convert_to_xrgb(dst, src, image->format, count);
+#endif
+        } else {
+            const uint32_t *src = get_source_row(image, src_x, src_y + sy, src_w, 0);
+#ifdef GFX_BACKBUFFER_16
+            nearest_row(out_row, src, count);
+            pixfmt_get(16)->blit_row(dst, out_row, count);
+#else
+            nearest_row(dst, src, count);
+#endif
+        }
+        prev_sy = sy;
+    }
+    
+    gfx_mark_dirty_rect(x + first_x, y + first_y, count, rows);
+    return 0;
+}
+
+/*
+ * Largest rectangle of an image's aspect ratio inside another, centered
+ */
+void gfx_fit_rect(int src_w, int src_h, int *x, int *y, int *width, int *height) {
+    int w = *width;
+    int h = *height;
+    
+    /* Compare width / height ratios without dividing */
+    if ((uint32_t)src_w * (uint32_t)h > (uint32_t)src_h * (uint32_t)w) {
+        h = (int)((uint32_t)src_h * (uint32_t)w / (uint32_t)src_w);
+        if (h < 1) h = 1;
+    } else {
+        w = (int)((uint32_t)src_w * (uint32_t)h / (uint32_t)src_h);
+        if (w < 1) w = 1;
+    }
+    *x += (*width - w) / 2;
+    *y += (*height - h) / 2;
+    *width = w;
+    *height = h;
+}
+
+/*
+ * Scale a whole image into a rectangle, keeping the aspect ratio
+ */
+int gfx_blit_fit(const gfx_image_t *image, int x, int y, int width, int height, int filter) {
+    if (image->width <= 0 || image->height <= 0) return 0;
+    
+    gfx_fit_rect(image->width, image->height, &x, &y, &width, &height);
+    return gfx_blit_scaled(image, 0, 0, image->width, image->height, x, y, width, height, filter);
+}
+
+/*
+ * Scale part of a surface onto the draw target
+ */
+int gfx_blit_surface_scaled(const gfx_surface_t *src, int src_x, int src_y, int src_w, int src_h,
+                            int x, int y, int width, int height, int filter) {
+    gfx_image_t image;
+    
+    image.pixels = src->pixels;
+    image.format = GFX_FORMAT_BACKBUFFER;
+    image.width = src->width;
+    image.height = src->height;
+    image.pitch = src->pitch * (int)sizeof(gfx_pixel_t);
+    return gfx_blit_scaled(&image, src_x, src_y, src_w, src_h, x, y, width, height, filter);
+}
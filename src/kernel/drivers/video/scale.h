@@ -0,0 +1,68 @@
+/*
+ * scale.h - Image scaling and pixel format conversion header
+ * version 0.0.2
+ * Blits images of any supported format to the draw target at any size
+ */
+
+#ifndef SCALE_H
+#define SCALE_H
+
+#include "../../stdint.h"
+#include "graphics.h"
+
+/* Image pixel formats */
+#define GFX_FORMAT_XRGB8888  0    /* 32-bit, alpha byte ignored */
+#define GFX_FORMAT_RGB565    1    /* 16-bit */
+#define GFX_FORMAT_BGR888    2    /* 3 bytes: blue, green, red (BMP, 24 bpp modes) */
+#define GFX_FORMAT_GRAY8     3    /* 1 byte of luma */
+
+/* Format of the back buffer and of surfaces */
+#ifdef GFX_BACKBUFFER_16
+#define GFX_FORMAT_BACKBUFFER GFX_FORMAT_RGB565
+#else
+#define GFX_FORMAT_BACKBUFFER GFX_FORMAT_XRGB8888
+#endif
+
+/* Scaling filters */
+#define GFX_SCALE_NEAREST    0
+#define GFX_SCALE_BILINEAR   1
+
+/* Widest source and tallest source or destination accepted */
+#define GFX_SCALE_MAX_WIDTH  4096
+#define GFX_SCALE_MAX_HEIGHT 16384
+
+/* An image in memory; the pixels belong to the caller */
+typedef struct {
+    const void *pixels;
+    int format;                 /* GFX_FORMAT_* */
+    int width;
+    int height;
+    int pitch;                  /* In bytes */
+} gfx_image_t;
+
+/* Convert count pixels of an image format to XRGB8888 and back
+ * Gray is taken as Y = (77 R + 150 G + 29 B + 128) / 256 */
+void gfx_convert_to_xrgb(uint32_t *dst, const void *src, int format, int count);
+void gfx_convert_from_xrgb(void *dst, const uint32_t *src, int format, int count);
+
+/* Scale the src_w x src_h rectangle at src_x, src_y of an image to
+ * width x height at x, y on the draw target, converting to the back
+ * buffer format on the way. The source rectangle is cut to the image
+ * and the destination clipped; clipping does not change the scale.
+ * Returns 0, or -1 for an unknown format or a source too large */
+int gfx_blit_scaled(const gfx_image_t *image, int src_x, int src_y, int src_w, int src_h,
+                    int x, int y, int width, int height, int filter);
+
+/* Shrink width x height at x, y to the largest rectangle with the
+ * aspect ratio of a src_w x src_h image, centered in it */
+void gfx_fit_rect(int src_w, int src_h, int *x, int *y, int *width, int *height);
+
+/* Scale a whole image to fit a rectangle, keeping its aspect ratio and
+ * centering it. Returns as gfx_blit_scaled */
+int gfx_blit_fit(const gfx_image_t *image, int x, int y, int width, int height, int filter);
+
+/* Scale part of a surface to width x height at x, y on the draw target */
+int gfx_blit_surface_scaled(const gfx_surface_t *src, int src_x, int src_y, int src_w, int src_h,
+                            int x, int y, int width, int height, int filter);
+
+#endif /* SCALE_H */
@@ -0,0 +1,793 @@
+/*
+ * gfxbench.c - Graphics benchmark implementation
+ * version 0.0.12
+ * Suite: fixed workloads (clear, random rects, copy, keyed sprites, text
+ * flood, scroll storm, escape sequence screen redraw, partial swaps,
+ * QOI screenshot encode, bilinear upscale of an RGB565 image), each timed
+ * with the TSC over N iterations and reported as min/median/max, MB/s,
+ * ns/pixel and fps
+ * Comparisons: glyph rendering strategies, console print cost for the
+ * writer under each flush policy, the circle and particle demos
+ * unpaced, and a scene of overlapping windows immediately and through
+ * the display list
+ */
+
+#include "gfxbench.h"
+#include "drivers/video/fb_console.h"
+#include "drivers/video/graphics.h"
+#include "drivers/video/raster.h"
+#include "drivers/video/displist.h"
+#include "drivers/video/scale.h"
+#include "drivers/serial/serial.h"
+#include "demo.h"
+#include "image.h"
+#include "timer.h"
+#include "utils.h"
+#include "stdint.h"
+
+/* Full screens of text drawn per measurement */
+#define TEXT_PASSES 4
+
+/* Lines printed per flush policy */
+#define PRINT_LINES   100
+
+/* Frames of the circle animation per run */
+#define CIRCLE_FRAMES 400
+
+/* Frames of the particle fountain per run */
+#define PARTICLE_FRAMES 200
+
+/* Scene frames per renderer, and windows per scene */
+#define SCENE_FRAMES  20
+#define SCENE_WINDOWS 12
+
+/* Suite: random rects per iteration, and their seed */
+#define RECT_COUNT    256
+#define RECT_SEED     12345
+
+/* Suite: sprite edge in pixels, and sprites per iteration */
+#define SPRITE_SIZE   32
+#define SPRITE_COUNT  256
+
+/* Suite: dirty rectangles per partial swap */
+#define SWAP_RECTS    8
+
+/* Suite: RGB565 image scaled to the whole screen */
+#define SCALE_WIDTH   320
+#define SCALE_HEIGHT  240
+
+/* Pixels in a console cell (8x8 font plus spacing rows) */
+#define CELL_PIXELS   (8 * 12)
+
+/* Suite workload: run() does one timed iteration and returns the
+ * pixels it updated; to_screen if they are framebuffer pixels */
+typedef struct {
+    const char *name;
+    uint32_t (*run)(int iteration);
+    int to_screen;
+} workload_t;
+
+/* Suite results of one workload, in nanoseconds */
+typedef struct {
+    uint32_t min_ns;
+    uint32_t median_ns;
+    uint32_t max_ns;
+    uint32_t pixels;
+    uint32_t bytes;
+} result_t;
+
+/* Strategy names, indexed by FB_RENDER_* */
+static const char *mode_names[] = {
+    "auto  ",
+    "scalar",
+    "cached",
+    "simd  "
+};
+
+static uint32_t lcg_state;
+
+/* Sprite for the sprites workload; 0 is transparent */
+static gfx_pixel_t sprite[SPRITE_SIZE * SPRITE_SIZE];
+static int sprite_ready = 0;
+
+/* Source image for the scale workload */
+static uint16_t scale_source[SCALE_WIDTH * SCALE_HEIGHT];
+static int scale_ready = 0;
+
+static uint32_t lcg_next(void) {
+    lcg_state = lcg_state * 1103515245 + 12345;
+    return lcg_state >> 8;
+}
+
+/*
+ * Workload: clear the whole back buffer
+ */
+static uint32_t run_clear(int iteration) {
+    gfx_clear(gfx_hsv(iteration * 23, 255, 160));
+    return (uint32_t)(gfx_get_width() * gfx_get_height());
+}
+
+/*
+ * Workload: RECT_COUNT random rectangles, the same ones every time
+ */
+static uint32_t run_rects(int iteration) {
+    int width = gfx_get_width();
+    int height = gfx_get_height();
+    uint32_t pixels = 0;
+    int i;
+    
+    lcg_state = RECT_SEED;
+    for (i = 0; i < RECT_COUNT; i++) {
+        int x = lcg_next() % width;
+        int y = lcg_next() % height;
+        int w = 8 + lcg_next() % (width / 4);
+        int h = 8 + lcg_next() % (height / 4);
+        
+        gfx_fill_rect(x, y, w, h, gfx_hsv((i + iteration) * 7, 200, 220));
+        if (x + w > width) w = width - x;
+        if (y + h > height) h = height - y;
+        pixels += (uint32_t)(w * h);
+    }
+    return pixels;
+}
+
+/*
+ * Workload: move the screen up by one text row (gfx_copy_rect)
+ */
+static uint32_t run_copy(int iteration) {
+    int width = gfx_get_width();
+    int height = gfx_get_height();
+    
+    (void)iteration;
+    gfx_copy_rect(0, 12, 0, 0, width, height - 12);
+    return (uint32_t)(width * (height - 12));
+}
+
+/*
+ * Workload: SPRITE_COUNT color-keyed sprites (gfx_blit_key)
+ */
+static uint32_t run_sprites(int iteration) {
+    int width = gfx_get_width() - SPRITE_SIZE;
+    int height = gfx_get_height() - SPRITE_SIZE;
+    int r = SPRITE_SIZE / 2;
+    int i, x, y;
+    
+    if (!sprite_ready) {
+        /* A shaded disc on a transparent square */
+        for (y = 0; y < SPRITE_SIZE; y++) {
+            for (x = 0; x < SPRITE_SIZE; x++) {
+                int dx = x - r, dy = y - r;
+                int d2 = dx * dx + dy * dy;
+                sprite[y * SPRITE_SIZE + x] = d2 < r * r ?
+                    (gfx_pixel_t)gfx_rgb(255 - d2 / 2, 96 + x * 4, 64 + y * 4) : 0;
+            }
+        }
+        sprite_ready = 1;
+    }
+    
+    lcg_state = RECT_SEED + iteration;
+    for (i = 0; i < SPRITE_COUNT; i++) {
+        x = lcg_next() % width;
+        y = lcg_next() % height;
+        gfx_blit_key(sprite, SPRITE_SIZE, 0, 0, SPRITE_SIZE, SPRITE_SIZE, x, y, 0);
+    }
+    return SPRITE_COUNT * SPRITE_SIZE * SPRITE_SIZE;
+}
+
+/*
+ * Workload: draw every console cell (draw_char path)
+ */
+static uint32_t run_text(int iteration) {
+    int cols = fb_console_cols();
+    int rows = fb_console_rows();
+    int x, y;
+    
+    for (y = 0; y < rows; y++) {
+        for (x = 0; x < cols; x++) {
+            fb_draw_glyph((char)(33 + (x + y + iteration) % 94), x, y);
+        }
+    }
+    return (uint32_t)(cols * rows * CELL_PIXELS);
+}
+
+/*
+ * Workload: print a screenful of full lines, scrolling each one in,
+ * and present it
+ */
+static uint32_t run_scroll(int iteration) {
+    static char line[GFX_MAX_WIDTH / 8 + 1];
+    int cols = fb_console_cols();
+    int rows = fb_console_rows();
+    int x, y;
+    
+    for (y = 0; y < rows; y++) {
+        for (x = 0; x < cols - 1; x++) {
+            line[x] = (char)(33 + (x + y + iteration) % 94);
+        }
+        line[cols - 1] = '\n';
+        fb_write(line, cols);
+    }
+    fb_flush();
+    return (uint32_t)(gfx_get_width() * gfx_get_height());
+}
+
+/*
+ * Append a decimal number to a byte buffer
+ */
+static int put_decimal(char *buf, int n, int value) {
+    if (value >= 10) {
+        n = put_decimal(buf, n, value / 10);
+    }
+    buf[n++] = (char)('0' + value % 10);
+    return n;
+}
+
+/*
+ * Workload: redraw the whole console the way a full-screen text program
+ * does, with a cursor position per row and a color change every 8
+ * cells, in one write
+ */
+static uint32_t run_tui(int iteration) {
+    static char screen[(GFX_MAX_HEIGHT / 12) * (GFX_MAX_WIDTH / 8 * 2 + 16)];
+    int cols = fb_console_cols();
+    int rows = fb_console_rows();
+    int n = 0;
+    int x, y;
+    
+    for (y = 0; y < rows; y++) {
+        screen[n++] = 0x1B;
+        screen[n++] = '[';
+        n = put_decimal(screen, n, y + 1);
+        screen[n++] = 'H';
+        for (x = 0; x < cols; x++) {
+            if ((x & 7) == 0) {
+                screen[n++] = 0x1B;
+                screen[n++] = '[';
+                screen[n++] = '3';
+                screen[n++] = (char)('1' + (x / 8 + y + iteration) % 7);
+                screen[n++] = 'm';
+            }
+            screen[n++] = (char)(33 + (x + y + iteration) % 94);
+        }
+    }
+    screen[n++] = 0x1B;
+    screen[n++] = '[';
+    screen[n++] = 'm';
+    fb_write(screen, n);
+    fb_flush();
+    return (uint32_t)(cols * rows * CELL_PIXELS);
+}
+
+/*
+ * Workload: present SWAP_RECTS window-sized dirty rectangles
+ * The swap converts their bounding box.
+ */
+static uint32_t run_swap(int iteration) {
+    int width = gfx_get_width();
+    int height = gfx_get_height();
+    int x1 = width, y1 = height, x2 = 0, y2 = 0;
+    int i;
+    
+    lcg_state = RECT_SEED + iteration;
+    for (i = 0; i < SWAP_RECTS; i++) {
+        int w = width / 8;
+        int h = height / 8;
+        int x = lcg_next() % (width / 2);
+        int y = lcg_next() % (height / 2);
+        
+        gfx_mark_dirty_rect(x, y, w, h);
+        if (x < x1) x1 = x;
+        if (y < y1) y1 = y;
+        if (x + w > x2) x2 = x + w;
+        if (y + h > y2) y2 = y + h;
+    }
+    gfx_swap_buffers();
+    return (uint32_t)((x2 - x1) * (y2 - y1));
+}
+
+/*
+ * Workload: encode the whole back buffer, as left by the workloads
+ * before it, to QOI without storing the output
+ */
+static int discard_output(const void *data, uint32_t len, void *arg) {
+    (void)data;
+    (void)len;
+    (void)arg;
+    return 0;
+}
+
+static uint32_t run_qoi(int iteration) {
+    int width = gfx_get_width();
+    int height = gfx_get_height();
+    gfx_surface_t *saved = gfx_set_target((gfx_surface_t *)0);
+    image_info_t info;
+    
+    (void)iteration;
+    image_encode(IMAGE_QOI, gfx_get_double_buffer(), gfx_get_buffer_pitch(), width, height,
+                 discard_output, (void *)0, &info);
+    gfx_set_target(saved);
+    return (uint32_t)(width * height);
+}
+
+/*
+ * Workload: bilinear scale of an RGB565 image to the whole screen
+ */
+static uint32_t run_scale(int iteration) {
+    static uint32_t row[SCALE_WIDTH];
+    gfx_image_t image;
+    int x, y;
+    
+    (void)iteration;
+    if (!scale_ready) {
+        /* Gradients with a checker, so both filter axes have edges */
+        for (y = 0; y < SCALE_HEIGHT; y++) {
+            for (x = 0; x < SCALE_WIDTH; x++) {
+                row[x] = ((x >> 4) ^ (y >> 4)) & 1 ? 0x00FFFFFF :
+                         ((uint32_t)(x * 255 / SCALE_WIDTH) << 16) |
+                         ((uint32_t)(y * 255 / SCALE_HEIGHT) << 8) | 0x80;
+            }
+            gfx_convert_from_xrgb(scale_source + y * SCALE_WIDTH, row, GFX_FORMAT_RGB565,
+                                  SCALE_WIDTH);
+        }
+        scale_ready = 1;
+    }
+    
+    image.pixels = scale_source;
+    image.format = GFX_FORMAT_RGB565;
+    image.width = SCALE_WIDTH;
+    image.height = SCALE_HEIGHT;
+    image.pitch = SCALE_WIDTH * 2;
+    gfx_blit_scaled(&image, 0, 0, SCALE_WIDTH, SCALE_HEIGHT,
+                    0, 0, gfx_get_width(), gfx_get_height(), GFX_SCALE_BILINEAR);
+    return (uint32_t)(gfx_get_width() * gfx_get_height());
+}
+
+static const workload_t workloads[] = {
+    {"clear",   run_clear,   0},
+    {"rects",   run_rects,   0},
+    {"copy",    run_copy,    0},
+    {"sprites", run_sprites, 0},
+    {"text",    run_text,    0},
+    {"scroll",  run_scroll,  1},
+    {"tui",     run_tui,     1},
+    {"swap",    run_swap,    1},
+    {"qoi",     run_qoi,     0},
+    {"scale",   run_scale,   0},
+};
+#define WORKLOAD_COUNT ((int)(sizeof(workloads) / sizeof(workloads[0])))
+
+/*
+ * Run one workload and reduce its timings
+ */
+static void bench_workload(const workload_t *w, int iterations, result_t *result) {
+    static uint32_t ns[GFXBENCH_MAX_ITERATIONS];
+    uint32_t khz = timer_tsc_khz();
+    int bytes = w->to_screen ? gfx_get_bpp() / 8 : (int)sizeof(gfx_pixel_t);
+    int i, j;
+    
+    /* One untimed pass warms caches and settles the console */
+    result->pixels = w->run(0);
+    fb_flush();
+    
+    for (i = 0; i < iterations; i++) {
+        unsigned long long start = rdtsc();
+        uint32_t cycles;
+        
+        w->run(i + 1);
+        cycles = (uint32_t)(rdtsc() - start);
+        ns[i] = khz ? mul_div(cycles, 1000000, khz) : cycles;
+    }
+    
+    /* Insertion sort for the median */
+    for (i = 1; i < iterations; i++) {
+        uint32_t v = ns[i];
+        for (j = i; j > 0 && ns[j - 1] > v; j--) {
+            ns[j] = ns[j - 1];
+        }
+        ns[j] = v;
+    }
+    
+    result->min_ns = ns[0];
+    result->median_ns = ns[iterations / 2];
+    result->max_ns = ns[iterations - 1];
+    result->bytes = result->pixels * bytes;
+}
+
+/* Output line being built */
+static char line_buf[192];
+static int line_len;
+
+static void line_str(const char *s) {
+    while (*s && line_len < (int)sizeof(line_buf) - 1) {
+        line_buf[line_len++] = *s++;
+    }
+    line_buf[line_len] = '\0';
+}
+
+/*
+ * Append an unsigned number, right-aligned in width characters
+ */
+static void line_uint(uint32_t v, int width) {
+    char digits[10];
+    int n = 0;
+    
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    
+    while (width-- > n) {
+        line_str(" ");
+    }
+    while (n > 0 && line_len < (int)sizeof(line_buf) - 1) {
+        line_buf[line_len++] = digits[--n];
+    }
+    line_buf[line_len] = '\0';
+}
+
+/*
+ * Append hundredths as a decimal number, right-aligned
+ */
+static void line_fixed2(uint32_t hundredths, int width) {
+    char frac[4];
+    
+    line_uint(hundredths / 100, width > 3 ? width - 3 : 0);
+    frac[0] = '.';
+    frac[1] = (char)('0' + (hundredths / 10) % 10);
+    frac[2] = (char)('0' + hundredths % 10);
+    frac[3] = '\0';
+    line_str(frac);
+}
+
+/*
+ * Append spaces up to a column
+ */
+static void line_pad(int column) {
+    while (line_len < column) {
+        line_str(" ");
+    }
+}
+
+/*
+ * Append " key=value"
+ */
+static void line_key(const char *key, uint32_t v) {
+    line_str(" ");
+    line_str(key);
+    line_str("=");
+    line_uint(v, 0);
+}
+
+/*
+ * Run the workload suite and print results
+ */
+void gfxbench_run(int iterations) {
+    static result_t results[sizeof(workloads) / sizeof(workloads[0])];
+    uint32_t khz = timer_tsc_khz();
+    int i;
+    
+    if (iterations <= 0) iterations = GFXBENCH_ITERATIONS;
+    if (iterations > GFXBENCH_MAX_ITERATIONS) iterations = GFXBENCH_MAX_ITERATIONS;
+    
+    /* The timer tick must not present the console mid-workload */
+    gfx_acquire();
+    for (i = 0; i < WORKLOAD_COUNT; i++) {
+        bench_workload(&workloads[i], iterations, &results[i]);
+    }
+    gfx_release();
+    fb_console_clear();
+    
+    line_len = 0;
+    line_str("GFXBENCH begin version=1");
+    line_key("iters", iterations);
+    line_key("width", gfx_get_width());
+    line_key("height", gfx_get_height());
+    line_key("bpp", gfx_get_bpp());
+    line_key("buffer_bpp", GFX_BUFFER_BPP);
+    line_key("present", gfx_get_present_mode());
+    line_key("tsc_khz", khz);
+    line_str("\n");
+    serial_print(line_buf);
+    
+    fb_print("Graphics suite: ");
+    fb_print_int(iterations);
+    fb_print(" iterations, ");
+    fb_print_int(gfx_get_width());
+    fb_putchar('x');
+    fb_print_int(gfx_get_height());
+    fb_putchar('x');
+    fb_print_int(gfx_get_bpp());
+    if (khz) {
+        fb_print(", TSC ");
+        fb_print_int((int)(khz / 1000));
+        fb_print(" MHz\n");
+    } else {
+        fb_print(", TSC not calibrated: times are cycles\n");
+    }
+    fb_print("  workload  min us  med us  max us     MB/s  ns/px     fps\n");
+    
+    for (i = 0; i < WORKLOAD_COUNT; i++) {
+        const result_t *r = &results[i];
+        uint32_t mbps = mul_div(r->bytes, 1000, r->median_ns);
+        uint32_t ns_px = mul_div(r->median_ns, 100, r->pixels);
+        uint32_t fps = r->median_ns ? 1000000000u / r->median_ns : 0;
+        
+        line_len = 0;
+        line_str("  ");
+        line_str(workloads[i].name);
+        line_pad(10);
+        line_uint(r->min_ns / 1000, 8);
+        line_uint(r->median_ns / 1000, 8);
+        line_uint(r->max_ns / 1000, 8);
+        line_uint(mbps, 9);
+        line_fixed2(ns_px, 7);
+        line_uint(fps, 8);
+        line_str("\n");
+        fb_print(line_buf);
+        
+        line_len = 0;
+        line_str("GFXBENCH name=");
+        line_str(workloads[i].name);
+        line_key("iters", iterations);
+        line_key("min_ns", r->min_ns);
+        line_key("median_ns", r->median_ns);
+        line_key("max_ns", r->max_ns);
+        line_key("pixels", r->pixels);
+        line_key("bytes", r->bytes);
+        line_key("mbps", mbps);
+        line_key("ns_px_x100", ns_px);
+        line_key("fps", fps);
+        line_str("\n");
+        serial_print(line_buf);
+    }
+    
+    serial_print("GFXBENCH end\n");
+    if (serial_available()) {
+        fb_print("Results also sent to COM1\n");
+    }
+}
+
+/*
+ * Fully saturated hue h (0-359) as XRGB8888, the format
+ * fb_set_text_color takes whatever the back buffer format
+ */
+static uint32_t hue_xrgb(int h) {
+    uint32_t ramp = (uint32_t)((h % 60) * 255 / 60);
+    
+    switch ((h % 360) / 60) {
+        case 0:  return 0x00FF0000 | (ramp << 8);
+        case 1:  return 0x0000FF00 | ((255 - ramp) << 16);
+        case 2:  return 0x0000FF00 | ramp;
+        case 3:  return 0x000000FF | ((255 - ramp) << 8);
+        case 4:  return 0x000000FF | (ramp << 16);
+        default: return 0x00FF0000 | (255 - ramp);
+    }
+}
+
+/*
+ * Draw TEXT_PASSES screens of text and return cycles per character
+ * If churn is set, the color pair changes every 8 characters
+ */
+static uint32_t bench_text(int mode, int churn) {
+    int cols = fb_console_cols();
+    int rows = fb_console_rows();
+    int pass, x, y;
+    int n = 0;
+    unsigned long long start, end;
+    
+    fb_set_render_mode(mode);
+    fb_set_text_color(0x00FFFFFF, 0x00000000);
+    
+    start = rdtsc();
+    for (pass = 0; pass < TEXT_PASSES; pass++) {
+        for (y = 0; y < rows; y++) {
+            for (x = 0; x < cols; x++) {
+                if (churn && (n & 7) == 0) {
+                    fb_set_text_color(hue_xrgb((n >> 3) * 7), 0x00000000);
+                }
+                fb_draw_glyph((char)(33 + (n % 94)), x, y);
+                n++;
+            }
+        }
+    }
+    end = rdtsc();
+    
+    return (uint32_t)(end - start) / (uint32_t)n;
+}
+
+/*
+ * Print PRINT_LINES lines under a flush policy and return the writer's
+ * cycles per line; rendering left to a flush after the timing counts
+ * only where the policy defers it
+ */
+static uint32_t bench_print(int flush_mode) {
+    int saved = fb_get_flush_mode();
+    unsigned long long start, end;
+    int i;
+    
+    fb_set_flush_mode(flush_mode);
+    start = rdtsc();
+    for (i = 0; i < PRINT_LINES; i++) {
+        fb_print("The quick brown fox jumps over the lazy dog 0123456789 ~!@#$%\n");
+    }
+    end = rdtsc();
+    fb_flush();
+    fb_set_flush_mode(saved);
+    
+    return (uint32_t)(end - start) / PRINT_LINES;
+}
+
+/*
+ * Draw a desktop of overlapping windows, immediately or recorded
+ * Each window is a frame, a title bar, lines of text and a few
+ * circles; later windows cover most of the earlier ones.
+ */
+static void draw_scene(int frame, int deferred) {
+    int w, line, i;
+    int width = gfx_get_width();
+    int height = gfx_get_height();
+    
+    if (deferred) {
+        dl_fill_rect(0, 0, width, height, gfx_rgb(0, 64, 96));
+    } else {
+        gfx_fill_rect(0, 0, width, height, gfx_rgb(0, 64, 96));
+    }
+    
+    for (w = 0; w < SCENE_WINDOWS; w++) {
+        int x = (w * 53 + frame * 3) % (width / 2);
+        int y = (w * 37) % (height / 2);
+        int ww = width / 2;
+        int wh = height / 2;
+        uint32_t body = gfx_hsv(w * 30, 40, 230);
+        uint32_t title = gfx_hsv(w * 30, 200, 160);
+        
+        if (deferred) {
+            dl_fill_rect(x, y, ww, wh, body);
+            dl_fill_rect(x, y, ww, 12, title);
+            dl_text(x + 4, y + 2, "window", 0x00FFFFFF);
+            for (line = 0; line < 16; line++) {
+                dl_text(x + 8, y + 20 + line * 10, "The quick brown fox jumps over", 0);
+            }
+            for (i = 0; i < 3; i++) {
+                dl_fill_circle(x + 60 + i * 100, y + wh - 50, 30, title);
+                dl_draw_line(x, y + wh - 1, x + ww - 1, y + 12, title);
+            }
+        } else {
+            gfx_fill_rect(x, y, ww, wh, body);
+            gfx_fill_rect(x, y, ww, 12, title);
+            fb_draw_text(x + 4, y + 2, "window", 0x00FFFFFF);
+            for (line = 0; line < 16; line++) {
+                fb_draw_text(x + 8, y + 20 + line * 10, "The quick brown fox jumps over", 0);
+            }
+            for (i = 0; i < 3; i++) {
+                gfx_fill_circle(x + 60 + i * 100, y + wh - 50, 30, title);
+                gfx_draw_line(x, y + wh - 1, x + ww - 1, y + 12, title);
+            }
+        }
+    }
+}
+
+/*
+ * Draw SCENE_FRAMES frames of the scene, return cycles per frame
+ */
+static uint32_t bench_scene(int deferred) {
+    unsigned long long start, end;
+    int frame;
+    
+    start = rdtsc();
+    for (frame = 0; frame < SCENE_FRAMES; frame++) {
+        if (deferred) {
+            dl_begin();
+            draw_scene(frame, 1);
+            dl_flush();
+        } else {
+            draw_scene(frame, 0);
+        }
+    }
+    end = rdtsc();
+    
+    return (uint32_t)(end - start) / SCENE_FRAMES;
+}
+
+/*
+ * Print num / den with two decimals
+ */
+static void print_ratio(uint32_t num, uint32_t den) {
+    uint32_t hundredths;
+    
+    if (den == 0) {
+        fb_print("-");
+        return;
+    }
+    while (den >= 0x1000000) {
+        num >>= 1;
+        den >>= 1;
+    }
+    hundredths = num / den * 100 + (num % den) * 100 / den;
+    fb_print_int(hundredths / 100);
+    fb_putchar('.');
+    fb_putchar('0' + (hundredths / 10) % 10);
+    fb_putchar('0' + hundredths % 10);
+}
+
+/*
+ * Run renderer comparisons and print results
+ */
+void gfxbench_compare(void) {
+    static uint32_t steady[4];
+    static uint32_t churn[4];
+    static uint32_t print_cycles[3];
+    demo_stats_t circle;
+    demo_stats_t particles;
+    dl_stats_t scene;
+    uint32_t immediate_cycles, deferred_cycles;
+    int saved_mode = fb_get_render_mode();
+    int mode, i;
+    
+    /* The timer tick must not present the console mid-measurement */
+    gfx_acquire();
+    for (mode = FB_RENDER_AUTO; mode <= FB_RENDER_SIMD; mode++) {
+        steady[mode] = bench_text(mode, 0);
+        churn[mode] = bench_text(mode, 1);
+    }
+    
+    fb_set_render_mode(saved_mode);
+    for (i = FB_FLUSH_IMMEDIATE; i <= FB_FLUSH_QUEUED; i++) {
+        print_cycles[i] = bench_print(i);
+    }
+    demo_rainbow_circle_bench(CIRCLE_FRAMES, &circle);
+    demo_particles(DEMO_PARTICLES, PARTICLE_FRAMES, &particles);
+    
+    immediate_cycles = bench_scene(0);
+    dl_reset_stats();
+    deferred_cycles = bench_scene(1);
+    dl_get_stats(&scene);
+    gfx_release();
+    
+    fb_set_text_color(0x00FFFFFF, 0x00000000);
+    fb_console_clear();
+    
+    fb_print("Glyph rendering (cycles per character):\n");
+    fb_print("  mode    steady  color-churn\n");
+    for (mode = FB_RENDER_AUTO; mode <= FB_RENDER_SIMD; mode++) {
+        fb_print("  ");
+        fb_print(mode_names[mode]);
+        fb_print("  ");
+        fb_print_int(steady[mode]);
+        fb_print("\t");
+        fb_print_int(churn[mode]);
+        fb_putchar('\n');
+    }
+    
+    fb_print("Console print (writer cycles per line):\n  immediate ");
+    fb_print_int(print_cycles[FB_FLUSH_IMMEDIATE]);
+    fb_print("  deferred ");
+    fb_print_int(print_cycles[FB_FLUSH_DEFERRED]);
+    fb_print("  queued ");
+    fb_print_int(print_cycles[FB_FLUSH_QUEUED]);
+    fb_putchar('\n');
+    
+    fb_print("Circle animation (unpaced):\n  ");
+    demo_print_stats(&circle);
+    
+    fb_print("Particle fountain (unpaced):\n  ");
+    demo_print_stats(&particles);
+    
+    fb_print("Window scene (cycles per frame):\n  immediate ");
+    fb_print_int(immediate_cycles);
+    fb_print("\n  display list ");
+    fb_print_int(deferred_cycles);
+    fb_print("\n  ops ");
+    fb_print_int(scene.ops / SCENE_FRAMES);
+    fb_print(", tile refs ");
+    fb_print_int(scene.binned / SCENE_FRAMES);
+    fb_print(", culled ");
+    fb_print_int(scene.culled / SCENE_FRAMES);
+    fb_print("\n  pixels written ");
+    fb_print_int(scene.pixels / SCENE_FRAMES);
+    fb_print(", skipped ");
+    fb_print_int(scene.culled_pixels / SCENE_FRAMES);
+    fb_print(", overdraw ");
+    print_ratio(scene.pixels, scene.covered);
+    fb_putchar('\n');
+}
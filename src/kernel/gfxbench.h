@@ -0,0 +1,22 @@
+/*
+ * gfxbench.h - Graphics benchmark header
+ * version 0.0.4
+ */
+
+#ifndef GFXBENCH_H
+#define GFXBENCH_H
+
+/* Iterations of each suite workload */
+#define GFXBENCH_ITERATIONS     16      /* Default */
+#define GFXBENCH_MAX_ITERATIONS 64
+
+/* Run the workload suite with min/median/max over iterations (0 for
+ * the default). Results go to the console and, if present, to the
+ * serial port as one "GFXBENCH key=value ..." line per workload */
+void gfxbench_run(int iterations);
+
+/* Compare renderers: glyph strategies, console print per flush
+ * policy, circle and particle demos and display list */
+void gfxbench_compare(void);
+
+#endif /* GFXBENCH_H */
@@ -1,13 +1,16 @@
 /*
  * idt.c - Interrupt Descriptor Table implementation
- * version 0.0.3
+ * version 0.0.8
  * Updated to use framebuffer console for error messages
+ * IRQ12 goes to the PS/2 mouse driver
  */
 
 #include "idt.h"
 #include "drivers/video/fb_console.h"
 #include "drivers/video/graphics.h"
 #include "drivers/input/keyboard.h"
+#include "drivers/input/mouse.h"
+#include "timer.h"
 #include "string.h"
 #include "utils.h"
 
@@ -226,14 +229,18 @@ void isr_handler(int int_num, uint32_t eip, uint32_t eax, uint32_t ebx, uint32_t
         "Reserved"
     };
     
-    /* Clear screen to blue */
-    gfx_clear(0x00FF0000);  /* Blue background (RGB: 0,0,255 -> 0x00FF0000 in XRGB) */
+    /* Nothing will tick anymore: queued text is drained and every print
+     * goes straight to the screen */
+    fb_set_flush_mode(FB_FLUSH_IMMEDIATE);
+    
+    /* Report on the console being looked at, whichever was printed to */
+    fb_vt_set_output(fb_vt_get_active());
     
     /* Set white text on blue background */
-    fb_set_text_color(0x00FFFFFF, 0x00FF0000);
+    fb_set_text_color(0x00FFFFFF, 0x00FF0000);  /* Blue background (RGB: 0,0,255 -> 0x00FF0000 in XRGB) */
     
-    /* Reset cursor to top-left */
-    fb_console_reset_cursor();
+    /* Clear screen to blue and reset cursor to top-left */
+    fb_console_clear();
     
     /* BSOD Header */
     fb_print("eh oh.\n\n");
@@ -276,11 +283,21 @@ void isr_handler(int int_num, uint32_t eip, uint32_t eax, uint32_t ebx, uint32_t
  * Parameters: int_num - the interrupt number (32-47)
  */
 void irq_handler(int int_num) {
+    /* Call timer handler for IRQ0 (interrupt 32) */
+    if (int_num == 32) {
+        timer_handler();
+    }
+    
     /* Call keyboard handler for IRQ1 (interrupt 33) */
     if (int_num == 33) {
         keyboard_handler();
     }
     
+    /* Call mouse handler for IRQ12 (interrupt 44) */
+    if (int_num == 44) {
+        mouse_handler();
+    }
+    
     /* Send EOI to PIC */
     outb(0x20, 0x20);
     
@@ -0,0 +1,743 @@
+/*
+ * image.c - Image file codec implementation
+ * version 0.0.3
+ * Decoding: the header is read first, then the rest of the file in
+ * chunks that end on cluster boundaries. Each chunk is pushed through
+ * the decoder, which keeps its place between chunks: a QOI op or BMP
+ * row cut by the chunk end is finished from the next one. Finished rows
+ * are converted to the back buffer format and drawn with gfx_blit, or
+ * when fitting to a rectangle scaled across with gfx_blit_scaled; rows
+ * are then repeated or dropped to scale down.
+ * Encoding: rows are encoded into a chunk buffer that is handed out
+ * whenever it fills, so files are written a whole cluster at a time.
+ */
+
+#include "image.h"
+#include "drivers/fs/fat32.h"
+#include "drivers/video/graphics.h"
+#include "drivers/video/pixfmt.h"
+#include "drivers/video/scale.h"
+#include "timer.h"
+#include "utils.h"
+
+/* Header sizes */
+#define QOI_HEADER 14
+#define BMP_HEADER 54           /* File header and BITMAPINFOHEADER */
+
+/* QOI ops */
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xC0
+#define QOI_OP_RGB   0xFE
+#define QOI_OP_RGBA  0xFF
+#define QOI_MASK     0xC0
+
+/* Longest QOI op in bytes */
+#define QOI_MAX_OP 5
+
+/* Pixels per row kept when fitting (the scaler's widest source) */
+#define ROW_MAX GFX_SCALE_MAX_WIDTH
+
+/* Decoder state */
+typedef struct {
+    int format;
+    int width, height;
+    int x, y;                   /* Where the top left pixel goes */
+    int fit_w, fit_h;           /* Size drawn at when fitting, else 0 */
+    int row;                    /* Rows finished, in file order */
+    int col;                    /* Pixels of the current row done */
+    int visible;                /* Pixels per row kept */
+    
+    uint8_t header[BMP_HEADER];
+    int header_len;
+    
+    /* QOI */
+    uint32_t index[64];         /* Recently seen pixels, ARGB */
+    uint32_t px;                /* Previous pixel, ARGB */
+    uint8_t pending[QOI_MAX_OP]; /* Op cut by the end of a chunk */
+    int pending_len;
+    
+    /* BMP */
+    uint32_t skip;              /* Bytes before the pixel data */
+    int bytes_pp;
+    int stride;                 /* Row bytes including padding */
+    int bottom_up;
+    int row_fill;               /* Bytes of a split row gathered */
+} decoder_t;
+
+static decoder_t dec;
+
+/* Chunk and row buffers; both have room for a 16-byte load past the end */
+static uint8_t chunk[IMAGE_CHUNK + 16];
+static uint8_t row_bytes[ROW_MAX * 4 + 16];
+static uint32_t row_pixels[ROW_MAX] __attribute__((aligned(16)));
+#ifdef GFX_BACKBUFFER_16
+static gfx_pixel_t row_native[GFX_MAX_WIDTH] __attribute__((aligned(16)));
+#endif
+
+/* Encoder state */
+typedef struct {
+    uint32_t index[64];         /* Recently seen pixels, ARGB */
+    uint32_t px;                /* Previous pixel, ARGB */
+    uint32_t raw;               /* Previous pixel as stored */
+    int run;                    /* Repeats of px not yet written */
+    int out_len;
+    image_write_fn write;
+    void *arg;
+    uint32_t bytes;
+    int error;
+} encoder_t;
+
+static encoder_t enc;
+
+/* Encoder output; a QOI op may run past the chunk before it is handed out */
+static uint8_t out[IMAGE_CHUNK + QOI_MAX_OP];
+
+static const uint32_t mask_rgb[4] __attribute__((aligned(16))) = {
+    0x00FFFFFF, 0x00FFFFFF, 0x00FFFFFF, 0x00FFFFFF
+};
+
+static uint32_t get_le32(const uint8_t *p) {
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+ * Draw the finished row and start the next
+ */
+static void emit_row(void) {
+    int y = dec.bottom_up ? dec.height - 1 - dec.row : dec.row;
+    
+    if (dec.fit_w) {
+        gfx_image_t image;
+        int y1 = y * dec.fit_h / dec.height;
+        int y2 = (y + 1) * dec.fit_h / dec.height;
+        
+        image.pixels = row_pixels;
+        image.format = GFX_FORMAT_XRGB8888;
+        image.width = dec.visible;
+        image.height = 1;
+        image.pitch = dec.visible * 4;
+        
+        /* Row y covers output rows y1 to y2 - 1, none when shrinking
+         * drops it */
+        if (y2 > y1) {
+            gfx_blit_scaled(&image, 0, 0, dec.visible, 1, dec.x, dec.y + y1,
+                            dec.fit_w, y2 - y1, GFX_SCALE_BILINEAR);
+        }
+    } else {
+#ifdef GFX_BACKBUFFER_16
+        pixfmt_get(16)->blit_row(row_native, row_pixels, dec.visible);
+        gfx_blit(row_native, GFX_MAX_WIDTH, 0, 0, dec.visible, 1, dec.x, dec.y + y);
+#else
+        gfx_blit(row_pixels, GFX_MAX_WIDTH, 0, 0, dec.visible, 1, dec.x, dec.y + y);
+#endif
+    }
+    dec.row++;
+    dec.col = 0;
+}
+
+/*
+ * Expand count BGR24 pixels to XRGB8888
+ * Four pixels per step: the 12 bytes are loaded at once, shifted so each
+ * pixel starts a dword, interleaved and masked. src must be readable 4
+ * bytes past the last pixel.
+ */
+static void expand_bgr24(uint32_t *dst, const uint8_t *src, int count) {
+    int i;
+    
+    for (i = 0; i + 4 <= count; i += 4) {
+        __asm__ __volatile__(
+            "movdqu (%1), %%xmm0\n\t"
+            "movdqa %%xmm0, %%xmm1\n\t"
+            "psrldq $3, %%xmm1\n\t"
+            "movdqa %%xmm0, %%xmm2\n\t"
+            "psrldq $6, %%xmm2\n\t"
+            "movdqa %%xmm0, %%xmm3\n\t"
+            "psrldq $9, %%xmm3\n\t"
+            "punpckldq %%xmm1, %%xmm0\n\t"
+            "punpckldq %%xmm3, %%xmm2\n\t"
+            "punpcklqdq %%xmm2, %%xmm0\n\t"
+            "pand %2, %%xmm0\n\t"
+            "movdqu %%xmm0, (%0)"
+            :
+            : "r"(dst + i), "r"(src + i * 3), "m"(mask_rgb)
+            : "xmm0", "xmm1", "xmm2", "xmm3", "memory"
+        );
+    }
+    for (; i < count; i++) {
+        dst[i] = src[i * 3] | ((uint32_t)src[i * 3 + 1] << 8) | ((uint32_t)src[i * 3 + 2] << 16);
+    }
+}
+
+/*
+ * Convert the visible part of one BMP row
+ */
+static void bmp_row(const uint8_t *src) {
+    int i;
+    
+    if (dec.bytes_pp == 3) {
+        expand_bgr24(row_pixels, src, dec.visible);
+    } else {
+        for (i = 0; i < dec.visible; i++) {
+            row_pixels[i] = get_le32(src + i * 4) & 0x00FFFFFF;
+        }
+    }
+    emit_row();
+}
+
+/*
+ * Decode BMP pixel data
+ * Whole rows are converted in place in the chunk; a row split across
+ * chunks is gathered in row_bytes first (visible part only)
+ */
+static void bmp_feed(const uint8_t *data, int len) {
+    int keep = dec.visible * dec.bytes_pp;
+    
+    if (dec.skip) {
+        int n = (uint32_t)len < dec.skip ? len : (int)dec.skip;
+        dec.skip -= n;
+        data += n;
+        len -= n;
+    }
+    
+    while (len > 0 && dec.row < dec.height) {
+        int n;
+        
+        if (dec.row_fill == 0 && len >= dec.stride) {
+            bmp_row(data);
+            data += dec.stride;
+            len -= dec.stride;
+            continue;
+        }
+        
+        n = dec.stride - dec.row_fill;
+        if (n > len) n = len;
+        if (dec.row_fill < keep) {
+            int copy = keep - dec.row_fill < n ? keep - dec.row_fill : n;
+            int i;
+            for (i = 0; i < copy; i++) {
+                row_bytes[dec.row_fill + i] = data[i];
+            }
+        }
+        dec.row_fill += n;
+        data += n;
+        len -= n;
+        
+        if (dec.row_fill == dec.stride) {
+            bmp_row(row_bytes);
+            dec.row_fill = 0;
+        }
+    }
+}
+
+/*
+ * Store count copies of a pixel, finishing rows as they fill
+ */
+static void qoi_put(uint32_t color, int count) {
+    color &= 0x00FFFFFF;
+    
+    while (count > 0 && dec.row < dec.height) {
+        int n = dec.width - dec.col;
+        int i, end;
+        
+        if (n > count) n = count;
+        end = dec.col + n < dec.visible ? dec.col + n : dec.visible;
+        for (i = dec.col; i < end; i++) {
+            row_pixels[i] = color;
+        }
+        dec.col += n;
+        count -= n;
+        if (dec.col == dec.width) emit_row();
+    }
+}
+
+/*
+ * Length of the QOI op starting with byte b
+ */
+static int qoi_op_len(uint8_t b) {
+    if (b == QOI_OP_RGB) return 4;
+    if (b == QOI_OP_RGBA) return 5;
+    if ((b & QOI_MASK) == QOI_OP_LUMA) return 2;
+    return 1;
+}
+
+/*
+ * Run one complete QOI op, returns its length
+ */
+static int qoi_op(const uint8_t *p) {
+    uint32_t px = dec.px;
+    uint8_t b1 = p[0];
+    int len = 1;
+    
+    if (b1 == QOI_OP_RGB) {
+        px = (px & 0xFF000000) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        len = 4;
+    } else if (b1 == QOI_OP_RGBA) {
+        px = ((uint32_t)p[4] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        len = 5;
+    } else if ((b1 & QOI_MASK) == QOI_OP_INDEX) {
+        px = dec.index[b1];
+    } else if ((b1 & QOI_MASK) == QOI_OP_RUN) {
+        qoi_put(px, (b1 & 0x3F) + 1);
+        return 1;
+    } else {
+        int r = (px >> 16) & 0xFF;
+        int g = (px >> 8) & 0xFF;
+        int b = px & 0xFF;
+        
+        if ((b1 & QOI_MASK) == QOI_OP_DIFF) {
+            r += ((b1 >> 4) & 3) - 2;
+            g += ((b1 >> 2) & 3) - 2;
+            b += (b1 & 3) - 2;
+        } else {
+            int dg = (b1 & 0x3F) - 32;
+            r += dg - 8 + ((p[1] >> 4) & 0x0F);
+            g += dg;
+            b += dg - 8 + (p[1] & 0x0F);
+            len = 2;
+        }
+        px = (px & 0xFF000000) | ((uint32_t)(r & 0xFF) << 16) |
+             ((uint32_t)(g & 0xFF) << 8) | (uint32_t)(b & 0xFF);
+    }
+    
+    dec.px = px;
+    dec.index[(((px >> 16) & 0xFF) * 3 + ((px >> 8) & 0xFF) * 5 +
+               (px & 0xFF) * 7 + (px >> 24) * 11) & 63] = px;
+    qoi_put(px, 1);
+    return len;
+}
+
+/*
+ * Decode QOI ops
+ */
+static void qoi_feed(const uint8_t *data, int len) {
+    int i = 0;
+    
+    /* Finish an op cut by the end of the last chunk */
+    if (dec.pending_len) {
+        int need = qoi_op_len(dec.pending[0]);
+        
+        while (dec.pending_len < need && i < len) {
+            dec.pending[dec.pending_len++] = data[i++];
+        }
+        if (dec.pending_len < need) return;
+        qoi_op(dec.pending);
+        dec.pending_len = 0;
+    }
+    
+    while (i < len && dec.row < dec.height) {
+        if (len - i < QOI_MAX_OP && qoi_op_len(data[i]) > len - i) {
+            while (i < len) {
+                dec.pending[dec.pending_len++] = data[i++];
+            }
+            return;
+        }
+        i += qoi_op(&data[i]);
+    }
+}
+
+/*
+ * Read and check the header, set up the decoder
+ * Returns 0 or IMAGE_ERR_FORMAT
+ */
+static int read_header(fat_file_t *file) {
+    const uint8_t *h = dec.header;
+    uint32_t width, height, bpp;
+    
+    dec.header_len = fat32_read(file, dec.header, QOI_HEADER);
+    if (dec.header_len < QOI_HEADER) return IMAGE_ERR_FORMAT;
+    
+    if (h[0] == 'q' && h[1] == 'o' && h[2] == 'i' && h[3] == 'f') {
+        width = get_be32(h + 4);
+        height = get_be32(h + 8);
+        if (h[12] != 3 && h[12] != 4) return IMAGE_ERR_FORMAT;
+        
+        dec.format = IMAGE_QOI;
+        dec.px = 0xFF000000;
+        dec.bottom_up = 0;
+    } else if (h[0] == 'B' && h[1] == 'M') {
+        int32_t signed_height;
+        
+        dec.header_len += fat32_read(file, dec.header + QOI_HEADER, BMP_HEADER - QOI_HEADER);
+        if (dec.header_len < BMP_HEADER) return IMAGE_ERR_FORMAT;
+        
+        width = get_le32(h + 18);
+        signed_height = (int32_t)get_le32(h + 22);
+        bpp = h[28] | (h[29] << 8);
+        if (get_le32(h + 14) < 40 || get_le32(h + 30) != 0) return IMAGE_ERR_FORMAT;
+        if (bpp != 24 && bpp != 32) return IMAGE_ERR_FORMAT;
+        if (get_le32(h + 10) < BMP_HEADER) return IMAGE_ERR_FORMAT;
+        
+        /* Rows are stored bottom up unless the height is negative */
+        dec.bottom_up = signed_height > 0;
+        height = signed_height > 0 ? (uint32_t)signed_height : (uint32_t)-signed_height;
+        dec.format = IMAGE_BMP;
+        dec.bytes_pp = bpp / 8;
+        dec.skip = get_le32(h + 10) - BMP_HEADER;
+    } else {
+        return IMAGE_ERR_FORMAT;
+    }
+    
+    if (width == 0 || height == 0 || width > IMAGE_MAX_SIZE || height > IMAGE_MAX_SIZE) {
+        return IMAGE_ERR_FORMAT;
+    }
+    dec.width = (int)width;
+    dec.height = (int)height;
+    dec.visible = dec.width < GFX_MAX_WIDTH ? dec.width : GFX_MAX_WIDTH;
+    if (dec.fit_w) {
+        dec.visible = dec.width < ROW_MAX ? dec.width : ROW_MAX;
+        gfx_fit_rect(dec.visible, dec.height, &dec.x, &dec.y, &dec.fit_w, &dec.fit_h);
+    }
+    dec.stride = (dec.width * dec.bytes_pp + 3) & ~3;
+    return 0;
+}
+
+/*
+ * Decode an image file onto the draw target, at its own size or fitted
+ */
+int image_view(const char *path, int x, int y, int width, int height, image_info_t *info) {
+    fat_file_t file;
+    unsigned long long start = rdtsc();
+    uint32_t want;
+    int len, i;
+    int result;
+    
+    info->format = 0;
+    info->width = 0;
+    info->height = 0;
+    info->bytes = 0;
+    info->us = 0;
+    info->memory = sizeof(dec) + sizeof(chunk) + sizeof(row_bytes) + sizeof(row_pixels);
+#ifdef GFX_BACKBUFFER_16
+    info->memory += sizeof(row_native);
+#endif
+    
+    if (fat32_open(path, &file) != 0 || file.is_directory) {
+        return IMAGE_ERR_OPEN;
+    }
+    
+    dec.format = 0;
+    dec.x = x;
+    dec.y = y;
+    dec.fit_w = width > 0 && height > 0 ? width : 0;
+    dec.fit_h = height;
+    dec.row = 0;
+    dec.col = 0;
+    dec.pending_len = 0;
+    dec.skip = 0;
+    dec.bytes_pp = 0;
+    dec.row_fill = 0;
+    for (i = 0; i < 64; i++) {
+        dec.index[i] = 0;
+    }
+    
+    result = read_header(&file);
+    info->bytes = dec.header_len > 0 ? (uint32_t)dec.header_len : 0;
+    
+    if (result == 0) {
+        info->format = dec.format;
+        info->width = dec.width;
+        info->height = dec.height;
+        
+        /* The first read stops at the end of the first cluster */
+        want = IMAGE_CHUNK - (uint32_t)dec.header_len;
+        while (dec.row < dec.height && (len = fat32_read(&file, chunk, want)) > 0) {
+            info->bytes += len;
+            if (dec.format == IMAGE_QOI) {
+                qoi_feed(chunk, len);
+            } else {
+                bmp_feed(chunk, len);
+            }
+            want = IMAGE_CHUNK;
+        }
+        if (dec.row < dec.height) {
+            result = IMAGE_ERR_DATA;
+        }
+    }
+    
+    fat32_close(&file);
+    info->us = timer_cycles_to_us((uint32_t)(rdtsc() - start));
+    return result;
+}
+
+/*
+ * Hand out a full chunk of encoder output, keeping what ran past it
+ */
+static void out_flush(void) {
+    int i;
+    
+    if (!enc.error && enc.write(out, IMAGE_CHUNK, enc.arg) != 0) {
+        enc.error = 1;
+    }
+    enc.bytes += IMAGE_CHUNK;
+    for (i = IMAGE_CHUNK; i < enc.out_len; i++) {
+        out[i - IMAGE_CHUNK] = out[i];
+    }
+    enc.out_len -= IMAGE_CHUNK;
+}
+
+/*
+ * Append bytes to the encoder output
+ */
+static void out_append(const uint8_t *data, int len) {
+    while (len > 0) {
+        int n, i;
+        
+        if (enc.out_len >= IMAGE_CHUNK) out_flush();
+        n = IMAGE_CHUNK - enc.out_len;
+        if (n > len) n = len;
+        for (i = 0; i < n; i++) {
+            out[enc.out_len + i] = data[i];
+        }
+        enc.out_len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+/*
+ * Count the pixels from i on that equal px, four compares at a time
+ */
+static int run_length(const uint32_t *row, int i, int count, uint32_t px) {
+    int start = i;
+    int mask;
+    
+    for (; i + 4 <= count; i += 4) {
+        __asm__ __volatile__(
+            "movd %2, %%xmm1\n\t"
+            "pshufd $0, %%xmm1, %%xmm1\n\t"
+            "movdqu (%1), %%xmm0\n\t"
+            "pcmpeqd %%xmm1, %%xmm0\n\t"
+            "movmskps %%xmm0, %0"
+            : "=r"(mask)
+            : "r"(row + i), "r"(px)
+            : "xmm0", "xmm1"
+        );
+        if (mask != 0xF) {
+            return i + __builtin_ctz(~mask) - start;
+        }
+    }
+    while (i < count && row[i] == px) {
+        i++;
+    }
+    return i - start;
+}
+
+/*
+ * Encode one XRGB8888 row as QOI ops
+ * Runs are found on the stored pixels; two pixels that differ only in
+ * the unused top byte just cost an index op instead of a run.
+ */
+static void qoi_encode_row(const uint32_t *row, int width) {
+    int i = 0;
+    
+    while (i < width) {
+        uint32_t raw = row[i];
+        uint32_t px, prev;
+        int hash;
+        
+        if (raw == enc.raw) {
+            int n = run_length(row, i, width, raw);
+            i += n;
+            enc.run += n;
+            while (enc.run >= 62) {
+                out[enc.out_len++] = QOI_OP_RUN | 61;
+                enc.run -= 62;
+                if (enc.out_len >= IMAGE_CHUNK) out_flush();
+            }
+            continue;
+        }
+        if (enc.run) {
+            out[enc.out_len++] = QOI_OP_RUN | (enc.run - 1);
+            enc.run = 0;
+        }
+        
+        prev = enc.px;
+        px = raw | 0xFF000000;
+        enc.raw = raw;
+        enc.px = px;
+        i++;
+        
+        hash = (((px >> 16) & 0xFF) * 3 + ((px >> 8) & 0xFF) * 5 + (px & 0xFF) * 7 + 0xFF * 11) & 63;
+        if (enc.index[hash] == px) {
+            out[enc.out_len++] = QOI_OP_INDEX | hash;
+        } else {
+            int dr = (int8_t)(((px >> 16) & 0xFF) - ((prev >> 16) & 0xFF));
+            int dg = (int8_t)(((px >> 8) & 0xFF) - ((prev >> 8) & 0xFF));
+            int db = (int8_t)((px & 0xFF) - (prev & 0xFF));
+            int dr_dg = dr - dg;
+            int db_dg = db - dg;
+            
+            enc.index[hash] = px;
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                out[enc.out_len++] = QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
+            } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                       db_dg >= -8 && db_dg <= 7) {
+                out[enc.out_len++] = QOI_OP_LUMA | (dg + 32);
+                out[enc.out_len++] = ((dr_dg + 8) << 4) | (db_dg + 8);
+            } else {
+                out[enc.out_len++] = QOI_OP_RGB;
+                out[enc.out_len++] = (px >> 16) & 0xFF;
+                out[enc.out_len++] = (px >> 8) & 0xFF;
+                out[enc.out_len++] = px & 0xFF;
+            }
+        }
+        if (enc.out_len >= IMAGE_CHUNK) out_flush();
+    }
+}
+
+/*
+ * Encode back buffer pixels to QOI or BMP
+ */
+int image_encode(int format, const gfx_pixel_t *pixels, int pitch, int width, int height,
+                 image_write_fn write, void *arg, image_info_t *info) {
+    static const uint8_t qoi_end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    unsigned long long start = rdtsc();
+    uint8_t header[BMP_HEADER];
+    int stride = (width * 3 + 3) & ~3;
+    int i, y;
+    
+    enc.write = write;
+    enc.arg = arg;
+    enc.out_len = 0;
+    enc.bytes = 0;
+    enc.error = 0;
+    
+    if (format == IMAGE_QOI) {
+        for (i = 0; i < 64; i++) {
+            enc.index[i] = 0;
+        }
+        enc.px = 0xFF000000;
+        enc.raw = 0;
+        enc.run = 0;
+        
+        header[0] = 'q';
+        header[1] = 'o';
+        header[2] = 'i';
+        header[3] = 'f';
+        put_be32(header + 4, (uint32_t)width);
+        put_be32(header + 8, (uint32_t)height);
+        header[12] = 3;         /* RGB */
+        header[13] = 0;         /* sRGB */
+        out_append(header, QOI_HEADER);
+        
+        for (y = 0; y < height && !enc.error; y++) {
+#ifdef GFX_BACKBUFFER_16
+            pixfmt_get(32)->blit_row_565(row_pixels, pixels + y * pitch, width);
+            qoi_encode_row(row_pixels, width);
+#else
+            qoi_encode_row(pixels + y * pitch, width);
+#endif
+        }
+        if (enc.run) {
+            out[enc.out_len++] = QOI_OP_RUN | (enc.run - 1);
+        }
+        out_append(qoi_end, sizeof(qoi_end));
+    } else {
+        for (i = 0; i < BMP_HEADER; i++) {
+            header[i] = 0;
+        }
+        header[0] = 'B';
+        header[1] = 'M';
+        put_le32(header + 2, BMP_HEADER + (uint32_t)stride * height);
+        put_le32(header + 10, BMP_HEADER);
+        put_le32(header + 14, 40);
+        put_le32(header + 18, (uint32_t)width);
+        put_le32(header + 22, (uint32_t)-height);  /* Top down */
+        header[26] = 1;
+        header[28] = 24;
+        put_le32(header + 34, (uint32_t)stride * height);
+        out_append(header, BMP_HEADER);
+        
+        /* The 24 bpp framebuffer format is BMP's byte order */
+        for (i = width * 3; i < stride; i++) {
+            row_bytes[i] = 0;
+        }
+        for (y = 0; y < height && !enc.error; y++) {
+#ifdef GFX_BACKBUFFER_16
+            pixfmt_get(24)->blit_row_565(row_bytes, pixels + y * pitch, width);
+#else
+            pixfmt_get(24)->blit_row(row_bytes, pixels + y * pitch, width);
+#endif
+            out_append(row_bytes, stride);
+        }
+    }
+    
+    /* The last, short chunk */
+    if (!enc.error && enc.out_len > 0 && enc.write(out, enc.out_len, enc.arg) != 0) {
+        enc.error = 1;
+    }
+    enc.bytes += enc.out_len;
+    
+    info->format = format;
+    info->width = width;
+    info->height = height;
+    info->bytes = enc.bytes;
+    info->memory = sizeof(enc) + sizeof(out) + sizeof(row_bytes);
+#ifdef GFX_BACKBUFFER_16
+    info->memory += sizeof(row_pixels);
+#endif
+    info->us = timer_cycles_to_us((uint32_t)(rdtsc() - start));
+    return enc.error ? IMAGE_ERR_WRITE : 0;
+}
+
+/*
+ * image_encode output to an open file
+ */
+static int file_write(const void *data, uint32_t len, void *arg) {
+    return fat32_write((fat_file_t *)arg, data, len) == (int)len ? 0 : -1;
+}
+
+/*
+ * Save a rectangle of the screen's back buffer to a file
+ */
+int image_save(const char *path, int format, int x, int y, int width, int height,
+               image_info_t *info) {
+    gfx_surface_t *saved;
+    const gfx_pixel_t *pixels;
+    fat_file_t file;
+    int pitch, result;
+    
+    if (x < 0) { width += x; x = 0; }
+    if (y < 0) { height += y; y = 0; }
+    if (x + width > gfx_get_width()) width = gfx_get_width() - x;
+    if (y + height > gfx_get_height()) height = gfx_get_height() - y;
+    if (width <= 0 || height <= 0) return IMAGE_ERR_FORMAT;
+    
+    /* Replace a file, never a directory */
+    if (fat32_open(path, &file) == 0) {
+        fat32_close(&file);
+        if (file.is_directory || fat32_delete(path) != 0) return IMAGE_ERR_OPEN;
+    }
+    if (fat32_create(path) != 0 || fat32_open(path, &file) != 0) {
+        return IMAGE_ERR_OPEN;
+    }
+    
+    saved = gfx_set_target((gfx_surface_t *)0);
+    pitch = gfx_get_buffer_pitch();
+    pixels = gfx_get_double_buffer() + y * pitch + x;
+    gfx_set_target(saved);
+    
+    result = image_encode(format, pixels, pitch, width, height, file_write, &file, info);
+    fat32_close(&file);
+    return result;
+}
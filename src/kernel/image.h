@@ -0,0 +1,68 @@
+/*
+ * image.h - Image file codec header
+ * version 0.0.3
+ * Streams QOI and uncompressed BMP files from the FAT32 volume onto
+ * the draw target, and screen contents back out to files
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "stdint.h"
+#include "drivers/video/graphics.h"
+
+/* Formats */
+#define IMAGE_QOI 1
+#define IMAGE_BMP 2
+
+/* Errors */
+#define IMAGE_ERR_OPEN   -1     /* No such file */
+#define IMAGE_ERR_FORMAT -2     /* Not QOI, or not a 24/32 bpp uncompressed BMP */
+#define IMAGE_ERR_DATA   -3     /* File ends before the last pixel */
+#define IMAGE_ERR_WRITE  -4     /* Output refused, e.g. disk full */
+
+/* Bytes read or written at a time (one FAT32 cluster) */
+#define IMAGE_CHUNK 4096
+
+/* Largest width or height accepted */
+#define IMAGE_MAX_SIZE 16384
+
+/* What a decode or encode did */
+typedef struct {
+    int format;                 /* IMAGE_QOI or IMAGE_BMP, 0 if unknown */
+    int width;
+    int height;
+    uint32_t bytes;             /* File bytes read or written */
+    uint32_t us;                /* Time spent, file access included */
+    uint32_t memory;            /* Codec state and buffers in bytes */
+} image_info_t;
+
+/* Output for image_encode: take len bytes, return 0, or -1 to stop */
+typedef int (*image_write_fn)(const void *data, uint32_t len, void *arg);
+
+/* Decode an image file onto the draw target
+ * With width and height 0 the top left corner goes at x, y and rows
+ * wider than GFX_MAX_WIDTH are cut. Otherwise the image is scaled up or
+ * down to fit the width x height rectangle at x, y, centered and with
+ * its aspect ratio kept; rows wider than GFX_SCALE_MAX_WIDTH are cut.
+ * The file is read a chunk at a time and each row is drawn as soon as
+ * it is complete, so nothing bigger than a chunk and a row is held.
+ * Alpha is ignored.
+ * Returns 0 or IMAGE_ERR_*; info is filled in as far as known */
+int image_view(const char *path, int x, int y, int width, int height, image_info_t *info);
+
+/* Encode width x height back buffer pixels (pitch in pixels, width at
+ * most GFX_MAX_WIDTH) as QOI or as a top-down 24-bit BMP
+ * Rows are encoded one at a time and handed to write in IMAGE_CHUNK
+ * pieces, the last one shorter. Returns 0 or IMAGE_ERR_WRITE */
+int image_encode(int format, const gfx_pixel_t *pixels, int pitch, int width, int height,
+                 image_write_fn write, void *arg, image_info_t *info);
+
+/* Save a rectangle of the screen's back buffer to a file, replacing it
+ * The rectangle is clipped to the screen. Returns 0, IMAGE_ERR_OPEN if
+ * the file cannot be created, IMAGE_ERR_FORMAT if nothing is left to
+ * save, or IMAGE_ERR_WRITE */
+int image_save(const char *path, int format, int x, int y, int width, int height,
+               image_info_t *info);
+
+#endif /* IMAGE_H */
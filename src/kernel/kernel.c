@@ -1,17 +1,21 @@
 /*
  * kernel.c - Main kernel entry point
- * version 0.0.10
+ * version 0.0.16
  */
 
 #include "utils.h"
 #include "gdt.h"
 #include "idt.h"
+#include "timer.h"
 #include "drivers/input/keyboard.h"
+#include "drivers/input/mouse.h"
+#include "drivers/video/cursor.h"
 #include "drivers/video/graphics.h"
 #include "drivers/video/fb_console.h"
 #include "cli.h"
 #include "drivers/fs/ramdisk.h"
 #include "drivers/fs/fat32.h"
+#include "drivers/serial/serial.h"
 #include "stdint.h"
 
 /* Multiboot info structure */
@@ -78,6 +82,8 @@ static void sse_init(void) {
 uint32_t *gfx_get_framebuffer_from_multiboot(void);
 int gfx_get_width_from_multiboot(void);
 int gfx_get_height_from_multiboot(void);
+int gfx_get_pitch_from_multiboot(void);
+int gfx_get_bpp_from_multiboot(void);
 
 uint32_t *gfx_get_framebuffer_from_multiboot(void) {
     if (mb_info && (mb_info->flags & (1 << 12))) {
@@ -103,6 +109,35 @@ int gfx_get_height_from_multiboot(void) {
     return 600;
 }
 
+int gfx_get_pitch_from_multiboot(void) {
+    if (mb_info && (mb_info->flags & (1 << 12))) {
+        return mb_info->framebuffer_pitch;
+    }
+    return 800 * 4;
+}
+
+int gfx_get_bpp_from_multiboot(void) {
+    if (mb_info && (mb_info->flags & (1 << 12))) {
+        return mb_info->framebuffer_bpp;
+    }
+    return 32;
+}
+
+/* Pointer packets move the cursor overlay (IRQ12) */
+static void mouse_moved(const mouse_event_t *event) {
+    cursor_move_by(event->dx, event->dy, event->stamp);
+}
+
+/* Alt+F1..F6 show virtual consoles 1 to 6 (IRQ1) */
+static int console_hotkey(unsigned char scancode, unsigned char flags) {
+    (void)flags;
+    if (scancode >= KEY_F1 && scancode < KEY_F1 + FB_VT_COUNT) {
+        fb_vt_request(scancode - KEY_F1);
+        return 1;
+    }
+    return 0;
+}
+
 /* Kernel entry point - called from boot.asm */
 void k_main(uint32_t magic, uint32_t mbi) {
     /* Save multiboot info */
@@ -164,8 +199,20 @@ void k_main(uint32_t magic, uint32_t mbi) {
     /* Initialize keyboard */
     fb_print("Initializing keyboard... ");
     keyboard_init();
+    keyboard_set_hotkey_callback(console_hotkey);
     fb_print("Done!\n");
     
+    /* Initialize PS/2 mouse and its cursor */
+    fb_print("Initializing mouse... ");
+    if (mouse_init() == 0) {
+        cursor_init();
+        mouse_set_callback(mouse_moved);
+        cursor_set_visible(1);
+        fb_print("Done!\n");
+    } else {
+        fb_print("Not present\n");
+    }
+    
     /* Initialize RAM disk */
     fb_print("Initializing RAM disk... ");
     ramdisk_init();
@@ -176,11 +223,27 @@ void k_main(uint32_t magic, uint32_t mbi) {
     fat32_init();
     fb_print("Done!\n");
     
+    /* Probe COM1 for machine-readable output (benchmarks) */
+    fb_print("Initializing serial port... ");
+    fb_print(serial_init() == 0 ? "Done!\n" : "Not present\n");
+    
+    /* Initialize timer (IRQ0) and periodic console flush */
+    fb_print("Initializing timer... ");
+    timer_init();
+    timer_register_callback(fb_console_tick, 60);
+    fb_print("Done! TSC: ");
+    fb_print_int((int)(timer_tsc_khz() / 1000));
+    fb_print(" MHz\n");
+    
     /* Enable interrupts */
     fb_print("Enabling interrupts... ");
     __asm__ __volatile__("sti");
     fb_print("Done!\n\n");
     
+    /* From here on console writes are only queued; the timer parses,
+     * renders and presents them */
+    fb_set_flush_mode(FB_FLUSH_QUEUED);
+    
     /* Start CLI */
     cli_init();
     cli_run();
@@ -0,0 +1,157 @@
+/*
+ * timer.c - PIT timer and TSC calibration implementation
+ * version 0.0.2
+ */
+
+#include "timer.h"
+#include "utils.h"
+
+/* PIT ports and input clock */
+#define PIT_CHANNEL0  0x40
+#define PIT_CHANNEL2  0x42
+#define PIT_COMMAND   0x43
+#define PIT_GATE      0x61
+#define PIT_BASE_HZ   1193182
+
+/* TSC calibration window: 10 ms on PIT channel 2 */
+#define CALIBRATE_MS  10
+
+static volatile uint32_t ticks = 0;
+static uint32_t tsc_khz = 0;
+
+/* Periodic callbacks */
+static struct {
+    void (*callback)(void);
+    uint32_t period;
+} callbacks[TIMER_MAX_CALLBACKS];
+static int callback_count = 0;
+
+/* FPU/SSE state of the interrupted code, saved around callbacks */
+static uint8_t fx_area[512] __attribute__((aligned(16)));
+
+/*
+ * Measure TSC frequency against PIT channel 2 (polled, no interrupts)
+ */
+static void calibrate_tsc(void) {
+    uint32_t count = (PIT_BASE_HZ / 1000) * CALIBRATE_MS;
+    unsigned long long start, end;
+    unsigned char gate;
+    
+    /* Gate on, speaker off */
+    gate = inb(PIT_GATE);
+    outb(PIT_GATE, (gate & ~0x02) | 0x01);
+    
+    /* Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count) */
+    outb(PIT_COMMAND, 0xB0);
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, (count >> 8) & 0xFF);
+    
+    start = rdtsc();
+    while (!(inb(PIT_GATE) & 0x20)) {
+        /* Wait for OUT2 to go high */
+    }
+    end = rdtsc();
+    
+    outb(PIT_GATE, gate);
+    
+    tsc_khz = (uint32_t)(end - start) / CALIBRATE_MS;
+}
+
+/*
+ * Initialize PIT channel 0 and enable IRQ0
+ */
+void timer_init(void) {
+    uint32_t divisor = PIT_BASE_HZ / TIMER_HZ;
+    
+    calibrate_tsc();
+    
+    /* Channel 0, lobyte/hibyte, mode 3 (square wave) */
+    outb(PIT_COMMAND, 0x36);
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+    
+    ticks = 0;
+    
+    /* Enable IRQ0 (timer) */
+    unsigned char mask = inb(0x21);
+    mask &= ~0x01;
+    outb(0x21, mask);
+}
+
+/*
+ * Timer interrupt handler
+ * Callbacks may use SSE, so the interrupted code's state is preserved
+ */
+void timer_handler(void) {
+    int i;
+    int saved = 0;
+    
+    ticks++;
+    
+    for (i = 0; i < callback_count; i++) {
+        if (ticks % callbacks[i].period == 0) {
+            if (!saved) {
+                __asm__ __volatile__("fxsave (%0)" : : "r"(fx_area) : "memory");
+                saved = 1;
+            }
+            callbacks[i].callback();
+        }
+    }
+    
+    if (saved) {
+        __asm__ __volatile__("fxrstor (%0)" : : "r"(fx_area) : "memory");
+    }
+}
+
+/*
+ * Ticks since timer_init
+ */
+uint32_t timer_ticks(void) {
+    return ticks;
+}
+
+/*
+ * Register a periodic callback
+ */
+int timer_register_callback(void (*callback)(void), uint32_t hz) {
+    if (callback_count >= TIMER_MAX_CALLBACKS || hz == 0) {
+        return -1;
+    }
+    
+    callbacks[callback_count].callback = callback;
+    callbacks[callback_count].period = hz >= TIMER_HZ ? 1 : TIMER_HZ / hz;
+    callback_count++;
+    return 0;
+}
+
+/*
+ * TSC frequency in kHz
+ */
+uint32_t timer_tsc_khz(void) {
+    return tsc_khz;
+}
+
+/*
+ * Convert a TSC cycle count to microseconds
+ */
+uint32_t timer_cycles_to_us(uint32_t cycles) {
+    uint32_t mhz = tsc_khz / 1000;
+    if (mhz == 0) {
+        return 0;
+    }
+    return cycles / mhz;
+}
+
+/*
+ * Convert a TSC cycle count to nanoseconds
+ */
+uint32_t timer_cycles_to_ns(uint32_t cycles) {
+    uint32_t mhz = tsc_khz / 1000;
+    if (mhz == 0) {
+        return 0;
+    }
+    if (cycles < 0xFFFFFFFFu / 1000) {
+        return cycles * 1000 / mhz;
+    }
+    return cycles / mhz * 1000;
+}
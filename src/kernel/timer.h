@@ -0,0 +1,40 @@
+/*
+ * timer.h - PIT timer and TSC calibration header
+ * version 0.0.2
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "stdint.h"
+
+/* Timer tick rate */
+#define TIMER_HZ 1000
+
+/* Maximum number of periodic callbacks */
+#define TIMER_MAX_CALLBACKS 4
+
+/* Initialize PIT channel 0 at TIMER_HZ and calibrate the TSC */
+void timer_init(void);
+
+/* Timer interrupt handler - called from IRQ0 */
+void timer_handler(void);
+
+/* Ticks since timer_init */
+uint32_t timer_ticks(void);
+
+/* Register a callback run from IRQ0 about hz times per second
+ * Returns 0 on success, -1 if the table is full */
+int timer_register_callback(void (*callback)(void), uint32_t hz);
+
+/* TSC frequency in kHz (0 if not calibrated) */
+uint32_t timer_tsc_khz(void);
+
+/* Convert a TSC cycle count to microseconds */
+uint32_t timer_cycles_to_us(uint32_t cycles);
+
+/* Convert a TSC cycle count to nanoseconds (microsecond resolution
+ * above about a millisecond) */
+uint32_t timer_cycles_to_ns(uint32_t cycles);
+
+#endif /* TIMER_H */
@@ -1,6 +1,6 @@
 /*
  * utils.h - Utility functions header
- * version 0.0.1
+ * version 0.0.3
  */
 
 #ifndef UTILS_H
@@ -64,10 +64,49 @@ static inline void outw(unsigned short port, unsigned short value) {
     __asm__ __volatile__("outw %0, %1" : : "a"(value), "Nd"(port));
 }
 
+static inline unsigned short inw(unsigned short port) {
+    unsigned short ret;
+    __asm__ __volatile__("inw %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
 static inline unsigned char inb(unsigned short port) {
     unsigned char ret;
     __asm__ __volatile__("inb %1, %0" : "=a"(ret) : "Nd"(port));
     return ret;
 }
 
+/* Disable interrupts, returning the previous EFLAGS for irq_restore */
+static inline unsigned int irq_save(void) {
+    unsigned int flags;
+    __asm__ __volatile__("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+/* Enable interrupts again if irq_save found them enabled */
+static inline void irq_restore(unsigned int flags) {
+    if (flags & 0x200) {
+        __asm__ __volatile__("sti" : : : "memory");
+    }
+}
+
+/* Read CPU time-stamp counter */
+static inline unsigned long long rdtsc(void) {
+    unsigned int lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+/* a * b / c with a 64-bit intermediate (mull/divl, no libgcc)
+ * Saturates when the quotient does not fit in 32 bits */
+static inline unsigned int mul_div(unsigned int a, unsigned int b, unsigned int c) {
+    unsigned int lo, hi, q;
+    
+    if (c == 0) return 0xFFFFFFFF;
+    __asm__("mull %3" : "=a"(lo), "=d"(hi) : "a"(a), "rm"(b));
+    if (hi >= c) return 0xFFFFFFFF;
+    __asm__("divl %4" : "=a"(q), "=d"(hi) : "a"(lo), "d"(hi), "rm"(c));
+    return q;
+}
+
 #endif /* UTILS_H */